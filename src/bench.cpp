@@ -0,0 +1,399 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "logformat.h"
+#include "protocol.h"
+#include "udpsession.h"
+
+// Microbenchmarks del codec de los protocolos, jsonEscape y la tabla de sesiones UDP (make bench). Cada caso
+// reporta ns/op y allocations por op y el conjunto se escribe en JSON para comparar builds: con --baseline el
+// binario sale con 1 si algún caso empeora más de --max-regression o hace más allocations.
+
+namespace {
+uint64_t gAllocations = 0;
+}
+
+void* operator new(std::size_t size) {
+    ++gAllocations;
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+constexpr uint64_t CALIBRATE_NS = 20000000ULL; // iteraciones que llenan ~20 ms
+constexpr uint64_t TARGET_NS = 200000000ULL;   // cada repetición dura ~200 ms
+constexpr int REPETITIONS = 5;                 // se reporta la más rápida: el ruido sólo suma tiempo
+constexpr size_t TABLE_CAPACITY = 4096;
+constexpr size_t TABLE_SESSIONS = 2048;
+
+using SteadyClock = std::chrono::steady_clock;
+
+// Barrera para el optimizador: el valor se considera usado y la memoria, modificada.
+template <typename T>
+inline void keep(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct BenchResult {
+    std::string name;
+    uint64_t iterations = 0;
+    double nsPerOp = 0.0;
+    double allocsPerOp = 0.0;
+};
+
+uint64_t elapsedNs(SteadyClock::time_point start) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(SteadyClock::now() - start).count());
+}
+
+template <typename Fn>
+BenchResult runBench(const std::string& name, Fn&& op) {
+    uint64_t iterations = 1;
+    while (true) {
+        const auto start = SteadyClock::now();
+        for (uint64_t i = 0; i < iterations; ++i) {
+            op();
+        }
+        const uint64_t ns = elapsedNs(start);
+        if (ns >= CALIBRATE_NS) {
+            iterations = std::max<uint64_t>(1, iterations * TARGET_NS / ns);
+            break;
+        }
+        iterations *= 2;
+    }
+
+    BenchResult result;
+    result.name = name;
+    result.iterations = iterations;
+    result.nsPerOp = 1e300;
+    for (int rep = 0; rep < REPETITIONS; ++rep) {
+        const uint64_t allocsBefore = gAllocations;
+        const auto start = SteadyClock::now();
+        for (uint64_t i = 0; i < iterations; ++i) {
+            op();
+        }
+        const uint64_t ns = elapsedNs(start);
+        result.nsPerOp = std::min(result.nsPerOp, static_cast<double>(ns) / static_cast<double>(iterations));
+        result.allocsPerOp = static_cast<double>(gAllocations - allocsBefore) / static_cast<double>(iterations);
+    }
+    return result;
+}
+
+// Claves como las de producción: sessionId consecutivos, pocas IPs (NAT) y puertos efímeros.
+std::vector<UdpSessionKey> makeKeys(size_t count, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<UdpSessionKey> keys(count);
+    for (size_t i = 0; i < count; ++i) {
+        keys[i].sessionId = 1000 + static_cast<uint32_t>(i) + seed * 0x100000U;
+        keys[i].ip = htonl(0x0A000000U + (rng() % 64U));
+        keys[i].port = static_cast<uint16_t>(32768U + rng() % 28232U);
+    }
+    return keys;
+}
+
+std::vector<BenchResult> runAll(const std::string& filter) {
+    std::vector<BenchResult> results;
+    const auto bench = [&](const std::string& name, auto&& op) {
+        if (!filter.empty() && name.find(filter) == std::string::npos) {
+            return;
+        }
+        results.push_back(runBench(name, op));
+        const BenchResult& r = results.back();
+        std::cout << std::left << std::setw(32) << r.name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(12) << r.nsPerOp << " ns/op" << std::setw(10) << r.allocsPerOp << " allocs/op"
+                  << std::setw(14) << r.iterations << " iter" << std::endl;
+    };
+
+    // TEST_START_REQ: el body que parsea el server con readLe.
+    std::vector<uint8_t> startReq;
+    appendLe<uint8_t>(startReq, 0);
+    appendLe<uint8_t>(startReq, UDP_FEATURE_LATENCY_STATS);
+    appendLe<uint16_t>(startReq, 0);
+    for (uint32_t value : {16U, 10000U, 0U, 64U, 64U}) {
+        appendLe<uint32_t>(startReq, value);
+    }
+    bench("readLe/test_start_req", [&]() {
+        size_t offset = 0;
+        uint8_t runMode = 0;
+        uint8_t features = 0;
+        uint16_t pad = 0;
+        uint32_t fields[5] = {0};
+        keep(startReq.data());
+        readLe<uint8_t>(startReq.data(), startReq.size(), offset, runMode);
+        readLe<uint8_t>(startReq.data(), startReq.size(), offset, features);
+        readLe<uint16_t>(startReq.data(), startReq.size(), offset, pad);
+        for (uint32_t& field : fields) {
+            readLe<uint32_t>(startReq.data(), startReq.size(), offset, field);
+        }
+        keep(fields[0] + fields[1] + fields[2] + fields[3] + fields[4] + runMode + features + pad);
+    });
+
+    std::vector<uint8_t> ackBody;
+    ackBody.reserve(64);
+    bench("appendLe/test_start_ack", [&]() {
+        ackBody.clear();
+        appendLe<uint32_t>(ackBody, 16);
+        appendLe<uint32_t>(ackBody, 625);
+        appendLe<uint32_t>(ackBody, 64);
+        appendLe<uint32_t>(ackBody, 64);
+        appendLe<uint8_t>(ackBody, 1);
+        appendLe<uint8_t>(ackBody, UDP_FEATURE_LATENCY_STATS);
+        appendLe<uint8_t>(ackBody, 0);
+        appendLe<uint8_t>(ackBody, 0);
+        keep(ackBody.data());
+    });
+
+    std::vector<uint8_t> upTick(12 + 12 + 64, 0);
+    size_t upTickLength = writeUdpHeader(upTick.data(), UdpMessageType::UP_TICK, 42, 7);
+    putLe<uint64_t>(upTick.data(), upTickLength, 123456789ULL);
+    putLe<uint32_t>(upTick.data(), upTickLength, 64);
+    bench("parseUdpHeader", [&]() {
+        UdpHeader header{};
+        keep(upTick.data());
+        const bool ok = parseUdpHeader(upTick.data(), upTick.size(), header);
+        keep(ok);
+        keep(header.seq);
+    });
+
+    uint8_t slot[UDP_MAX_DATAGRAM_BYTES];
+    uint32_t seq = 0;
+    bench("writeUdpHeader/down_tick", [&]() {
+        size_t length = writeUdpHeader(slot, UdpMessageType::DOWN_TICK, 42, ++seq);
+        putLe<uint64_t>(slot, length, 1);
+        putLe<uint64_t>(slot, length, 2);
+        putLe<uint64_t>(slot, length, 3);
+        putLe<uint32_t>(slot, length, 0);
+        putLe<uint32_t>(slot, length, 64);
+        keep(slot);
+        keep(length);
+    });
+
+    const std::vector<uint8_t> syncBody(24, 0x5A);
+    bench("makeUdpPacket/sync_resp", [&]() {
+        const auto packet = makeUdpPacket(UdpMessageType::SYNC_RESP, 42, ++seq, syncBody);
+        keep(packet.data());
+    });
+
+    const std::vector<uint8_t> startAck(28, 0x11);
+    bench("makeTcpFrame/start_ack", [&]() {
+        const auto frame = makeTcpFrame(TcpMessageType::START_ACK, 42, startAck);
+        keep(frame.data());
+    });
+
+    const std::vector<uint8_t> chunk(TCP_DEFAULT_CHUNK_BYTES, 0x22);
+    bench("makeTcpFrame/data_16k", [&]() {
+        const auto frame = makeTcpFrame(TcpMessageType::DATA, 42, chunk);
+        keep(frame.data());
+    });
+
+    uint8_t rawTcp[16];
+    const auto tcpFrame = makeTcpFrame(TcpMessageType::DATA, 42, {});
+    std::memcpy(rawTcp, tcpFrame.data(), sizeof(rawTcp));
+    bench("parseTcpHeader", [&]() {
+        TcpHeader header{};
+        keep(rawTcp);
+        const bool ok = parseTcpHeader(rawTcp, header);
+        keep(ok);
+        keep(header.length);
+    });
+
+    const std::string plain = "HomeScan2/3.4.1 (Android 14; Pixel 7) wifi";
+    bench("jsonEscape/plain", [&]() {
+        const std::string escaped = jsonEscape(plain);
+        keep(escaped.data());
+    });
+
+    const std::string quoted = "ssid \"Casa\\5G\"\tcanal 36\n";
+    bench("jsonEscape/escapes", [&]() {
+        const std::string escaped = jsonEscape(quoted);
+        keep(escaped.data());
+    });
+
+    // Tabla con la mitad de su capacidad ocupada, como un worker con --max-sessions alto y carga media.
+    UdpSessionTable table(TABLE_CAPACITY);
+    const std::vector<UdpSessionKey> keys = makeKeys(TABLE_SESSIONS, 1);
+    const std::vector<UdpSessionKey> misses = makeKeys(TABLE_SESSIONS, 2);
+    for (const UdpSessionKey& key : keys) {
+        table.insert(key);
+    }
+    size_t cursor = 0;
+    bench("udpSessions/find_hit", [&]() {
+        UdpSession* session = table.find(keys[cursor++ % TABLE_SESSIONS]);
+        keep(session);
+    });
+    bench("udpSessions/find_miss", [&]() {
+        UdpSession* session = table.find(misses[cursor++ % TABLE_SESSIONS]);
+        keep(session);
+    });
+    bench("udpSessions/insert_erase", [&]() {
+        const UdpSessionKey& key = misses[cursor++ % TABLE_SESSIONS];
+        UdpSession* session = table.insert(key);
+        keep(session);
+        table.erase(key);
+    });
+    return results;
+}
+
+std::string resultsJson(const std::vector<BenchResult>& results) {
+    std::ostringstream out;
+    out << "{\n  \"timestampMs\": "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+               .count()
+        << ",\n  \"compiler\": \"" << jsonEscape(__VERSION__) << "\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        // Un caso por línea: el parser de --baseline depende de esto.
+        out << "    {\"name\": \"" << jsonEscape(r.name) << "\", \"iterations\": " << r.iterations << std::fixed
+            << std::setprecision(3) << ", \"nsPerOp\": " << r.nsPerOp << ", \"allocsPerOp\": " << r.allocsPerOp
+            << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return out.str();
+}
+
+bool readNumber(const std::string& line, const std::string& key, double& value) {
+    const size_t pos = line.find("\"" + key + "\": ");
+    if (pos == std::string::npos) {
+        return false;
+    }
+    value = std::strtod(line.c_str() + pos + key.size() + 4, nullptr);
+    return true;
+}
+
+// Lee un archivo escrito por resultsJson.
+bool loadBaseline(const std::string& path, std::vector<BenchResult>& baseline) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        const size_t pos = line.find("{\"name\": \"");
+        if (pos == std::string::npos) {
+            continue;
+        }
+        BenchResult r;
+        const size_t start = pos + 10;
+        r.name = line.substr(start, line.find('"', start) - start);
+        if (readNumber(line, "nsPerOp", r.nsPerOp) && readNumber(line, "allocsPerOp", r.allocsPerOp)) {
+            baseline.push_back(r);
+        }
+    }
+    return true;
+}
+
+int compareBaseline(const std::vector<BenchResult>& results, const std::vector<BenchResult>& baseline,
+                    double maxRegressionPct) {
+    int regressions = 0;
+    std::cout << "\ncomparación con baseline (tolerancia " << maxRegressionPct << "%):\n";
+    for (const BenchResult& r : results) {
+        const auto it = std::find_if(baseline.begin(), baseline.end(),
+                                     [&r](const BenchResult& b) { return b.name == r.name; });
+        if (it == baseline.end()) {
+            std::cout << "  " << r.name << ": sin baseline\n";
+            continue;
+        }
+        const double deltaPct = it->nsPerOp > 0.0 ? (r.nsPerOp / it->nsPerOp - 1.0) * 100.0 : 0.0;
+        const bool slower = deltaPct > maxRegressionPct;
+        const bool moreAllocs = r.allocsPerOp > it->allocsPerOp + 1e-6;
+        std::cout << "  " << std::left << std::setw(30) << r.name << std::right << std::showpos << std::setw(9)
+                  << deltaPct << std::noshowpos << "% ns/op, allocs " << it->allocsPerOp << " -> " << r.allocsPerOp
+                  << (slower || moreAllocs ? "  REGRESIÓN" : "") << "\n";
+        regressions += slower || moreAllocs ? 1 : 0;
+    }
+    return regressions;
+}
+
+void printHelp(const char* prog) {
+    std::cout
+        << "Usage: " << prog << " [opciones]\n"
+        << "      --out <path>            Resultados en JSON (default bench.json)\n"
+        << "      --filter <texto>        Sólo los casos cuyo nombre contiene el texto\n"
+        << "      --baseline <path>       JSON de una corrida anterior: sale con 1 si hay regresiones\n"
+        << "      --max-regression <pct>  Empeoramiento de ns/op tolerado contra el baseline (default 10)\n"
+        << "  -h, --help                  Mostrar ayuda\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string outPath = "bench.json";
+    std::string filter;
+    std::string baselinePath;
+    double maxRegressionPct = 10.0;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "-h" || arg == "--help") {
+            printHelp(argv[0]);
+            return 0;
+        }
+        if (arg == "--out" && hasValue) {
+            outPath = argv[++i];
+        } else if (arg == "--filter" && hasValue) {
+            filter = argv[++i];
+        } else if (arg == "--baseline" && hasValue) {
+            baselinePath = argv[++i];
+        } else if (arg == "--max-regression" && hasValue) {
+            maxRegressionPct = std::atof(argv[++i]);
+        } else {
+            printHelp(argv[0]);
+            return 1;
+        }
+    }
+
+    // Se lee antes de correr: --baseline y --out pueden ser el mismo archivo.
+    std::vector<BenchResult> baseline;
+    if (!baselinePath.empty() && !loadBaseline(baselinePath, baseline)) {
+        std::cerr << "No se pudo leer el baseline " << baselinePath << std::endl;
+        return 1;
+    }
+
+    const std::vector<BenchResult> results = runAll(filter);
+    std::ofstream out(outPath);
+    out << resultsJson(results);
+    if (!out) {
+        std::cerr << "No se pudo escribir " << outPath << std::endl;
+        return 1;
+    }
+    std::cout << "resultados: " << outPath << std::endl;
+
+    if (!baselinePath.empty() && compareBaseline(results, baseline, maxRegressionPct) > 0) {
+        return 1;
+    }
+    return 0;
+}
@@ -1,278 +1,846 @@
-#include <iostream>
-#include <chrono>
-#include <cstring>
-#include <cstdlib>
-#include <string>
-#include <vector>
 #include <algorithm>
-#include <netinet/in.h>
 #include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <random>
+#include <string>
+#include <sys/prctl.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
 #include <unistd.h>
-#include <fstream>
-#include <iomanip>
-#include <ctime>
-#include <limits>
-
-using Clock = std::chrono::steady_clock;
-
-// Packet header layout used by the server. Pack it so the size is 20 bytes
-// and consistent with the Android implementation.
-#pragma pack(push, 1)
-struct PacketHeader {
-    uint32_t seq;
-    uint64_t timestamp_ns;
-    uint32_t server_id;
-    uint32_t tick_ms;
-};
-#pragma pack(pop)
-
-struct Packet {
-    uint32_t seq;
-    uint64_t timestamp_ns; // send timestamp in nanoseconds
-    uint32_t server_id;
-    uint32_t tick_ms;
-    std::vector<uint8_t> payload;
+#include <vector>
+
+#include "protocol.h"
+
+// Cliente CLI de pruebas locales: UDP v2 (SYNC, TEST_START, UP_TICK/DOWN_TICK, TEST_END) y TCP throughput en
+// las dos direcciones. Los UP_TICK salen con agenda absoluta y los DOWN_TICK se reciben en otro thread, así la
+// cadencia de envío no depende de lo que tarde procesar las respuestas.
+
+namespace {
+
+constexpr int DEFAULT_PORT = 9000;
+constexpr int SYNC_TIMEOUT_MS = 200;
+constexpr int CONTROL_TIMEOUT_MS = 500;
+constexpr int CONTROL_RETRIES = 3;
+constexpr int RX_POLL_MS = 50;
+constexpr uint64_t DRAIN_GRACE_NS = 500000000ULL; // espera de los últimos DOWN_TICK después del último envío
+constexpr size_t TCP_RECV_BUFFER_BYTES = 256 * 1024;
+constexpr uint64_t TCP_STOP_MARGIN_NS = 50000000ULL; // el STOP del upload sale antes del deadline del server
+
+enum class ClientMode : uint8_t {
+    UDP,
+    DOWNLOAD,
+    UPLOAD,
 };
 
-struct SyncRequest {
-    uint64_t client_time_ns; // t0
+struct ClientOptions {
+    std::string addr;
+    int port = DEFAULT_PORT;
+    ClientMode mode = ClientMode::UDP;
+    uint32_t sessionId = 0;
+    uint32_t count = 300;
+    uint32_t tickMs = 16;
+    uint32_t payloadUp = 64;
+    int payloadDown = -1; // -1: igual al de subida
+    bool downlinkStream = false;
+    uint32_t spinUs = 0;
+    int syncCount = 10;
+    uint32_t durationMs = 10000;
+    uint32_t chunkBytes = TCP_DEFAULT_CHUNK_BYTES;
 };
 
-struct SyncResponse {
-    uint64_t recv_time_ns; // t1
-    uint64_t send_time_ns; // t2
+// Mismo reloj que usa clock_nanosleep para la agenda de envíos.
+uint64_t monotonicNs() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// Duerme hasta `deadlineNs - spinNs` con un timer absoluto (sin deriva acumulada) y hace busy-wait el resto.
+void sleepUntil(uint64_t deadlineNs, uint64_t spinNs) {
+    if (deadlineNs > spinNs) {
+        const uint64_t wakeNs = deadlineNs - spinNs;
+        timespec ts{};
+        ts.tv_sec = static_cast<time_t>(wakeNs / 1000000000ULL);
+        ts.tv_nsec = static_cast<long>(wakeNs % 1000000000ULL);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+        }
+    }
+    while (monotonicNs() < deadlineNs) {
+    }
+}
+
+void setRecvTimeout(int fd, int timeoutMs) {
+    timeval tv{};
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+uint64_t percentile(std::vector<uint64_t>& values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    const auto index = static_cast<size_t>(p / 100.0 * static_cast<double>(values.size() - 1) + 0.5);
+    std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(index), values.end());
+    return values[index];
+}
+
+void printStats(const char* name, std::vector<uint64_t> valuesNs) {
+    if (valuesNs.empty()) {
+        std::cout << name << ": sin muestras\n";
+        return;
+    }
+    const uint64_t maxNs = *std::max_element(valuesNs.begin(), valuesNs.end());
+    std::cout << name << " (ms): n=" << valuesNs.size() << std::fixed << std::setprecision(3)
+              << " p50=" << percentile(valuesNs, 50.0) / 1e6 << " p90=" << percentile(valuesNs, 90.0) / 1e6
+              << " p99=" << percentile(valuesNs, 99.0) / 1e6 << " max=" << maxNs / 1e6 << "\n";
+}
+
+void printHelp(const char* prog) {
+    std::cout
+        << "Usage: " << prog << " -a <ip> [opciones]\n"
+        << "  -a, --addr <ip>             IPv4 del server\n"
+        << "  -p, --port <port>           Puerto UDP/TCP (default 9000)\n"
+        << "  -m, --mode <modo>           udp|download|upload (default udp)\n"
+        << "  -i, --id <id>               sessionId (default aleatorio)\n"
+        << "UDP v2:\n"
+        << "  -n, --count <n>             UP_TICK a enviar (default 300)\n"
+        << "  -t, --tick <ms>             Intervalo entre UP_TICK (default 16)\n"
+        << "  -s, --payload <bytes>       Payload de subida (default 64)\n"
+        << "      --payload-down <bytes>  Payload de bajada (default igual al de subida)\n"
+        << "      --downlink-stream       runMode 2: el server envía los DOWN_TICK con su propia agenda\n"
+        << "      --spin-us <us>          Busy-wait de los últimos µs antes de cada envío (default 0)\n"
+        << "      --sync <n>              SYNC_REQ para estimar el offset de reloj (default 10)\n"
+        << "TCP throughput:\n"
+        << "  -d, --duration <ms>         Duración del test (default 10000)\n"
+        << "      --chunk <bytes>         Payload de cada frame DATA (default 16384)\n"
+        << "  -h, --help                  Mostrar ayuda\n";
+}
+
+int connectUdp(const ClientOptions& options, sockaddr_in& server) {
+    server.sin_family = AF_INET;
+    server.sin_port = htons(static_cast<uint16_t>(options.port));
+    if (inet_pton(AF_INET, options.addr.c_str(), &server.sin_addr) != 1) {
+        std::cerr << "IP de server inválida: " << options.addr << std::endl;
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket UDP");
+        return -1;
+    }
+    int rcvBuf = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf));
+    // connect: send/recv sin dirección y el kernel descarta datagramas de otros orígenes.
+    if (connect(fd, reinterpret_cast<sockaddr*>(&server), sizeof(server)) != 0) {
+        perror("connect UDP");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Offset server - cliente del SYNC con menor RTT (el más cercano a un camino simétrico).
+bool syncClock(int fd, const ClientOptions& options, int64_t& offsetNs, uint64_t& bestRttNs) {
+    setRecvTimeout(fd, SYNC_TIMEOUT_MS);
+    bestRttNs = UINT64_MAX;
+    uint8_t buffer[UDP_MAX_DATAGRAM_BYTES];
+    for (int i = 0; i < options.syncCount; ++i) {
+        std::vector<uint8_t> body;
+        const uint64_t t0 = monotonicNs();
+        appendLe<uint64_t>(body, t0);
+        const auto packet = makeUdpPacket(UdpMessageType::SYNC_REQ, options.sessionId, static_cast<uint32_t>(i), body);
+        send(fd, packet.data(), packet.size(), 0);
+        while (true) {
+            const ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n < 0) {
+                break;
+            }
+            const uint64_t t3 = monotonicNs();
+            UdpHeader header{};
+            size_t offset = 12;
+            uint64_t echoNs = 0;
+            uint64_t t1 = 0;
+            uint64_t t2 = 0;
+            if (!parseUdpHeader(buffer, static_cast<size_t>(n), header) || header.type != UdpMessageType::SYNC_RESP ||
+                !readLe<uint64_t>(buffer, static_cast<size_t>(n), offset, echoNs) ||
+                !readLe<uint64_t>(buffer, static_cast<size_t>(n), offset, t1) ||
+                !readLe<uint64_t>(buffer, static_cast<size_t>(n), offset, t2) || echoNs != t0) {
+                continue; // respuesta de un SYNC anterior que llegó tarde
+            }
+            const uint64_t rttNs = (t3 - t0) - (t2 - t1);
+            if (rttNs < bestRttNs) {
+                bestRttNs = rttNs;
+                offsetNs = (static_cast<int64_t>(t1 - t0) + static_cast<int64_t>(t2 - t3)) / 2;
+            }
+            break;
+        }
+    }
+    return bestRttNs != UINT64_MAX;
+}
+
+struct UdpAck {
+    uint32_t tickMs = 0;
+    uint32_t count = 0;
+    uint32_t payloadUp = 0;
+    uint32_t payloadDown = 0;
+    bool accepted = false;
+    uint8_t features = 0;
 };
 
-constexpr int INIT_SYNC_COUNT = 10;
-constexpr uint64_t SYNC_INTERVAL_NS = 5ULL * 1000ULL * 1000ULL * 1000ULL;
+bool startUdpTest(int fd, const ClientOptions& options, uint8_t features, UdpAck& ack) {
+    std::vector<uint8_t> body;
+    appendLe<uint8_t>(body, options.downlinkStream ? UDP_RUN_MODE_DOWNLINK_STREAM : 1);
+    appendLe<uint8_t>(body, features);
+    appendLe<uint16_t>(body, 0);
+    appendLe<uint32_t>(body, options.tickMs);
+    appendLe<uint32_t>(body, 0);
+    appendLe<uint32_t>(body, options.count);
+    appendLe<uint32_t>(body, options.payloadUp);
+    appendLe<uint32_t>(body, static_cast<uint32_t>(options.payloadDown));
+    const auto packet = makeUdpPacket(UdpMessageType::TEST_START_REQ, options.sessionId, 0, body);
 
-static uint64_t now_ns() {
-    return std::chrono::duration_cast<std::chrono::nanoseconds>(
-        Clock::now().time_since_epoch()).count();
+    setRecvTimeout(fd, CONTROL_TIMEOUT_MS);
+    uint8_t buffer[UDP_MAX_DATAGRAM_BYTES];
+    for (int attempt = 0; attempt < CONTROL_RETRIES; ++attempt) {
+        send(fd, packet.data(), packet.size(), 0);
+        ssize_t n = 0;
+        while ((n = recv(fd, buffer, sizeof(buffer), 0)) >= 0) {
+            UdpHeader header{};
+            size_t offset = 12;
+            uint8_t accepted = 0;
+            if (!parseUdpHeader(buffer, static_cast<size_t>(n), header) ||
+                header.type != UdpMessageType::TEST_START_ACK ||
+                !readLe<uint32_t>(buffer, static_cast<size_t>(n), offset, ack.tickMs) ||
+                !readLe<uint32_t>(buffer, static_cast<size_t>(n), offset, ack.count) ||
+                !readLe<uint32_t>(buffer, static_cast<size_t>(n), offset, ack.payloadUp) ||
+                !readLe<uint32_t>(buffer, static_cast<size_t>(n), offset, ack.payloadDown) ||
+                !readLe<uint8_t>(buffer, static_cast<size_t>(n), offset, accepted)) {
+                continue;
+            }
+            readLe<uint8_t>(buffer, static_cast<size_t>(n), offset, ack.features);
+            ack.accepted = accepted != 0;
+            return true;
+        }
+    }
+    return false;
 }
 
-// Same layout as used by the Android client (packed to 24 bytes).
-#pragma pack(push, 1)
-struct Request {
-    uint32_t count;
-    uint64_t client_time_ns;
-    uint32_t client_id;
-    uint32_t payload_size;
-    uint32_t tick_request_ms;
+struct DownTickSample {
+    bool received = false;
+    uint64_t clientSendNs = 0;
+    uint64_t serverRecvNs = 0; // en el stream: instante agendado
+    uint64_t serverSendNs = 0;
+    uint64_t rxNs = 0;
+    uint32_t flags = 0;
 };
-#pragma pack(pop)
-
-static void print_help(const char* prog) {
-    std::cout << "Usage: " << prog << " [options]\n"
-              << "  -a, --addr <ip>     Server IPv4 address\n"
-              << "  -p, --port <port>   Server UDP port\n"
-              << "  -n, --count <num>   Number of packets to request (default 100)\n"
-              << "  -t, --tick <ms>     Desired tick interval in ms\n"
-              << "  -s, --payload <b>   Payload size in bytes\n"
-              << "  -i, --id <id>       Optional client identifier\n"
-              << "  -h, --help          Show this help message\n";
+
+// Thread de recepción: sólo escribe las muestras y contadores, que el thread principal lee después del join.
+class DownTickReceiver {
+public:
+    DownTickReceiver(int fd, uint32_t sessionId, uint32_t count)
+        : fd_(fd), sessionId_(sessionId), samples_(count) {}
+
+    void start() {
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    void stop() {
+        running_.store(false);
+        thread_.join();
+    }
+
+    const std::vector<DownTickSample>& samples() const { return samples_; }
+    uint64_t duplicates() const { return duplicates_; }
+    uint64_t outOfOrder() const { return outOfOrder_; }
+
+private:
+    void run() {
+        setRecvTimeout(fd_, RX_POLL_MS);
+        uint8_t buffer[UDP_MAX_DATAGRAM_BYTES];
+        int64_t maxSeq = -1;
+        while (running_.load()) {
+            const ssize_t n = recv(fd_, buffer, sizeof(buffer), 0);
+            const uint64_t rxNs = monotonicNs();
+            if (n < 0) {
+                continue;
+            }
+            UdpHeader header{};
+            size_t offset = 12;
+            DownTickSample sample;
+            if (!parseUdpHeader(buffer, static_cast<size_t>(n), header) || header.type != UdpMessageType::DOWN_TICK ||
+                header.sessionId != sessionId_ || header.seq >= samples_.size() ||
+                !readLe<uint64_t>(buffer, static_cast<size_t>(n), offset, sample.clientSendNs) ||
+                !readLe<uint64_t>(buffer, static_cast<size_t>(n), offset, sample.serverRecvNs) ||
+                !readLe<uint64_t>(buffer, static_cast<size_t>(n), offset, sample.serverSendNs) ||
+                !readLe<uint32_t>(buffer, static_cast<size_t>(n), offset, sample.flags)) {
+                continue;
+            }
+            DownTickSample& slot = samples_[header.seq];
+            if (slot.received) {
+                ++duplicates_;
+                continue;
+            }
+            if (static_cast<int64_t>(header.seq) < maxSeq) {
+                ++outOfOrder_;
+            }
+            maxSeq = std::max<int64_t>(maxSeq, header.seq);
+            sample.received = true;
+            sample.rxNs = rxNs;
+            slot = sample;
+        }
+    }
+
+    int fd_;
+    uint32_t sessionId_;
+    std::vector<DownTickSample> samples_;
+    uint64_t duplicates_ = 0;
+    uint64_t outOfOrder_ = 0;
+    std::atomic<bool> running_{true};
+    std::thread thread_;
+};
+
+// TEST_END_SUMMARY: con UDP_FEATURE_LOSS_RUNS llega en fragmentos que se concatenan por índice; sin la feature
+// es un solo datagrama con el bitmap.
+bool finishUdpTest(int fd, const ClientOptions& options, uint8_t features, uint32_t endSeq, std::vector<uint8_t>& body) {
+    const auto packet = makeUdpPacket(UdpMessageType::TEST_END_REQ, options.sessionId, endSeq, {});
+    send(fd, packet.data(), packet.size(), 0);
+    setRecvTimeout(fd, CONTROL_TIMEOUT_MS * 2);
+
+    const bool fragmented = (features & UDP_FEATURE_LOSS_RUNS) != 0;
+    std::vector<std::vector<uint8_t>> fragments;
+    size_t pending = 1;
+    uint8_t buffer[UDP_MAX_DATAGRAM_BYTES * 2];
+    while (pending > 0) {
+        const ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0) {
+            return false;
+        }
+        UdpHeader header{};
+        if (!parseUdpHeader(buffer, static_cast<size_t>(n), header) ||
+            header.type != UdpMessageType::TEST_END_SUMMARY || header.seq != endSeq) {
+            continue;
+        }
+        if (!fragmented) {
+            body.assign(buffer + 12, buffer + n);
+            return true;
+        }
+        size_t offset = 12;
+        uint16_t index = 0;
+        uint16_t count = 0;
+        if (!readLe<uint16_t>(buffer, static_cast<size_t>(n), offset, index) ||
+            !readLe<uint16_t>(buffer, static_cast<size_t>(n), offset, count) || count == 0 || index >= count) {
+            continue;
+        }
+        if (fragments.empty()) {
+            fragments.resize(count);
+            pending = count;
+        }
+        if (index < fragments.size() && fragments[index].empty()) {
+            fragments[index].assign(buffer + offset, buffer + n);
+            --pending;
+        }
+    }
+    body.clear();
+    for (const auto& fragment : fragments) {
+        body.insert(body.end(), fragment.begin(), fragment.end());
+    }
+    return true;
 }
 
-int main(int argc, char* argv[]) {
-    std::string server_ip;
-    int port = 0;
-    int count = 100;
-    uint32_t client_id = 0;
-    uint32_t payload_size = 0;
-    uint32_t tick_request_ms = 0;
-    for (int i = 1; i < argc; ++i) {
-        std::string arg = argv[i];
-        if (arg == "-h" || arg == "--help") { print_help(argv[0]); return 0; }
-        else if ((arg == "-a" || arg == "--addr") && i + 1 < argc) {
-            server_ip = argv[++i];
-        } else if ((arg == "-p" || arg == "--port") && i + 1 < argc) {
-            port = std::atoi(argv[++i]);
-        } else if ((arg == "-n" || arg == "--count") && i + 1 < argc) {
-            count = std::atoi(argv[++i]);
-        } else if ((arg == "-t" || arg == "--tick") && i + 1 < argc) {
-            tick_request_ms = std::atoi(argv[++i]);
-        } else if ((arg == "-s" || arg == "--payload") && i + 1 < argc) {
-            payload_size = std::atoi(argv[++i]);
-        } else if ((arg == "-i" || arg == "--id") && i + 1 < argc) {
-            client_id = std::atoi(argv[++i]);
-        } else {
-            print_help(argv[0]);
-            return 1;
+void printSummary(const std::vector<uint8_t>& body, uint8_t features, bool downlinkStream) {
+    size_t offset = 0;
+    uint32_t expected = 0;
+    uint32_t upReceived = 0;
+    uint32_t downSent = 0;
+    uint32_t upOutOfOrder = 0;
+    uint8_t lossFormat = UDP_LOSS_FORMAT_BITMAP;
+    uint32_t lossBytes = 0;
+    if (!readLe<uint32_t>(body.data(), body.size(), offset, expected) ||
+        !readLe<uint32_t>(body.data(), body.size(), offset, upReceived) ||
+        !readLe<uint32_t>(body.data(), body.size(), offset, downSent) ||
+        !readLe<uint32_t>(body.data(), body.size(), offset, upOutOfOrder) ||
+        ((features & UDP_FEATURE_LOSS_RUNS) != 0 && !readLe<uint8_t>(body.data(), body.size(), offset, lossFormat)) ||
+        !readLe<uint32_t>(body.data(), body.size(), offset, lossBytes) || offset + lossBytes > body.size()) {
+        std::cout << "server: resumen inválido\n";
+        return;
+    }
+
+    uint32_t lossRuns = 0;
+    uint32_t longestRun = 0;
+    if (lossFormat == UDP_LOSS_FORMAT_RUNS) {
+        size_t runOffset = offset;
+        const size_t end = offset + lossBytes;
+        uint32_t gap = 0;
+        uint32_t length = 0;
+        while (runOffset < end && readVarint(body.data(), end, runOffset, gap) &&
+               readVarint(body.data(), end, runOffset, length)) {
+            ++lossRuns;
+            longestRun = std::max(longestRun, length);
+        }
+    } else {
+        uint32_t run = 0;
+        for (uint32_t seq = 0; seq < expected && seq / 8U < lossBytes; ++seq) {
+            if ((body[offset + seq / 8U] & (1U << (seq % 8U))) == 0) {
+                lossRuns += run == 0 ? 1 : 0;
+                longestRun = std::max(longestRun, ++run);
+            } else {
+                run = 0;
+            }
         }
     }
-    if (server_ip.empty() || port == 0) {
-        print_help(argv[0]);
+    offset += lossBytes;
+
+    std::cout << "server: expected=" << expected << " upReceived=" << upReceived << " upLost=" << expected - upReceived
+              << " downSent=" << downSent << " upOutOfOrder=" << upOutOfOrder << " lossRuns=" << lossRuns
+              << " longestLossRun=" << longestRun << "\n";
+    if ((features & UDP_FEATURE_LATENCY_STATS) == 0) {
+        return;
+    }
+    const char* names[] = {"server upDelay", "server interArrivalDev", "server downScheduleDev"};
+    const size_t blocks = downlinkStream ? 3 : 2;
+    for (size_t i = 0; i < blocks; ++i) {
+        uint32_t values[5] = {0};
+        for (uint32_t& value : values) {
+            if (!readLe<uint32_t>(body.data(), body.size(), offset, value)) {
+                return;
+            }
+        }
+        std::cout << names[i] << " (µs): n=" << values[0] << " p50=" << values[1] << " p90=" << values[2]
+                  << " p99=" << values[3] << " max=" << values[4] << "\n";
+    }
+}
+
+int runUdp(const ClientOptions& options) {
+    sockaddr_in server{};
+    const int fd = connectUdp(options, server);
+    if (fd < 0) {
         return 1;
     }
 
-    int sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock < 0) {
-        perror("socket");
+    int64_t offsetNs = 0;
+    uint64_t syncRttNs = 0;
+    if (!syncClock(fd, options, offsetNs, syncRttNs)) {
+        std::cerr << "Sin respuesta a SYNC_REQ" << std::endl;
+        close(fd);
         return 1;
     }
+    std::cout << "sync: offsetMs=" << std::fixed << std::setprecision(3) << offsetNs / 1e6
+              << " rttMs=" << syncRttNs / 1e6 << "\n";
 
-    sockaddr_in server{};
-    server.sin_family = AF_INET;
-    server.sin_port = htons(port);
-    if (inet_pton(AF_INET, server_ip.c_str(), &server.sin_addr) != 1) {
-        std::cerr << "Invalid server IP" << std::endl;
+    const uint8_t requested = UDP_FEATURE_LATENCY_STATS | UDP_FEATURE_RESIDENCE | UDP_FEATURE_LOSS_RUNS;
+    UdpAck ack;
+    if (!startUdpTest(fd, options, requested, ack)) {
+        std::cerr << "Sin respuesta a TEST_START_REQ" << std::endl;
+        close(fd);
         return 1;
     }
+    if (!ack.accepted) {
+        std::cerr << "Test rechazado por el server (ocupado o parámetros inválidos)" << std::endl;
+        close(fd);
+        return 2;
+    }
+    std::cout << "start: tickMs=" << ack.tickMs << " count=" << ack.count << " payloadUp=" << ack.payloadUp
+              << " payloadDown=" << ack.payloadDown << " features=0x" << std::hex << static_cast<int>(ack.features)
+              << std::dec << (options.downlinkStream ? " runMode=2" : "") << "\n";
+
+    DownTickReceiver receiver(fd, options.sessionId, ack.count);
+    receiver.start();
+
+    // Agenda absoluta: cada UP_TICK tiene su instante t0 + seq * tick, así un envío tardío no corre los siguientes.
+    prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+    std::vector<uint8_t> packet(12 + sizeof(uint64_t) + sizeof(uint32_t) + ack.payloadUp, 0);
+    std::vector<uint64_t> sendLateNs;
+    sendLateNs.reserve(ack.count);
+    const uint64_t tickNs = static_cast<uint64_t>(ack.tickMs) * 1000000ULL;
+    const uint64_t spinNs = static_cast<uint64_t>(options.spinUs) * 1000ULL;
+    const uint64_t startNs = monotonicNs() + tickNs;
+    for (uint32_t seq = 0; seq < ack.count; ++seq) {
+        const uint64_t deadlineNs = startNs + seq * tickNs;
+        sleepUntil(deadlineNs, spinNs);
+        size_t length = writeUdpHeader(packet.data(), UdpMessageType::UP_TICK, options.sessionId, seq);
+        const uint64_t sendNs = monotonicNs();
+        putLe<uint64_t>(packet.data(), length, sendNs);
+        putLe<uint32_t>(packet.data(), length, ack.payloadUp);
+        send(fd, packet.data(), packet.size(), 0);
+        sendLateNs.push_back(sendNs - deadlineNs);
+    }
+    sleepUntil(monotonicNs() + DRAIN_GRACE_NS, 0);
+    receiver.stop();
 
-    std::vector<double> latencies;
-    char* buffer = new char[sizeof(PacketHeader) + payload_size];
-    double min_lat = std::numeric_limits<double>::max();
-    double max_lat = 0.0;
-
-    // prepare log file
-    auto t = std::chrono::system_clock::now();
-    std::time_t tt = std::chrono::system_clock::to_time_t(t);
-    std::tm* tm = std::localtime(&tt);
-    char fname[64];
-    std::strftime(fname, sizeof(fname), "client_%Y%m%d_%H%M%S.log", tm);
-    std::ofstream log(fname);
-
-    const size_t DISPLAY = 5;
-
-    // initial clock synchronization
-    sockaddr_in from{};
-    socklen_t from_len = sizeof(from);
-    uint64_t best_rtt = std::numeric_limits<uint64_t>::max();
-    int64_t offset_ns = 0;
-    for (int i = 0; i < INIT_SYNC_COUNT; ++i) {
-        SyncRequest sreq{now_ns()};
-        uint64_t t0 = sreq.client_time_ns;
-        if (sendto(sock, &sreq, sizeof(sreq), 0, (sockaddr*)&server, sizeof(server)) < 0) {
-            perror("sendto");
-            return 1;
+    const auto& samples = receiver.samples();
+    std::vector<uint64_t> rttNs;
+    std::vector<uint64_t> downDelayNs;
+    std::vector<uint64_t> jitterNs;
+    uint64_t received = 0;
+    int64_t baseDownNs = INT64_MAX;
+    int64_t prevDownNs = 0;
+    bool havePrev = false;
+    for (const DownTickSample& sample : samples) {
+        if (!sample.received) {
+            havePrev = false;
+            continue;
+        }
+        ++received;
+        if (!options.downlinkStream) {
+            // RTT sin el tiempo que el tick pasó en el server: la residencia de flags llega hasta el envío real,
+            // sendNs - recvNs sólo hasta armar el DOWN_TICK.
+            const uint64_t heldNs = (sample.flags & DOWN_TICK_FLAG_RESIDENCE) != 0
+                                        ? static_cast<uint64_t>(sample.flags >> 16U) * 1000ULL
+                                        : sample.serverSendNs - sample.serverRecvNs;
+            rttNs.push_back(sample.rxNs - sample.clientSendNs - std::min(heldNs, sample.rxNs - sample.clientSendNs));
         }
-        SyncResponse sresp{};
-        ssize_t n = recvfrom(sock, &sresp, sizeof(sresp), 0,
-                             (sockaddr*)&from, &from_len);
-        if (n < (ssize_t)sizeof(sresp)) {
-            perror("recvfrom");
-            return 1;
+        // Delay de bajada con el offset del SYNC; el jitter es |delay - delay del seq anterior|.
+        const int64_t downNs = static_cast<int64_t>(sample.rxNs) -
+                               (static_cast<int64_t>(sample.serverSendNs) - offsetNs);
+        baseDownNs = std::min(baseDownNs, downNs);
+        if (havePrev) {
+            jitterNs.push_back(static_cast<uint64_t>(std::llabs(downNs - prevDownNs)));
         }
-        uint64_t t3 = now_ns();
-        uint64_t rtt = (t3 - t0) - (sresp.send_time_ns - sresp.recv_time_ns);
-        int64_t off = ((int64_t)sresp.recv_time_ns - (int64_t)t0 +
-                       (int64_t)sresp.send_time_ns - (int64_t)t3) / 2;
-        if ((int64_t)rtt >= 0 && rtt < best_rtt) {
-            best_rtt = rtt;
-            offset_ns = off;
+        prevDownNs = downNs;
+        havePrev = true;
+    }
+    for (const DownTickSample& sample : samples) {
+        if (sample.received) {
+            downDelayNs.push_back(static_cast<uint64_t>(static_cast<int64_t>(sample.rxNs) -
+                                                        (static_cast<int64_t>(sample.serverSendNs) - offsetNs) -
+                                                        baseDownNs));
         }
     }
 
-    log << "Initial sync offset_ns=" << offset_ns
-        << " rtt_ns=" << best_rtt << "\n";
+    std::cout << "down: received=" << received << " lost=" << ack.count - received
+              << " duplicates=" << receiver.duplicates() << " outOfOrder=" << receiver.outOfOrder() << "\n";
+    printStats("sendLate", sendLateNs);
+    if (!options.downlinkStream) {
+        printStats("rtt", rttNs);
+    }
+    printStats("downDelay (sobre el mínimo)", downDelayNs);
+    printStats("downJitter", jitterNs);
 
-    // send request to server
-    Request req{};
-    req.count = static_cast<uint32_t>(count);
-    req.client_time_ns = now_ns();
-    req.client_id = client_id;
-    req.payload_size = payload_size;
-    req.tick_request_ms = tick_request_ms;
-    if (sendto(sock, &req, sizeof(req), 0, (sockaddr*)&server, sizeof(server)) < 0) {
-        perror("sendto");
-        return 1;
+    std::vector<uint8_t> summary;
+    if (finishUdpTest(fd, options, ack.features, ack.count, summary)) {
+        printSummary(summary, ack.features, options.downlinkStream);
+    } else {
+        std::cerr << "Sin TEST_END_SUMMARY del server" << std::endl;
     }
+    close(fd);
+    return 0;
+}
 
-    log << "SEND Request count=" << req.count << " client_time_ns=" << req.client_time_ns
-        << " client_id=" << req.client_id << " payload_size=" << req.payload_size
-        << " tick_request_ms=" << req.tick_request_ms << "\n";
+bool sendAll(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        const ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
 
-    uint64_t next_sync = now_ns() + SYNC_INTERVAL_NS;
-    bool waiting_sync = false;
-    uint64_t sync_t0 = 0;
+bool recvExact(int fd, uint8_t* data, size_t size) {
+    while (size > 0) {
+        const ssize_t n = recv(fd, data, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
 
-    for (int i = 0; i < count; ) {
-        uint64_t now = now_ns();
-        if (!waiting_sync && now >= next_sync) {
-            SyncRequest sreq{now};
-            sync_t0 = sreq.client_time_ns;
-            sendto(sock, &sreq, sizeof(sreq), 0, (sockaddr*)&server, sizeof(server));
-            waiting_sync = true;
-            next_sync = now + SYNC_INTERVAL_NS;
+// Lee un frame; el payload de DATA sólo se cuenta (se descarta en `scratch`) y el resto queda en `body`.
+bool readTcpFrame(int fd, TcpHeader& header, std::vector<uint8_t>& body, std::vector<uint8_t>& scratch) {
+    uint8_t raw[16];
+    if (!recvExact(fd, raw, sizeof(raw)) || !parseTcpHeader(raw, header)) {
+        return false;
+    }
+    if (header.type == TcpMessageType::DATA) {
+        size_t remaining = header.length;
+        while (remaining > 0) {
+            const size_t chunk = std::min(remaining, scratch.size());
+            if (!recvExact(fd, scratch.data(), chunk)) {
+                return false;
+            }
+            remaining -= chunk;
         }
+        return true;
+    }
+    body.resize(header.length);
+    return recvExact(fd, body.data(), body.size());
+}
 
-        sockaddr_in pkt_from{};
-        socklen_t len = sizeof(pkt_from);
-        ssize_t n = recvfrom(sock, buffer, sizeof(PacketHeader) + payload_size, 0,
-                             (sockaddr*)&pkt_from, &len);
-        if (n < 0) {
-            perror("recvfrom");
-            continue;
+int runTcp(const ClientOptions& options) {
+    sockaddr_in server{};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(static_cast<uint16_t>(options.port));
+    if (inet_pton(AF_INET, options.addr.c_str(), &server.sin_addr) != 1) {
+        std::cerr << "IP de server inválida: " << options.addr << std::endl;
+        return 1;
+    }
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&server), sizeof(server)) != 0) {
+        perror("connect TCP");
+        if (fd >= 0) {
+            close(fd);
         }
+        return 1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    const bool download = options.mode == ClientMode::DOWNLOAD;
+    std::vector<uint8_t> startBody;
+    appendLe<uint8_t>(startBody, static_cast<uint8_t>(download ? ThroughputDirection::DOWNLOAD
+                                                               : ThroughputDirection::UPLOAD));
+    appendLe<uint8_t>(startBody, 0);
+    appendLe<uint16_t>(startBody, 0);
+    appendLe<uint32_t>(startBody, options.durationMs);
+    appendLe<uint32_t>(startBody, options.chunkBytes);
+    const auto start = makeTcpFrame(TcpMessageType::START_REQ, options.sessionId, startBody);
+    const uint64_t startReqNs = monotonicNs();
+    if (!sendAll(fd, start.data(), start.size())) {
+        perror("send START_REQ");
+        close(fd);
+        return 1;
+    }
+
+    TcpHeader header{};
+    std::vector<uint8_t> body;
+    std::vector<uint8_t> scratch(TCP_RECV_BUFFER_BYTES);
+    if (!readTcpFrame(fd, header, body, scratch)) {
+        std::cerr << "Sin START_ACK del server" << std::endl;
+        close(fd);
+        return 1;
+    }
+    if (header.type == TcpMessageType::BUSY) {
+        size_t offset = 0;
+        uint32_t retryMs = 0;
+        readLe<uint32_t>(body.data(), body.size(), offset, retryMs);
+        std::cerr << "Server ocupado (BUSY), reintentar en " << retryMs << " ms" << std::endl;
+        close(fd);
+        return 2;
+    }
+    size_t offset = 0;
+    uint8_t accepted = 0;
+    uint8_t maxStreams = 0;
+    uint16_t streamIndex = 0;
+    uint32_t durationMs = 0;
+    uint32_t chunkBytes = 0;
+    uint8_t linkType = 0;
+    uint8_t pad = 0;
+    uint16_t features = 0;
+    uint32_t linkDownMbps = 0;
+    uint32_t linkUpMbps = 0;
+    if (header.type != TcpMessageType::START_ACK || !readLe<uint8_t>(body.data(), body.size(), offset, accepted) ||
+        !readLe<uint8_t>(body.data(), body.size(), offset, maxStreams) ||
+        !readLe<uint16_t>(body.data(), body.size(), offset, streamIndex) ||
+        !readLe<uint32_t>(body.data(), body.size(), offset, durationMs) ||
+        !readLe<uint32_t>(body.data(), body.size(), offset, chunkBytes) ||
+        !readLe<uint8_t>(body.data(), body.size(), offset, linkType) ||
+        !readLe<uint8_t>(body.data(), body.size(), offset, pad) ||
+        !readLe<uint16_t>(body.data(), body.size(), offset, features) ||
+        !readLe<uint32_t>(body.data(), body.size(), offset, linkDownMbps) ||
+        !readLe<uint32_t>(body.data(), body.size(), offset, linkUpMbps)) {
+        std::cerr << "START_ACK inválido" << std::endl;
+        close(fd);
+        return 1;
+    }
+    if (accepted == 0) {
+        std::cerr << "Test rechazado por el server" << std::endl;
+        close(fd);
+        return 2;
+    }
+    std::cout << "start: " << (download ? "download" : "upload") << " durationMs=" << durationMs
+              << " chunkBytes=" << chunkBytes << " serverLinkDownMbps=" << linkDownMbps
+              << " serverLinkUpMbps=" << linkUpMbps << "\n";
+
+    const uint64_t startNs = monotonicNs();
+    uint64_t clientBytes = 0;
+    uint64_t lastReportNs = startNs;
+    uint64_t lastReportBytes = 0;
+    const auto report = [&](uint64_t now) {
+        if (now - lastReportNs < 1000000000ULL) {
+            return;
+        }
+        std::cout << "  t=" << std::fixed << std::setprecision(1) << (now - startNs) / 1e9
+                  << "s Mbps=" << std::setprecision(2) << (clientBytes - lastReportBytes) * 8.0 / ((now - lastReportNs) / 1e3)
+                  << std::endl;
+        lastReportNs = now;
+        lastReportBytes = clientBytes;
+    };
 
-        uint64_t recv_time = now_ns();
-        if (waiting_sync && n == (ssize_t)sizeof(SyncResponse)) {
-            SyncResponse resp{};
-            std::memcpy(&resp, buffer, sizeof(resp));
-            uint64_t rtt = (recv_time - sync_t0) - (resp.send_time_ns - resp.recv_time_ns);
-            int64_t off = ((int64_t)resp.recv_time_ns - (int64_t)sync_t0 +
-                           (int64_t)resp.send_time_ns - (int64_t)recv_time) / 2;
-            if ((int64_t)rtt >= 0 && rtt < best_rtt) {
-                best_rtt = rtt;
-                offset_ns = off;
-                log << "SYNC update offset_ns=" << offset_ns
-                    << " rtt_ns=" << rtt << "\n";
+    bool ok = true;
+    if (download) {
+        while ((ok = readTcpFrame(fd, header, body, scratch))) {
+            if (header.type == TcpMessageType::RESULT) {
+                break;
             }
-            waiting_sync = false;
-            continue;
+            if (header.type == TcpMessageType::DATA) {
+                clientBytes += header.length;
+            }
+            report(monotonicNs());
         }
+    } else {
+        std::vector<uint8_t> payload(chunkBytes, 'u');
+        const auto data = makeTcpFrame(TcpMessageType::DATA, options.sessionId, payload);
+        // El server cuenta la duración desde que recibe START_REQ: medida desde el ACK, el STOP llegaría
+        // después de su deadline, cuando ya cerró con datos sin leer y la conexión se resetea.
+        const uint64_t durationNs = static_cast<uint64_t>(durationMs) * 1000000ULL;
+        const uint64_t endNs = startReqNs + durationNs - std::min(TCP_STOP_MARGIN_NS, durationNs / 2);
+        bool sending = true;
+        bool gotResult = false;
+        size_t frameOffset = 0;
+        uint64_t now = startNs;
+        while (now < endNs && sending && !gotResult) {
+            // Mientras sube también escucha: si el server cierra primero, el RESULT ya está en el socket.
+            pollfd pfd{fd, POLLIN | POLLOUT, 0};
+            const int timeoutMs = static_cast<int>((endNs - now + 999999ULL) / 1000000ULL);
+            if (poll(&pfd, 1, timeoutMs) < 0 && errno != EINTR) {
+                break;
+            }
+            if ((pfd.revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+                while ((ok = readTcpFrame(fd, header, body, scratch)) && header.type != TcpMessageType::RESULT) {
+                }
+                gotResult = ok;
+                break;
+            }
+            if ((pfd.revents & POLLOUT) != 0) {
+                const ssize_t n =
+                    send(fd, data.data() + frameOffset, data.size() - frameOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (n > 0) {
+                    frameOffset += static_cast<size_t>(n);
+                    if (frameOffset == data.size()) {
+                        frameOffset = 0;
+                        clientBytes += chunkBytes;
+                    }
+                } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    sending = false;
+                }
+            }
+            now = monotonicNs();
+            report(now);
+        }
+        if (!gotResult) {
+            // Un error de envío no corta el test: se completa el frame a medias (si se puede) y se busca el RESULT.
+            if (sending && sendAll(fd, data.data() + frameOffset, data.size() - frameOffset)) {
+                if (frameOffset != 0) {
+                    clientBytes += chunkBytes;
+                }
+                const auto stop = makeTcpFrame(TcpMessageType::STOP, options.sessionId, {});
+                sendAll(fd, stop.data(), stop.size());
+            }
+            while ((ok = readTcpFrame(fd, header, body, scratch)) && header.type != TcpMessageType::RESULT) {
+            }
+        }
+    }
+    const uint64_t elapsedNs = monotonicNs() - startNs;
+    close(fd);
+    if (!ok) {
+        std::cerr << "Conexión cerrada antes del RESULT" << std::endl;
+        return 1;
+    }
 
-        if (n < (ssize_t)sizeof(PacketHeader)) {
-            perror("recvfrom");
-            continue;
+    offset = 0;
+    uint64_t serverBytes = 0;
+    uint64_t serverDurationNs = 0;
+    readLe<uint64_t>(body.data(), body.size(), offset, serverBytes);
+    readLe<uint64_t>(body.data(), body.size(), offset, serverDurationNs);
+    std::cout << "client: bytes=" << clientBytes << " Mbps=" << std::fixed << std::setprecision(2)
+              << clientBytes * 8.0 / (elapsedNs / 1e3) << "\n"
+              << "server: bytes=" << serverBytes << " durationMs=" << serverDurationNs / 1000000ULL << " Mbps="
+              << (serverDurationNs > 0 ? serverBytes * 8.0 / (serverDurationNs / 1e3) : 0.0) << "\n";
+    return 0;
+}
+
+bool parseArgs(int argc, char* argv[], ClientOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if ((arg == "-a" || arg == "--addr") && hasValue) {
+            options.addr = argv[++i];
+        } else if ((arg == "-p" || arg == "--port") && hasValue) {
+            options.port = std::atoi(argv[++i]);
+        } else if ((arg == "-m" || arg == "--mode") && hasValue) {
+            const std::string mode = argv[++i];
+            if (mode == "udp") {
+                options.mode = ClientMode::UDP;
+            } else if (mode == "download") {
+                options.mode = ClientMode::DOWNLOAD;
+            } else if (mode == "upload") {
+                options.mode = ClientMode::UPLOAD;
+            } else {
+                return false;
+            }
+        } else if ((arg == "-i" || arg == "--id") && hasValue) {
+            options.sessionId = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if ((arg == "-n" || arg == "--count") && hasValue) {
+            options.count = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if ((arg == "-t" || arg == "--tick") && hasValue) {
+            options.tickMs = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if ((arg == "-s" || arg == "--payload") && hasValue) {
+            options.payloadUp = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (arg == "--payload-down" && hasValue) {
+            options.payloadDown = std::atoi(argv[++i]);
+        } else if (arg == "--downlink-stream") {
+            options.downlinkStream = true;
+        } else if (arg == "--spin-us" && hasValue) {
+            options.spinUs = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (arg == "--sync" && hasValue) {
+            options.syncCount = std::atoi(argv[++i]);
+        } else if ((arg == "-d" || arg == "--duration") && hasValue) {
+            options.durationMs = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (arg == "--chunk" && hasValue) {
+            options.chunkBytes = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else {
+            return false;
         }
-        PacketHeader hdr{};
-        std::memcpy(&hdr, buffer, sizeof(hdr));
-        Packet resp;
-        resp.seq = hdr.seq;
-        resp.timestamp_ns = hdr.timestamp_ns;
-        resp.server_id = hdr.server_id;
-        resp.tick_ms = hdr.tick_ms;
-        resp.payload.resize(payload_size);
-        if (payload_size && (size_t)n > sizeof(PacketHeader))
-            std::memcpy(resp.payload.data(), buffer + sizeof(PacketHeader),
-                        std::min<size_t>(payload_size, n - sizeof(PacketHeader)));
-
-        double latency_ms = (recv_time - (resp.timestamp_ns - offset_ns)) / 1e6;
-        latencies.push_back(latency_ms);
-        if (latency_ms < min_lat) min_lat = latency_ms;
-        if (latency_ms > max_lat) max_lat = latency_ms;
-        log << "RECV Packet seq=" << resp.seq << " server_id=" << resp.server_id
-            << " tick_ms=" << resp.tick_ms << " latency_ms=" << latency_ms << "\n";
-
-        std::cout << "\033[2J\033[H";
-        size_t start = latencies.size() > DISPLAY ? latencies.size() - DISPLAY : 0;
-        for (size_t j = start; j < latencies.size(); ++j) {
-            std::cout << "seq=" << j << " latency_ms=" << latencies[j] << "\n";
+    }
+    return !options.addr.empty() && options.port > 0 && options.port <= 65535 && options.syncCount > 0 &&
+           options.count > 0 && options.count <= UDP_MAX_PACKET_COUNT && options.tickMs >= UDP_MIN_TICK_MS &&
+           options.tickMs <= UDP_MAX_TICK_MS && options.payloadUp <= UDP_MAX_PAYLOAD_BYTES &&
+           options.payloadDown <= static_cast<int>(UDP_MAX_PAYLOAD_BYTES);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-h") == 0 || std::strcmp(argv[i], "--help") == 0) {
+            printHelp(argv[0]);
+            return 0;
         }
-        std::cout << "server_id=" << resp.server_id
-                  << " tick_ms=" << resp.tick_ms
-                  << " payload=" << resp.payload.size() << " bytes\n";
-        double sum = 0.0;
-        for (double l : latencies) sum += l;
-        double avg = latencies.empty() ? 0 : sum / latencies.size();
-        std::cout << "Packets:" << latencies.size() << " Avg(ms):" << std::fixed
-                  << std::setprecision(2) << avg
-                  << " Min:" << std::setprecision(2) << min_lat
-                  << " Max:" << std::setprecision(2) << max_lat << std::flush;
-
-        ++i;
-    }
-
-    double sum = 0;
-    for (double l : latencies) sum += l;
-    double avg = latencies.empty() ? 0 : sum / latencies.size();
-    std::cout << "\nAvg: " << avg << " ms Min: " << min_lat
-              << " ms Max: " << max_lat
-              << " ms Offset: " << offset_ns / 1e6 << " ms" << std::endl;
-
-    delete[] buffer;
-    close(sock);
-    log.close();
+    }
+    ClientOptions options;
+    if (!parseArgs(argc, argv, options)) {
+        printHelp(argv[0]);
+        return 1;
+    }
+    if (options.payloadDown < 0) {
+        options.payloadDown = static_cast<int>(options.payloadUp);
+    }
+    if (options.sessionId == 0) {
+        options.sessionId = std::random_device{}();
+    }
+    return options.mode == ClientMode::UDP ? runUdp(options) : runTcp(options);
 }
@@ -0,0 +1,1112 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <queue>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "protocol.h"
+
+// Generador de carga para dimensionar hardware: miles de sesiones UDP v2 y sesiones TCP throughput contra un
+// server, con pocos threads (cada uno con epoll, timerfd absoluto y sockets UDP con recvmmsg/sendmmsg). La carga
+// sube en steps y por step se reportan pps, percentiles de RTT de los DOWN_TICK, rechazos/BUSY y el step desde el
+// que la latencia se degrada.
+
+namespace {
+
+constexpr int DEFAULT_PORT = 9000;
+constexpr size_t UDP_BATCH = 64;
+constexpr uint32_t SESSION_ID_BASE = 0x4C000000; // "L": fácil de filtrar en los logs del server
+constexpr uint64_t NS_PER_MS = 1000000ULL;
+constexpr uint64_t CONTROL_TIMEOUT_NS = 500 * NS_PER_MS;
+constexpr uint32_t CONTROL_RETRIES = 3;
+constexpr uint64_t DRAIN_GRACE_NS = 300 * NS_PER_MS; // espera de los últimos DOWN_TICK antes del TEST_END_REQ
+constexpr uint64_t STEP_GAP_NS = 1000 * NS_PER_MS;   // margen para cerrar el step y que el server libere lugar
+constexpr uint64_t TCP_STEP_TIMEOUT_NS = 5000 * NS_PER_MS;
+constexpr uint64_t TCP_STOP_MARGIN_NS = 50 * NS_PER_MS; // el STOP del upload sale antes del deadline del server
+constexpr double LOSS_DEGRADED = 0.01;
+constexpr double REJECT_DEGRADED = 0.01; // fracción de sesiones rechazadas/BUSY/sin ACK
+constexpr size_t TCP_READ_BYTES = 256 * 1024;
+
+struct LoadOptions {
+    std::string addr;
+    int port = DEFAULT_PORT;
+    uint32_t udpSessions = 1000;
+    int udpThreads = 2;
+    int udpSockets = 16; // por thread: puertos de origen distintos para repartir entre --udp-workers del server
+    uint32_t tickMs = 16;
+    uint32_t payloadBytes = 64;
+    uint32_t tcpSessions = 0;
+    ThroughputDirection tcpDirection = ThroughputDirection::DOWNLOAD;
+    int tcpThreads = 1;
+    uint32_t chunkBytes = TCP_DEFAULT_CHUNK_BYTES;
+    int steps = 5;
+    uint32_t stepMs = 10000;
+    double degradeFactor = 2.0;
+};
+
+uint64_t monotonicNs() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+void armTimer(int timerFd, uint64_t deadlineNs) {
+    itimerspec spec{};
+    spec.it_value.tv_sec = static_cast<time_t>(deadlineNs / 1000000000ULL);
+    spec.it_value.tv_nsec = static_cast<long>(deadlineNs % 1000000000ULL);
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+        spec.it_value.tv_nsec = 1; // 0 desarmaría el timer
+    }
+    timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+// Carga del step `step` (0-based): rampa lineal hasta el total.
+uint32_t stepLoad(uint32_t total, int step, int steps) {
+    return static_cast<uint32_t>((static_cast<uint64_t>(total) * static_cast<uint64_t>(step + 1) +
+                                  static_cast<uint64_t>(steps) - 1) /
+                                 static_cast<uint64_t>(steps));
+}
+
+// Todos los threads siguen la misma agenda: no hace falta coordinarlos para arrancar cada step.
+struct StepClock {
+    uint64_t t0Ns = 0;
+    uint64_t stepNs = 0;
+    uint64_t periodNs = 0;
+
+    uint64_t stepStartNs(int step) const { return t0Ns + static_cast<uint64_t>(step) * periodNs; }
+};
+
+struct UdpStepStats {
+    uint64_t sessions = 0;
+    uint64_t accepted = 0;
+    uint64_t rejected = 0;
+    uint64_t noAck = 0;
+    uint64_t ticksSent = 0;
+    uint64_t sendErrors = 0;
+    uint64_t replies = 0;
+    uint64_t summaries = 0;
+    uint64_t serverUpReceived = 0;
+    std::vector<uint32_t> rttUs;
+    std::vector<uint32_t> sendLateUs;
+};
+
+struct TcpStepStats {
+    uint64_t sessions = 0;
+    uint64_t accepted = 0;
+    uint64_t busy = 0;
+    uint64_t rejected = 0;
+    uint64_t failed = 0;
+    uint64_t clientBytes = 0;
+    uint64_t serverBytes = 0;
+};
+
+// Resultados por step de un thread; `completedSteps` publica (release) los steps ya cerrados al thread principal.
+struct ThreadResults {
+    std::vector<UdpStepStats> udp;
+    std::vector<TcpStepStats> tcp;
+    std::atomic<int> completedSteps{0};
+};
+
+enum class UdpSessionState : uint8_t {
+    IDLE,
+    STARTING,
+    RUNNING,
+    DRAINING,
+    ENDING,
+    DONE,
+};
+
+struct LoadSession {
+    uint32_t sessionId = 0;
+    uint32_t socket = 0;
+    UdpSessionState state = UdpSessionState::IDLE;
+    uint32_t generation = 0; // invalida entradas viejas del heap
+    uint32_t attempts = 0;
+    uint32_t tickMs = 0;
+    uint32_t count = 0;
+    uint32_t nextSeq = 0;
+    uint64_t startNs = 0;
+};
+
+struct SessionDeadline {
+    uint64_t deadlineNs;
+    uint32_t index;
+    uint32_t generation;
+
+    bool operator>(const SessionDeadline& other) const { return deadlineNs > other.deadlineNs; }
+};
+
+// Lote de envío por socket para sendmmsg (sockets conectados: sin dirección por mensaje).
+class SocketTxBatch {
+public:
+    explicit SocketTxBatch(int fd) : fd_(fd), buffers_(UDP_BATCH * UDP_MAX_DATAGRAM_BYTES), iov_(UDP_BATCH),
+                                     msgs_(UDP_BATCH) {
+        for (size_t i = 0; i < UDP_BATCH; ++i) {
+            iov_[i].iov_base = buffers_.data() + i * UDP_MAX_DATAGRAM_BYTES;
+            msgs_[i].msg_hdr.msg_iov = &iov_[i];
+            msgs_[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    uint8_t* prepare(uint64_t& sendErrors) {
+        if (count_ == UDP_BATCH) {
+            flush(sendErrors);
+        }
+        return buffers_.data() + count_ * UDP_MAX_DATAGRAM_BYTES;
+    }
+
+    void commit(size_t length) { iov_[count_++].iov_len = length; }
+
+    // Devuelve cuántos salieron; los que el kernel no aceptó (buffer lleno) se cuentan como errores.
+    size_t flush(uint64_t& sendErrors) {
+        size_t sent = 0;
+        while (sent < count_) {
+            const int n = sendmmsg(fd_, msgs_.data() + sent, static_cast<unsigned int>(count_ - sent), MSG_DONTWAIT);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                sendErrors += count_ - sent;
+                break;
+            }
+            sent += static_cast<size_t>(n);
+        }
+        count_ = 0;
+        return sent;
+    }
+
+    int fd() const { return fd_; }
+
+private:
+    int fd_;
+    std::vector<uint8_t> buffers_;
+    std::vector<iovec> iov_;
+    std::vector<mmsghdr> msgs_;
+    size_t count_ = 0;
+};
+
+class UdpLoadThread {
+public:
+    UdpLoadThread(const LoadOptions& options, const sockaddr_in& server, const StepClock& clock, int index,
+                  ThreadResults& results)
+        : options_(options), server_(server), clock_(clock), index_(index), results_(results) {}
+
+    ~UdpLoadThread() {
+        for (const auto& batch : batches_) {
+            close(batch.fd());
+        }
+        if (timerFd_ >= 0) {
+            close(timerFd_);
+        }
+        if (epollFd_ >= 0) {
+            close(epollFd_);
+        }
+    }
+
+    bool setup() {
+        epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+        timerFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (epollFd_ < 0 || timerFd_ < 0) {
+            perror("epoll/timerfd loadgen");
+            return false;
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u32 = UINT32_MAX;
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, timerFd_, &ev);
+        for (int i = 0; i < options_.udpSockets; ++i) {
+            const int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&server_), sizeof(server_)) != 0) {
+                perror("socket UDP loadgen");
+                if (fd >= 0) {
+                    close(fd);
+                }
+                return false;
+            }
+            int bufBytes = 4 * 1024 * 1024;
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufBytes, sizeof(bufBytes));
+            setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufBytes, sizeof(bufBytes));
+            batches_.emplace_back(fd);
+            ev.data.u32 = static_cast<uint32_t>(i);
+            epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
+        }
+
+        // Sesión global i -> thread i % udpThreads; el sessionId identifica la sesión local sin búsquedas.
+        for (uint32_t i = static_cast<uint32_t>(index_); i < options_.udpSessions;
+             i += static_cast<uint32_t>(options_.udpThreads)) {
+            LoadSession session;
+            session.sessionId = SESSION_ID_BASE + i;
+            session.socket = static_cast<uint32_t>(sessions_.size() % batches_.size());
+            session.state = UdpSessionState::DONE;
+            sessions_.push_back(session);
+        }
+        return true;
+    }
+
+    void run() {
+        prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+        std::vector<epoll_event> events(64);
+        for (int step = 0; step < options_.steps; ++step) {
+            beginStep(step);
+            while (pending_ > 0) {
+                const uint64_t now = monotonicNs();
+                runDue(now);
+                flushAll();
+                if (pending_ == 0) {
+                    break;
+                }
+                if (!heap_.empty()) {
+                    armTimer(timerFd_, heap_.top().deadlineNs);
+                }
+                const int n = epoll_wait(epollFd_, events.data(), static_cast<int>(events.size()), 1000);
+                for (int i = 0; i < n; ++i) {
+                    if (events[static_cast<size_t>(i)].data.u32 == UINT32_MAX) {
+                        uint64_t expirations = 0;
+                        (void)read(timerFd_, &expirations, sizeof(expirations));
+                    } else {
+                        receive(batches_[events[static_cast<size_t>(i)].data.u32].fd());
+                    }
+                }
+            }
+            results_.completedSteps.store(step + 1, std::memory_order_release);
+        }
+    }
+
+private:
+    void beginStep(int step) {
+        stats_ = &results_.udp[static_cast<size_t>(step)];
+        const uint32_t active = stepLoad(options_.udpSessions, step, options_.steps);
+        const uint64_t startNs = clock_.stepStartNs(step);
+        const uint64_t tickNs = static_cast<uint64_t>(options_.tickMs) * NS_PER_MS;
+        // Los arranques se reparten dentro de un tick para no mandar todas las sesiones en la misma ráfaga.
+        for (size_t local = 0; local < sessions_.size(); ++local) {
+            const uint32_t global = sessions_[local].sessionId - SESSION_ID_BASE;
+            if (global >= active) {
+                break;
+            }
+            LoadSession& session = sessions_[local];
+            session.state = UdpSessionState::IDLE;
+            session.attempts = 0;
+            ++session.generation;
+            ++pending_;
+            ++stats_->sessions;
+            heap_.push({startNs + tickNs * global / active, static_cast<uint32_t>(local), session.generation});
+        }
+        if (pending_ == 0) {
+            return;
+        }
+        stats_->rttUs.reserve(static_cast<size_t>(pending_) * (options_.stepMs / options_.tickMs + 1));
+    }
+
+    void schedule(uint32_t index, uint64_t deadlineNs) {
+        LoadSession& session = sessions_[index];
+        ++session.generation;
+        heap_.push({deadlineNs, index, session.generation});
+    }
+
+    void finish(LoadSession& session) {
+        session.state = UdpSessionState::DONE;
+        ++session.generation;
+        --pending_;
+    }
+
+    void runDue(uint64_t now) {
+        while (!heap_.empty() && heap_.top().deadlineNs <= now) {
+            const SessionDeadline due = heap_.top();
+            heap_.pop();
+            LoadSession& session = sessions_[due.index];
+            if (due.generation != session.generation) {
+                continue;
+            }
+            switch (session.state) {
+                case UdpSessionState::IDLE:
+                case UdpSessionState::STARTING:
+                    if (session.attempts == CONTROL_RETRIES) {
+                        ++stats_->noAck;
+                        finish(session);
+                        break;
+                    }
+                    ++session.attempts;
+                    session.state = UdpSessionState::STARTING;
+                    sendTestStart(session);
+                    schedule(due.index, now + CONTROL_TIMEOUT_NS);
+                    break;
+                case UdpSessionState::RUNNING: {
+                    const uint64_t tickNs = static_cast<uint64_t>(session.tickMs) * NS_PER_MS;
+                    stats_->sendLateUs.push_back(static_cast<uint32_t>((now - due.deadlineNs) / 1000ULL));
+                    sendUpTick(session, now);
+                    if (++session.nextSeq == session.count) {
+                        session.state = UdpSessionState::DRAINING;
+                        schedule(due.index, now + DRAIN_GRACE_NS);
+                    } else {
+                        schedule(due.index, session.startNs + session.nextSeq * tickNs);
+                    }
+                    break;
+                }
+                case UdpSessionState::DRAINING:
+                    session.state = UdpSessionState::ENDING;
+                    sendControl(session, UdpMessageType::TEST_END_REQ, session.count);
+                    schedule(due.index, now + 2 * CONTROL_TIMEOUT_NS);
+                    break;
+                case UdpSessionState::ENDING:
+                    finish(session); // sin TEST_END_SUMMARY: la sesión igual expira en el server
+                    break;
+                case UdpSessionState::DONE:
+                    break;
+            }
+        }
+    }
+
+    void sendTestStart(const LoadSession& session) {
+        uint8_t* out = batches_[session.socket].prepare(stats_->sendErrors);
+        size_t length = writeUdpHeader(out, UdpMessageType::TEST_START_REQ, session.sessionId, 0);
+        putLe<uint8_t>(out, length, 0); // runMode 0: count desde la duración del step
+        putLe<uint8_t>(out, length, 0);
+        putLe<uint16_t>(out, length, 0);
+        putLe<uint32_t>(out, length, options_.tickMs);
+        putLe<uint32_t>(out, length, options_.stepMs);
+        putLe<uint32_t>(out, length, 0);
+        putLe<uint32_t>(out, length, options_.payloadBytes);
+        putLe<uint32_t>(out, length, options_.payloadBytes);
+        batches_[session.socket].commit(length);
+    }
+
+    void sendUpTick(const LoadSession& session, uint64_t now) {
+        uint8_t* out = batches_[session.socket].prepare(stats_->sendErrors);
+        size_t length = writeUdpHeader(out, UdpMessageType::UP_TICK, session.sessionId, session.nextSeq);
+        putLe<uint64_t>(out, length, now);
+        putLe<uint32_t>(out, length, options_.payloadBytes);
+        std::memset(out + length, 0, options_.payloadBytes);
+        batches_[session.socket].commit(length + options_.payloadBytes);
+        ++stats_->ticksSent;
+    }
+
+    void sendControl(const LoadSession& session, UdpMessageType type, uint32_t seq) {
+        uint8_t* out = batches_[session.socket].prepare(stats_->sendErrors);
+        batches_[session.socket].commit(writeUdpHeader(out, type, session.sessionId, seq));
+    }
+
+    void flushAll() {
+        for (auto& batch : batches_) {
+            batch.flush(stats_->sendErrors);
+        }
+    }
+
+    void receive(int fd) {
+        std::vector<uint8_t>& buffers = rxBuffers_;
+        buffers.resize(UDP_BATCH * UDP_MAX_DATAGRAM_BYTES);
+        iovec iov[UDP_BATCH];
+        mmsghdr msgs[UDP_BATCH];
+        while (true) {
+            for (size_t i = 0; i < UDP_BATCH; ++i) {
+                iov[i].iov_base = buffers.data() + i * UDP_MAX_DATAGRAM_BYTES;
+                iov[i].iov_len = UDP_MAX_DATAGRAM_BYTES;
+                std::memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            const int n = recvmmsg(fd, msgs, UDP_BATCH, MSG_DONTWAIT, nullptr);
+            if (n <= 0) {
+                return;
+            }
+            const uint64_t now = monotonicNs();
+            for (int i = 0; i < n; ++i) {
+                handleDatagram(static_cast<const uint8_t*>(iov[i].iov_base), msgs[i].msg_len, now);
+            }
+            if (static_cast<size_t>(n) < UDP_BATCH) {
+                return;
+            }
+        }
+    }
+
+    void handleDatagram(const uint8_t* data, size_t size, uint64_t now) {
+        UdpHeader header{};
+        if (!parseUdpHeader(data, size, header) || header.sessionId < SESSION_ID_BASE) {
+            return;
+        }
+        const uint32_t global = header.sessionId - SESSION_ID_BASE;
+        const uint32_t local = global / static_cast<uint32_t>(options_.udpThreads);
+        if (global % static_cast<uint32_t>(options_.udpThreads) != static_cast<uint32_t>(index_) ||
+            local >= sessions_.size()) {
+            return;
+        }
+        LoadSession& session = sessions_[local];
+        size_t offset = 12;
+
+        if (header.type == UdpMessageType::DOWN_TICK &&
+            (session.state == UdpSessionState::RUNNING || session.state == UdpSessionState::DRAINING)) {
+            uint64_t clientSendNs = 0;
+            if (readLe<uint64_t>(data, size, offset, clientSendNs) && clientSendNs <= now) {
+                ++stats_->replies;
+                stats_->rttUs.push_back(static_cast<uint32_t>(std::min<uint64_t>((now - clientSendNs) / 1000ULL,
+                                                                                 UINT32_MAX)));
+            }
+            return;
+        }
+        if (header.type == UdpMessageType::TEST_START_ACK && session.state == UdpSessionState::STARTING) {
+            uint32_t tickMs = 0;
+            uint32_t count = 0;
+            uint32_t payloadUp = 0;
+            uint32_t payloadDown = 0;
+            uint8_t accepted = 0;
+            if (!readLe<uint32_t>(data, size, offset, tickMs) || !readLe<uint32_t>(data, size, offset, count) ||
+                !readLe<uint32_t>(data, size, offset, payloadUp) ||
+                !readLe<uint32_t>(data, size, offset, payloadDown) || !readLe<uint8_t>(data, size, offset, accepted)) {
+                return;
+            }
+            if (accepted == 0 || count == 0 || tickMs == 0) {
+                ++stats_->rejected;
+                finish(session);
+                return;
+            }
+            ++stats_->accepted;
+            session.state = UdpSessionState::RUNNING;
+            session.tickMs = tickMs;
+            session.count = count;
+            session.nextSeq = 0;
+            session.startNs = now;
+            schedule(local, now);
+            return;
+        }
+        if (header.type == UdpMessageType::TEST_END_SUMMARY && session.state == UdpSessionState::ENDING) {
+            uint32_t expected = 0;
+            uint32_t upReceived = 0;
+            if (readLe<uint32_t>(data, size, offset, expected) && readLe<uint32_t>(data, size, offset, upReceived)) {
+                ++stats_->summaries;
+                stats_->serverUpReceived += upReceived;
+            }
+            finish(session);
+        }
+    }
+
+    const LoadOptions& options_;
+    sockaddr_in server_;
+    const StepClock& clock_;
+    int index_;
+    ThreadResults& results_;
+    UdpStepStats* stats_ = nullptr;
+    int epollFd_ = -1;
+    int timerFd_ = -1;
+    std::vector<SocketTxBatch> batches_;
+    std::vector<LoadSession> sessions_;
+    std::priority_queue<SessionDeadline, std::vector<SessionDeadline>, std::greater<SessionDeadline>> heap_;
+    uint32_t pending_ = 0;
+    std::vector<uint8_t> rxBuffers_;
+};
+
+enum class TcpConnState : uint8_t {
+    CONNECTING,
+    WAIT_ACK,
+    TRANSFER,
+    WAIT_RESULT,
+};
+
+struct TcpLoadConn {
+    int fd = -1;
+    uint32_t sessionId = 0;
+    TcpConnState state = TcpConnState::CONNECTING;
+    std::vector<uint8_t> pending; // frames de control a medio enviar
+    size_t pendingOffset = 0;
+    uint8_t dataHeader[16] = {0}; // el server sólo cuenta DATA/STOP con el sessionId de la conexión
+    size_t dataOffset = 0;
+    uint64_t startReqNs = 0;
+    uint64_t deadlineNs = 0;
+    uint8_t header[16] = {0};
+    size_t headerFill = 0;
+    TcpHeader current{};
+    uint32_t bodyRemaining = 0;
+    std::vector<uint8_t> body;
+};
+
+class TcpLoadThread {
+public:
+    TcpLoadThread(const LoadOptions& options, const sockaddr_in& server, const StepClock& clock, int index,
+                  ThreadResults& results)
+        : options_(options), server_(server), clock_(clock), index_(index), results_(results) {}
+
+    ~TcpLoadThread() {
+        if (epollFd_ >= 0) {
+            close(epollFd_);
+        }
+    }
+
+    bool setup() {
+        epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd_ < 0) {
+            perror("epoll loadgen TCP");
+            return false;
+        }
+        payload_.assign(options_.chunkBytes, 'l');
+        readBuffer_.resize(TCP_READ_BYTES);
+        return true;
+    }
+
+    void run() {
+        std::vector<epoll_event> events(256);
+        for (int step = 0; step < options_.steps; ++step) {
+            stats_ = &results_.tcp[static_cast<size_t>(step)];
+            const uint64_t startNs = clock_.stepStartNs(step);
+            while (monotonicNs() < startNs) {
+                const uint64_t waitMs = (startNs - monotonicNs()) / NS_PER_MS + 1;
+                std::this_thread::sleep_for(std::chrono::milliseconds(waitMs));
+            }
+            const uint32_t active = stepLoad(options_.tcpSessions, step, options_.steps);
+            for (uint32_t i = static_cast<uint32_t>(index_); i < active; i += static_cast<uint32_t>(options_.tcpThreads)) {
+                openConn(SESSION_ID_BASE + 0x800000U + i);
+            }
+            const uint64_t hardEndNs = startNs + clock_.stepNs + TCP_STEP_TIMEOUT_NS;
+            while (open_ > 0) {
+                const uint64_t now = monotonicNs();
+                if (now >= hardEndNs) {
+                    for (size_t i = 0; i < conns_.size(); ++i) {
+                        if (conns_[i].fd >= 0) {
+                            fail(i);
+                        }
+                    }
+                    break;
+                }
+                const int timeoutMs = static_cast<int>(std::min<uint64_t>((hardEndNs - now) / NS_PER_MS + 1, 100));
+                const int n = epoll_wait(epollFd_, events.data(), static_cast<int>(events.size()), timeoutMs);
+                for (int i = 0; i < n; ++i) {
+                    const size_t index = events[static_cast<size_t>(i)].data.u32;
+                    const uint32_t mask = events[static_cast<size_t>(i)].events;
+                    if (conns_[index].fd >= 0 && (mask & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0) {
+                        onReadable(index);
+                    }
+                    if (conns_[index].fd >= 0 && (mask & EPOLLOUT) != 0) {
+                        onWritable(index);
+                    }
+                }
+            }
+            conns_.clear();
+            results_.completedSteps.store(step + 1, std::memory_order_release);
+        }
+    }
+
+private:
+    void openConn(uint32_t sessionId) {
+        ++stats_->sessions;
+        const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            ++stats_->failed;
+            return;
+        }
+        if (connect(fd, reinterpret_cast<const sockaddr*>(&server_), sizeof(server_)) != 0 && errno != EINPROGRESS) {
+            close(fd);
+            ++stats_->failed;
+            return;
+        }
+        TcpLoadConn conn;
+        conn.fd = fd;
+        conn.sessionId = sessionId;
+        const auto dataHeader = makeTcpFrame(TcpMessageType::DATA, sessionId, {});
+        std::memcpy(conn.dataHeader, dataHeader.data(), sizeof(conn.dataHeader));
+        size_t lengthOffset = 12;
+        putLe<uint32_t>(conn.dataHeader, lengthOffset, options_.chunkBytes);
+        std::vector<uint8_t> body;
+        appendLe<uint8_t>(body, static_cast<uint8_t>(options_.tcpDirection));
+        appendLe<uint8_t>(body, 0);
+        appendLe<uint16_t>(body, 0);
+        appendLe<uint32_t>(body, options_.stepMs);
+        appendLe<uint32_t>(body, options_.chunkBytes);
+        conn.pending = makeTcpFrame(TcpMessageType::START_REQ, sessionId, body);
+        conns_.push_back(std::move(conn));
+
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.u32 = static_cast<uint32_t>(conns_.size() - 1);
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
+        ++open_;
+    }
+
+    void closeConn(size_t index) {
+        TcpLoadConn& conn = conns_[index];
+        epoll_ctl(epollFd_, EPOLL_CTL_DEL, conn.fd, nullptr);
+        close(conn.fd);
+        conn.fd = -1;
+        --open_;
+    }
+
+    void fail(size_t index) {
+        ++stats_->failed;
+        closeConn(index);
+    }
+
+    void wantWrite(size_t index, bool enabled) {
+        epoll_event ev{};
+        ev.events = EPOLLIN | (enabled ? EPOLLOUT : 0U);
+        ev.data.u32 = static_cast<uint32_t>(index);
+        epoll_ctl(epollFd_, EPOLL_CTL_MOD, conns_[index].fd, &ev);
+    }
+
+    void onWritable(size_t index) {
+        TcpLoadConn& conn = conns_[index];
+        if (conn.state == TcpConnState::CONNECTING) {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0) {
+                fail(index);
+                return;
+            }
+            conn.state = TcpConnState::WAIT_ACK;
+            conn.startReqNs = monotonicNs();
+        }
+        while (conn.pendingOffset < conn.pending.size()) {
+            const ssize_t n = send(conn.fd, conn.pending.data() + conn.pendingOffset,
+                                   conn.pending.size() - conn.pendingOffset, MSG_NOSIGNAL);
+            if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+                return;
+            }
+            if (n <= 0) {
+                sendFailed(index);
+                return;
+            }
+            conn.pendingOffset += static_cast<size_t>(n);
+        }
+        const bool uploading = conn.state == TcpConnState::TRANSFER &&
+                               options_.tcpDirection == ThroughputDirection::UPLOAD;
+        if (!uploading) {
+            wantWrite(index, false);
+            return;
+        }
+        // Upload: frames DATA hasta la duración; el STOP sale recién en un borde de frame.
+        while (conn.dataOffset != 0 || monotonicNs() < conn.deadlineNs) {
+            // Header propio de la conexión + payload compartido en un solo sendmsg.
+            iovec iov[2];
+            size_t iovCount = 0;
+            if (conn.dataOffset < sizeof(conn.dataHeader)) {
+                iov[iovCount++] = {conn.dataHeader + conn.dataOffset, sizeof(conn.dataHeader) - conn.dataOffset};
+                iov[iovCount++] = {payload_.data(), payload_.size()};
+            } else {
+                const size_t payloadOffset = conn.dataOffset - sizeof(conn.dataHeader);
+                iov[iovCount++] = {payload_.data() + payloadOffset, payload_.size() - payloadOffset};
+            }
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iovCount;
+            const ssize_t n = sendmsg(conn.fd, &msg, MSG_NOSIGNAL);
+            if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+                return;
+            }
+            if (n <= 0) {
+                sendFailed(index);
+                return;
+            }
+            conn.dataOffset += static_cast<size_t>(n);
+            if (conn.dataOffset == sizeof(conn.dataHeader) + payload_.size()) {
+                conn.dataOffset = 0;
+                stats_->clientBytes += options_.chunkBytes;
+            }
+        }
+        conn.state = TcpConnState::WAIT_RESULT;
+        conn.pending = makeTcpFrame(TcpMessageType::STOP, conn.sessionId, {});
+        conn.pendingOffset = 0;
+        onWritable(index);
+    }
+
+    // Durante el upload un error de envío no da la sesión por perdida: si el server ya cerró, el RESULT puede
+    // estar en el socket. Se deja de escribir y la lectura decide (RESULT o EOF/reset).
+    void sendFailed(size_t index) {
+        TcpLoadConn& conn = conns_[index];
+        if (conn.state != TcpConnState::TRANSFER && conn.state != TcpConnState::WAIT_RESULT) {
+            fail(index);
+            return;
+        }
+        conn.state = TcpConnState::WAIT_RESULT;
+        conn.pending.clear();
+        conn.pendingOffset = 0;
+        wantWrite(index, false);
+    }
+
+    void onReadable(size_t index) {
+        TcpLoadConn& conn = conns_[index];
+        const ssize_t n = recv(conn.fd, readBuffer_.data(), readBuffer_.size(), 0);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            return;
+        }
+        if (n <= 0) {
+            fail(index);
+            return;
+        }
+        const uint8_t* data = readBuffer_.data();
+        size_t size = static_cast<size_t>(n);
+        while (size > 0 && conn.fd >= 0) {
+            if (conn.headerFill < sizeof(conn.header)) {
+                const size_t take = std::min(size, sizeof(conn.header) - conn.headerFill);
+                std::memcpy(conn.header + conn.headerFill, data, take);
+                conn.headerFill += take;
+                data += take;
+                size -= take;
+                if (conn.headerFill < sizeof(conn.header)) {
+                    break;
+                }
+                if (!parseTcpHeader(conn.header, conn.current)) {
+                    fail(index);
+                    return;
+                }
+                conn.bodyRemaining = conn.current.length;
+                conn.body.clear();
+            }
+            const size_t take = std::min<size_t>(size, conn.bodyRemaining);
+            if (conn.current.type == TcpMessageType::DATA) {
+                stats_->clientBytes += take;
+            } else {
+                conn.body.insert(conn.body.end(), data, data + take);
+            }
+            data += take;
+            size -= take;
+            conn.bodyRemaining -= static_cast<uint32_t>(take);
+            if (conn.bodyRemaining == 0) {
+                conn.headerFill = 0;
+                handleFrame(index);
+            }
+        }
+    }
+
+    void handleFrame(size_t index) {
+        TcpLoadConn& conn = conns_[index];
+        size_t offset = 0;
+        if (conn.current.type == TcpMessageType::BUSY) {
+            ++stats_->busy;
+            closeConn(index);
+        } else if (conn.current.type == TcpMessageType::START_ACK && conn.state == TcpConnState::WAIT_ACK) {
+            uint8_t accepted = 0;
+            uint8_t maxStreams = 0;
+            uint16_t streamIndex = 0;
+            uint32_t durationMs = 0;
+            if (!readLe<uint8_t>(conn.body.data(), conn.body.size(), offset, accepted) ||
+                !readLe<uint8_t>(conn.body.data(), conn.body.size(), offset, maxStreams) ||
+                !readLe<uint16_t>(conn.body.data(), conn.body.size(), offset, streamIndex) ||
+                !readLe<uint32_t>(conn.body.data(), conn.body.size(), offset, durationMs) || accepted == 0) {
+                ++stats_->rejected;
+                closeConn(index);
+                return;
+            }
+            ++stats_->accepted;
+            conn.state = TcpConnState::TRANSFER;
+            // El server cuenta la duración desde que recibe START_REQ: medida desde el ACK el STOP llegaría
+            // tarde y el server cerraría con datos sin leer.
+            const uint64_t durationNs = static_cast<uint64_t>(durationMs) * NS_PER_MS;
+            conn.deadlineNs = conn.startReqNs + durationNs - std::min(TCP_STOP_MARGIN_NS, durationNs / 2);
+            if (options_.tcpDirection == ThroughputDirection::UPLOAD) {
+                wantWrite(index, true);
+            }
+        } else if (conn.current.type == TcpMessageType::RESULT) {
+            uint64_t bytes = 0;
+            readLe<uint64_t>(conn.body.data(), conn.body.size(), offset, bytes);
+            stats_->serverBytes += bytes;
+            closeConn(index);
+        }
+    }
+
+    const LoadOptions& options_;
+    sockaddr_in server_;
+    const StepClock& clock_;
+    int index_;
+    ThreadResults& results_;
+    TcpStepStats* stats_ = nullptr;
+    int epollFd_ = -1;
+    std::vector<TcpLoadConn> conns_;
+    size_t open_ = 0;
+    std::vector<uint8_t> payload_;
+    std::vector<uint8_t> readBuffer_;
+};
+
+uint32_t percentileUs(std::vector<uint32_t>& values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    const auto index = static_cast<size_t>(p / 100.0 * static_cast<double>(values.size() - 1) + 0.5);
+    std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(index), values.end());
+    return values[index];
+}
+
+struct StepReport {
+    uint32_t udpSessions = 0;
+    uint32_t rttP99Us = 0;
+    double loss = 0.0;
+    uint64_t rejects = 0;
+    double rejectRate = 0.0; // rejects sobre las sesiones UDP + TCP del step
+};
+
+StepReport printStep(int step, const LoadOptions& options, std::vector<ThreadResults>& udpResults,
+                     std::vector<ThreadResults>& tcpResults) {
+    UdpStepStats udp;
+    for (auto& results : udpResults) {
+        UdpStepStats& part = results.udp[static_cast<size_t>(step)];
+        udp.sessions += part.sessions;
+        udp.accepted += part.accepted;
+        udp.rejected += part.rejected;
+        udp.noAck += part.noAck;
+        udp.ticksSent += part.ticksSent;
+        udp.sendErrors += part.sendErrors;
+        udp.replies += part.replies;
+        udp.summaries += part.summaries;
+        udp.serverUpReceived += part.serverUpReceived;
+        udp.rttUs.insert(udp.rttUs.end(), part.rttUs.begin(), part.rttUs.end());
+        udp.sendLateUs.insert(udp.sendLateUs.end(), part.sendLateUs.begin(), part.sendLateUs.end());
+        part.rttUs = std::vector<uint32_t>();
+        part.sendLateUs = std::vector<uint32_t>();
+    }
+    TcpStepStats tcp;
+    for (auto& results : tcpResults) {
+        const TcpStepStats& part = results.tcp[static_cast<size_t>(step)];
+        tcp.sessions += part.sessions;
+        tcp.accepted += part.accepted;
+        tcp.busy += part.busy;
+        tcp.rejected += part.rejected;
+        tcp.failed += part.failed;
+        tcp.clientBytes += part.clientBytes;
+        tcp.serverBytes += part.serverBytes;
+    }
+
+    const double seconds = options.stepMs / 1e3;
+    StepReport report;
+    report.udpSessions = static_cast<uint32_t>(udp.sessions);
+    report.loss = udp.ticksSent > 0 ? 1.0 - static_cast<double>(udp.replies) / static_cast<double>(udp.ticksSent)
+                                    : 0.0;
+    report.rejects = udp.rejected + udp.noAck + tcp.busy + tcp.rejected;
+    const uint64_t sessions = udp.sessions + tcp.sessions;
+    report.rejectRate = sessions > 0 ? static_cast<double>(report.rejects) / static_cast<double>(sessions) : 0.0;
+    const uint32_t rttMaxUs = udp.rttUs.empty() ? 0 : *std::max_element(udp.rttUs.begin(), udp.rttUs.end());
+    const uint32_t p50 = percentileUs(udp.rttUs, 50.0);
+    const uint32_t p99 = percentileUs(udp.rttUs, 99.0);
+    const uint32_t p999 = percentileUs(udp.rttUs, 99.9);
+    report.rttP99Us = p99;
+    const uint32_t sendLateP99Us = percentileUs(udp.sendLateUs, 99.0);
+
+    std::cout << std::fixed << std::setprecision(3) << "step " << step + 1 << "/" << options.steps
+              << " udp sesiones=" << udp.sessions << " aceptadas=" << udp.accepted << " rechazadas=" << udp.rejected
+              << " sinAck=" << udp.noAck << " txPps=" << static_cast<uint64_t>(udp.ticksSent / seconds)
+              << " rxPps=" << static_cast<uint64_t>(udp.replies / seconds) << " pérdida=" << report.loss * 100.0
+              << "% upPerdidosServer=" << (udp.summaries > 0 ? udp.ticksSent - std::min(udp.ticksSent,
+                                                                                      udp.serverUpReceived)
+                                                               : 0)
+              << " erroresEnvío=" << udp.sendErrors << "\n"
+              << "       rttMs p50=" << p50 / 1e3 << " p99=" << p99 / 1e3 << " p999=" << p999 / 1e3
+              << " max=" << rttMaxUs / 1e3 << " envíoTardeP99Ms=" << sendLateP99Us / 1e3 << "\n";
+    if (udp.accepted * 2 < udp.sessions) {
+        std::cout << "       aviso: sólo " << udp.accepted << " de " << udp.sessions
+                  << " sesiones UDP medidas; el RTT de las demás no entra en los percentiles\n";
+    }
+    if (sendLateP99Us * 2ULL > options.tickMs * 1000ULL) {
+        std::cout << "       aviso: el generador no sostiene la agenda de UP_TICK; la latencia de este step puede "
+                     "ser del cliente (más --udp-threads o otra máquina)\n";
+    }
+    if (tcp.sessions > 0) {
+        std::cout << std::setprecision(2) << "       tcp sesiones=" << tcp.sessions << " aceptadas=" << tcp.accepted
+                  << " busy=" << tcp.busy << " rechazadas=" << tcp.rejected << " fallidas=" << tcp.failed
+                  << " clientMbps=" << tcp.clientBytes * 8.0 / seconds / 1e6
+                  << " serverMbps=" << tcp.serverBytes * 8.0 / seconds / 1e6 << "\n";
+    }
+    std::cout.flush();
+    return report;
+}
+
+void printHelp(const char* prog) {
+    std::cout
+        << "Usage: " << prog << " -a <ip> [opciones]\n"
+        << "  -a, --addr <ip>             IPv4 del server\n"
+        << "  -p, --port <port>           Puerto UDP/TCP (default 9000)\n"
+        << "      --steps <n>             Steps de la rampa de carga (default 5)\n"
+        << "  -d, --step-ms <ms>          Duración de cada step (default 10000)\n"
+        << "      --degrade-factor <x>    Factor sobre el step 1 (p99 de RTT, pérdida, rechazos) que es degradación (default 2)\n"
+        << "UDP v2:\n"
+        << "  -u, --udp-sessions <n>      Sesiones UDP en el último step (default 1000)\n"
+        << "      --udp-threads <n>       Threads UDP (default 2)\n"
+        << "      --udp-sockets <n>       Sockets UDP por thread (default 16)\n"
+        << "  -t, --tick <ms>             Intervalo entre UP_TICK (default 16)\n"
+        << "  -s, --payload <bytes>       Payload de subida y bajada (default 64)\n"
+        << "TCP throughput:\n"
+        << "      --tcp-sessions <n>      Sesiones TCP en el último step (default 0)\n"
+        << "      --tcp-direction <dir>   download|upload (default download)\n"
+        << "      --tcp-threads <n>       Threads TCP (default 1)\n"
+        << "      --chunk <bytes>         Payload de cada frame DATA (default 16384)\n"
+        << "  -h, --help                  Mostrar ayuda\n";
+}
+
+bool parseArgs(int argc, char* argv[], LoadOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if ((arg == "-a" || arg == "--addr") && hasValue) {
+            options.addr = argv[++i];
+        } else if ((arg == "-p" || arg == "--port") && hasValue) {
+            options.port = std::atoi(argv[++i]);
+        } else if (arg == "--steps" && hasValue) {
+            options.steps = std::atoi(argv[++i]);
+        } else if ((arg == "-d" || arg == "--step-ms") && hasValue) {
+            options.stepMs = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (arg == "--degrade-factor" && hasValue) {
+            options.degradeFactor = std::atof(argv[++i]);
+        } else if ((arg == "-u" || arg == "--udp-sessions") && hasValue) {
+            options.udpSessions = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (arg == "--udp-threads" && hasValue) {
+            options.udpThreads = std::atoi(argv[++i]);
+        } else if (arg == "--udp-sockets" && hasValue) {
+            options.udpSockets = std::atoi(argv[++i]);
+        } else if ((arg == "-t" || arg == "--tick") && hasValue) {
+            options.tickMs = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if ((arg == "-s" || arg == "--payload") && hasValue) {
+            options.payloadBytes = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (arg == "--tcp-sessions" && hasValue) {
+            options.tcpSessions = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (arg == "--tcp-direction" && hasValue) {
+            const std::string direction = argv[++i];
+            if (direction == "download") {
+                options.tcpDirection = ThroughputDirection::DOWNLOAD;
+            } else if (direction == "upload") {
+                options.tcpDirection = ThroughputDirection::UPLOAD;
+            } else {
+                return false;
+            }
+        } else if (arg == "--tcp-threads" && hasValue) {
+            options.tcpThreads = std::atoi(argv[++i]);
+        } else if (arg == "--chunk" && hasValue) {
+            options.chunkBytes = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else {
+            return false;
+        }
+    }
+    return !options.addr.empty() && options.port > 0 && options.port <= 65535 && options.steps > 0 &&
+           options.stepMs >= TCP_MIN_DURATION_MS && options.stepMs <= TCP_MAX_DURATION_MS &&
+           options.udpThreads > 0 && options.udpThreads <= 64 && options.udpSockets > 0 &&
+           options.udpSockets <= 1024 && options.tickMs >= UDP_MIN_TICK_MS && options.tickMs <= UDP_MAX_TICK_MS &&
+           options.stepMs / options.tickMs <= UDP_MAX_PACKET_COUNT && options.payloadBytes <= UDP_MAX_PAYLOAD_BYTES &&
+           options.udpSessions < 0x800000U && options.tcpSessions < 0x800000U && options.tcpThreads > 0 &&
+           options.tcpThreads <= 64 && options.chunkBytes >= TCP_MIN_CHUNK_BYTES &&
+           options.chunkBytes <= TCP_MAX_CHUNK_BYTES && options.degradeFactor > 1.0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-h") == 0 || std::strcmp(argv[i], "--help") == 0) {
+            printHelp(argv[0]);
+            return 0;
+        }
+    }
+    LoadOptions options;
+    if (!parseArgs(argc, argv, options)) {
+        printHelp(argv[0]);
+        return 1;
+    }
+    sockaddr_in server{};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(static_cast<uint16_t>(options.port));
+    if (inet_pton(AF_INET, options.addr.c_str(), &server.sin_addr) != 1) {
+        std::cerr << "IP de server inválida: " << options.addr << std::endl;
+        return 1;
+    }
+    if (options.udpSessions == 0) {
+        options.udpThreads = 0;
+    }
+    if (options.tcpSessions == 0) {
+        options.tcpThreads = 0;
+    }
+
+    StepClock clock;
+    clock.stepNs = static_cast<uint64_t>(options.stepMs) * NS_PER_MS;
+    clock.periodNs = clock.stepNs + static_cast<uint64_t>(options.tickMs) * NS_PER_MS + DRAIN_GRACE_NS +
+                     2 * CONTROL_TIMEOUT_NS + STEP_GAP_NS;
+
+    std::vector<ThreadResults> udpResults(static_cast<size_t>(options.udpThreads));
+    std::vector<ThreadResults> tcpResults(static_cast<size_t>(options.tcpThreads));
+    std::vector<std::unique_ptr<UdpLoadThread>> udpThreads;
+    std::vector<std::unique_ptr<TcpLoadThread>> tcpThreads;
+    for (int i = 0; i < options.udpThreads; ++i) {
+        udpResults[static_cast<size_t>(i)].udp.resize(static_cast<size_t>(options.steps));
+        udpThreads.push_back(std::make_unique<UdpLoadThread>(options, server, clock, i,
+                                                             udpResults[static_cast<size_t>(i)]));
+        if (!udpThreads.back()->setup()) {
+            return 1;
+        }
+    }
+    for (int i = 0; i < options.tcpThreads; ++i) {
+        tcpResults[static_cast<size_t>(i)].tcp.resize(static_cast<size_t>(options.steps));
+        tcpThreads.push_back(std::make_unique<TcpLoadThread>(options, server, clock, i,
+                                                             tcpResults[static_cast<size_t>(i)]));
+        if (!tcpThreads.back()->setup()) {
+            return 1;
+        }
+    }
+
+    std::cout << "loadgen: server=" << options.addr << ":" << options.port << " steps=" << options.steps
+              << " stepMs=" << options.stepMs << " udpSessions=" << options.udpSessions << " tickMs=" << options.tickMs
+              << " payload=" << options.payloadBytes << " tcpSessions=" << options.tcpSessions << " tcpDirection="
+              << (options.tcpDirection == ThroughputDirection::DOWNLOAD ? "download" : "upload") << std::endl;
+
+    clock.t0Ns = monotonicNs() + 200 * NS_PER_MS;
+    std::vector<std::thread> threads;
+    for (auto& thread : udpThreads) {
+        threads.emplace_back([&thread]() { thread->run(); });
+    }
+    for (auto& thread : tcpThreads) {
+        threads.emplace_back([&thread]() { thread->run(); });
+    }
+
+    // El step k se imprime cuando todos los threads lo cerraron; la degradación se mide contra el step 1.
+    std::vector<StepReport> reports;
+    for (int step = 0; step < options.steps; ++step) {
+        const auto done = [step](const std::vector<ThreadResults>& results) {
+            return std::all_of(results.begin(), results.end(), [step](const ThreadResults& r) {
+                return r.completedSteps.load(std::memory_order_acquire) > step;
+            });
+        };
+        while (!done(udpResults) || !done(tcpResults)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        reports.push_back(printStep(step, options, udpResults, tcpResults));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Los rechazos se comparan como fracción de las sesiones, igual que la pérdida: un step 1 que ya rechaza
+    // no es una base sana, así que cuenta como degradado por sí solo.
+    const StepReport& base = reports.front();
+    for (size_t i = 0; i < reports.size(); ++i) {
+        const StepReport& report = reports[i];
+        std::string reason;
+        if (i == 0) {
+            if (report.rejectRate > REJECT_DEGRADED) {
+                reason = std::to_string(report.rejects) + " rechazos/BUSY (" + std::to_string(report.rejectRate * 100.0) +
+                         "% de las sesiones)";
+            }
+        } else if (base.rttP99Us > 0 && report.rttP99Us > base.rttP99Us * options.degradeFactor) {
+            reason = "p99 de RTT " + std::to_string(report.rttP99Us) + " µs vs " + std::to_string(base.rttP99Us) +
+                     " µs del step 1";
+        } else if (report.loss > LOSS_DEGRADED && report.loss > base.loss * options.degradeFactor) {
+            reason = "pérdida " + std::to_string(report.loss * 100.0) + "%";
+        } else if (report.rejectRate > REJECT_DEGRADED && report.rejectRate > base.rejectRate * options.degradeFactor) {
+            reason = std::to_string(report.rejects) + " rechazos/BUSY (" + std::to_string(report.rejectRate * 100.0) +
+                     "% de las sesiones)";
+        }
+        if (!reason.empty()) {
+            std::cout << "degradación: desde el step " << i + 1 << " (udp sesiones=" << report.udpSessions
+                      << "): " << reason << std::endl;
+            return 0;
+        }
+    }
+    std::cout << "degradación: no detectada hasta udp sesiones=" << reports.back().udpSessions << std::endl;
+    return 0;
+}
@@ -0,0 +1,156 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#include "logformat.h"
+
+// Convierte logs binarios del server (server_YYYYMMDD.stgb, comprimidos o no) al mismo JSONL que escribe
+// --log-format json.
+
+namespace {
+
+constexpr uint32_t MAX_RECORD_BYTES = 1U << 24; // muy por encima del registro más grande que acepta el ring
+
+void printHelp(const char* prog) {
+    std::cout
+        << "Usage: " << prog << " <archivo.stgb[.gz]>...\n"
+        << "  Escribe en stdout las líneas JSONL de cada archivo, en orden.\n"
+        << "  -h, --help                  Mostrar ayuda\n";
+}
+
+bool readExact(gzFile in, uint8_t* data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        const int n = gzread(in, data + done, static_cast<unsigned>(size - done));
+        if (n <= 0) {
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Devuelve false si el archivo no es un log binario o tiene registros corruptos; un registro final truncado
+// (server cortado a mitad de una escritura) sólo se avisa.
+bool exportFile(const std::string& path, std::string& out) {
+    gzFile in = gzopen(path.c_str(), "rb");
+    if (!in) {
+        std::cerr << "No se pudo abrir " << path << std::endl;
+        return false;
+    }
+    gzbuffer(in, 1 << 16);
+
+    std::vector<std::string> names;
+    std::vector<uint8_t> record;
+    bool segmentSeen = false;
+    bool ok = true;
+    uint64_t index = 0;
+    while (true) {
+        uint32_t len = 0;
+        const int n = gzread(in, &len, sizeof(len));
+        if (n == 0) {
+            break;
+        }
+        if (!segmentSeen && (n != static_cast<int>(sizeof(len)) || len != sizeof(LOG_BINARY_MAGIC) + 3)) {
+            std::cerr << path << ": no es un log binario del server" << std::endl;
+            ok = false;
+            break;
+        }
+        if (len > MAX_RECORD_BYTES) {
+            std::cerr << path << ": registro " << index << " con largo inválido" << std::endl;
+            ok = false;
+            break;
+        }
+        record.resize(len);
+        if (n != static_cast<int>(sizeof(len)) || len == 0 || !readExact(in, record.data(), len)) {
+            std::cerr << path << ": registro " << index << " truncado, se ignora el resto" << std::endl;
+            break;
+        }
+        ++index;
+
+        const auto kind = static_cast<LogBinaryKind>(record[0]);
+        LogReader reader(record.data(), record.size(), 1);
+        if (kind == LogBinaryKind::SEGMENT) {
+            char magic[sizeof(LOG_BINARY_MAGIC)];
+            for (char& c : magic) {
+                c = static_cast<char>(reader.take<uint8_t>());
+            }
+            const uint16_t version = reader.take<uint16_t>();
+            if (!reader.ok() || std::memcmp(magic, LOG_BINARY_MAGIC, sizeof(magic)) != 0 ||
+                version != LOG_BINARY_VERSION) {
+                std::cerr << path << ": segmento inválido o versión no soportada" << std::endl;
+                ok = false;
+                break;
+            }
+            names.clear();
+            segmentSeen = true;
+            continue;
+        }
+        if (!segmentSeen) {
+            std::cerr << path << ": no es un log binario del server" << std::endl;
+            ok = false;
+            break;
+        }
+        if (kind == LogBinaryKind::NAME) {
+            const uint16_t id = reader.take<uint16_t>();
+            if (!reader.ok() || id != names.size()) {
+                std::cerr << path << ": registro " << index << ": id de nombre fuera de orden" << std::endl;
+                ok = false;
+                break;
+            }
+            names.emplace_back(reinterpret_cast<const char*>(record.data() + reader.offset()),
+                               record.size() - reader.offset());
+            continue;
+        }
+        if (kind != LogBinaryKind::EVENT) {
+            continue; // tipos de registro futuros
+        }
+        const auto readName = [&names](LogReader& r) -> const char* {
+            const uint16_t id = r.take<uint16_t>();
+            return r.ok() && id < names.size() ? names[id].c_str() : nullptr;
+        };
+        if (!formatLogRecord(reader, readName, out)) {
+            std::cerr << path << ": registro " << index << " inválido, se omite" << std::endl;
+        }
+        if (out.size() >= (1 << 20)) {
+            std::cout.write(out.data(), static_cast<std::streamsize>(out.size()));
+            out.clear();
+        }
+    }
+    gzclose(in);
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            printHelp(argv[0]);
+            return 0;
+        }
+        files.push_back(arg);
+    }
+    if (files.empty()) {
+        printHelp(argv[0]);
+        return 1;
+    }
+
+    std::ios::sync_with_stdio(false);
+    std::string out;
+    int rc = 0;
+    for (const std::string& file : files) {
+        if (!exportFile(file, out)) {
+            rc = 1;
+        }
+        std::cout.write(out.data(), static_cast<std::streamsize>(out.size()));
+        out.clear();
+    }
+    std::cout.flush();
+    return rc;
+}
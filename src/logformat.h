@@ -0,0 +1,261 @@
+#ifndef SPEEDTEST_LOGFORMAT_H
+#define SPEEDTEST_LOGFORMAT_H
+
+// Formato de los registros de log, compartido por el server (ring del logger y archivo binario) y por
+// logexport (archivo binario -> JSONL).
+//
+// Cuerpo de un registro: tsMs u64, nombre del evento y luego campos (tipo u8, nombre de la clave, valor).
+// En el ring los nombres son punteros a literales; en el archivo son ids u16 de la tabla del segmento.
+//
+// Archivo binario (server_YYYYMMDD.stgb): secuencia de registros `len u32` + `kind u8` + payload, donde
+// `len` cuenta kind y payload. Cada vez que el server abre el archivo escribe un SEGMENT, que reinicia la
+// tabla de nombres; NAME define un id (`id u16` + bytes) y EVENT lleva el cuerpo con ids.
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+enum class LogFieldType : uint8_t {
+    U64,
+    I64,
+    F64, // 3 decimales
+    BOOL,
+    NUL,
+    STR,
+    ADDR,        // ip:puerto
+    SESSION_TAG, // sessionId@ip:puerto
+    U64_ARRAY,
+    U64_ROWS, // arreglo de filas de igual largo
+    STR_ARRAY,
+};
+
+enum class LogBinaryKind : uint8_t {
+    SEGMENT = 0, // magic + versión
+    NAME = 1,
+    EVENT = 2,
+};
+
+constexpr char LOG_BINARY_MAGIC[6] = {'S', 'T', 'G', 'L', 'O', 'G'};
+constexpr uint16_t LOG_BINARY_VERSION = 1;
+constexpr const char* LOG_BINARY_EXTENSION = ".stgb";
+
+inline std::string jsonEscape(const std::string& input) {
+    std::ostringstream out;
+    for (char c : input) {
+        switch (c) {
+            case '"': out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\r': out << "\\r"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+                        << static_cast<int>(static_cast<unsigned char>(c)) << std::dec;
+                } else {
+                    out << c;
+                }
+                break;
+        }
+    }
+    return out.str();
+}
+
+// Lector con límites: leer fuera del registro no toca memoria ajena, devuelve ceros y marca el registro
+// como inválido (archivos truncados o corruptos en logexport).
+class LogReader {
+public:
+    LogReader(const uint8_t* data, size_t size, size_t offset = 0) : data_(data), size_(size), offset_(offset) {}
+
+    template <typename T>
+    T take() {
+        T value{};
+        if (offset_ + sizeof(T) > size_) {
+            ok_ = false;
+            offset_ = size_;
+            return value;
+        }
+        std::memcpy(&value, data_ + offset_, sizeof(T));
+        offset_ += sizeof(T);
+        return value;
+    }
+
+    std::string takeString() {
+        const uint32_t len = take<uint32_t>();
+        if (len > size_ - offset_) {
+            ok_ = false;
+            offset_ = size_;
+            return std::string();
+        }
+        std::string value(reinterpret_cast<const char*>(data_ + offset_), len);
+        offset_ += len;
+        return value;
+    }
+
+    // Saltea el valor de un campo: el writer lo usa para copiar valores tal cual al archivo binario.
+    void skipValue(LogFieldType type) {
+        switch (type) {
+            case LogFieldType::U64:
+            case LogFieldType::I64:
+            case LogFieldType::F64:
+                take<uint64_t>();
+                break;
+            case LogFieldType::BOOL:
+                take<uint8_t>();
+                break;
+            case LogFieldType::NUL:
+                break;
+            case LogFieldType::STR:
+                takeString();
+                break;
+            case LogFieldType::SESSION_TAG:
+                take<uint32_t>();
+                take<uint32_t>();
+                take<uint16_t>();
+                break;
+            case LogFieldType::ADDR:
+                take<uint32_t>();
+                take<uint16_t>();
+                break;
+            case LogFieldType::U64_ARRAY:
+            case LogFieldType::U64_ROWS: {
+                const uint64_t rows = type == LogFieldType::U64_ROWS ? take<uint32_t>() : 1;
+                const uint64_t cols = take<uint32_t>();
+                skip(rows * cols * sizeof(uint64_t));
+                break;
+            }
+            case LogFieldType::STR_ARRAY: {
+                const uint32_t count = take<uint32_t>();
+                for (uint32_t i = 0; i < count && ok_; ++i) {
+                    takeString();
+                }
+                break;
+            }
+            default:
+                ok_ = false;
+                offset_ = size_;
+                break;
+        }
+    }
+
+    bool ok() const { return ok_; }
+    bool done() const { return offset_ >= size_; }
+    size_t offset() const { return offset_; }
+
+private:
+    void skip(uint64_t bytes) {
+        if (bytes > size_ - offset_) {
+            ok_ = false;
+            offset_ = size_;
+            return;
+        }
+        offset_ += static_cast<size_t>(bytes);
+    }
+
+    const uint8_t* data_;
+    size_t size_;
+    size_t offset_;
+    bool ok_ = true;
+};
+
+// Agrega a `out` la línea JSONL del cuerpo que empieza en el offset de `reader`. `readName` lee la
+// referencia a un nombre (puntero o id) y devuelve el texto, o nullptr si no se puede resolver.
+template <typename NameFn>
+bool formatLogRecord(LogReader& reader, NameFn readName, std::string& out) {
+    const auto addr = [&]() {
+        const uint32_t ip = reader.take<uint32_t>();
+        const uint16_t port = reader.take<uint16_t>();
+        char text[INET_ADDRSTRLEN] = {0};
+        inet_ntop(AF_INET, &ip, text, sizeof(text));
+        return std::string(text) + ":" + std::to_string(ntohs(port));
+    };
+
+    const size_t start = out.size();
+    const uint64_t tsMs = reader.take<uint64_t>();
+    const char* event = readName(reader);
+    if (event == nullptr) {
+        return false;
+    }
+    out += "{\"tsMs\":" + std::to_string(tsMs) + ",\"event\":\"" + jsonEscape(event) + "\"";
+    while (!reader.done() && reader.ok()) {
+        const auto type = static_cast<LogFieldType>(reader.take<uint8_t>());
+        const char* key = readName(reader);
+        if (key == nullptr) {
+            out.resize(start);
+            return false;
+        }
+        out += ",\"";
+        out += key;
+        out += "\":";
+        switch (type) {
+            case LogFieldType::U64:
+                out += std::to_string(reader.take<uint64_t>());
+                break;
+            case LogFieldType::I64:
+                out += std::to_string(reader.take<int64_t>());
+                break;
+            case LogFieldType::F64: {
+                char text[64];
+                snprintf(text, sizeof(text), "%.3f", reader.take<double>());
+                out += text;
+                break;
+            }
+            case LogFieldType::BOOL:
+                out += reader.take<uint8_t>() != 0 ? "true" : "false";
+                break;
+            case LogFieldType::NUL:
+                out += "null";
+                break;
+            case LogFieldType::STR:
+                out += "\"" + jsonEscape(reader.takeString()) + "\"";
+                break;
+            case LogFieldType::ADDR:
+                out += "\"" + addr() + "\"";
+                break;
+            case LogFieldType::SESSION_TAG: {
+                const uint32_t sessionId = reader.take<uint32_t>();
+                out += "\"" + std::to_string(sessionId) + "@" + addr() + "\"";
+                break;
+            }
+            case LogFieldType::U64_ARRAY:
+            case LogFieldType::U64_ROWS: {
+                const uint32_t rows = type == LogFieldType::U64_ROWS ? reader.take<uint32_t>() : 1;
+                const uint32_t cols = reader.take<uint32_t>();
+                out += type == LogFieldType::U64_ROWS ? "[" : "";
+                for (uint32_t r = 0; r < rows && reader.ok(); ++r) {
+                    out += r > 0 ? ",[" : "[";
+                    for (uint32_t c = 0; c < cols && reader.ok(); ++c) {
+                        out += (c > 0 ? "," : "") + std::to_string(reader.take<uint64_t>());
+                    }
+                    out += "]";
+                }
+                out += type == LogFieldType::U64_ROWS ? "]" : "";
+                break;
+            }
+            case LogFieldType::STR_ARRAY: {
+                const uint32_t count = reader.take<uint32_t>();
+                out += "[";
+                for (uint32_t i = 0; i < count && reader.ok(); ++i) {
+                    out += (i > 0 ? ",\"" : "\"") + jsonEscape(reader.takeString()) + "\"";
+                }
+                out += "]";
+                break;
+            }
+            default:
+                out.resize(start);
+                return false;
+        }
+    }
+    if (!reader.ok()) {
+        out.resize(start);
+        return false;
+    }
+    out += "}\n";
+    return true;
+}
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef SPEEDTEST_PROTOCOL_H
+#define SPEEDTEST_PROTOCOL_H
+
+// Formato de cable de UDP v2 y TCP throughput (ver "Protocolos" en el README), compartido por el server y
+// los clientes: todo little-endian, header UDP de 12 bytes y frame TCP con header de 16.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+constexpr uint16_t UDP_PROTOCOL_VERSION = 2;
+constexpr uint16_t TCP_PROTOCOL_VERSION = 1;
+constexpr uint32_t UDP_MAX_PAYLOAD_BYTES = 1024;
+constexpr uint32_t UDP_MAX_PACKET_COUNT = 12000;
+constexpr uint32_t UDP_MIN_TICK_MS = 1;
+constexpr uint32_t UDP_MAX_TICK_MS = 2000;
+constexpr size_t UDP_MAX_DATAGRAM_BYTES = 1400;
+constexpr size_t UDP_SUMMARY_FRAGMENT_BYTES = UDP_MAX_DATAGRAM_BYTES - 12 - 2 * sizeof(uint16_t);
+constexpr uint8_t UDP_RUN_MODE_DOWNLINK_STREAM = 2; // el server envía DOWN_TICK con su propia agenda
+constexpr int UDP_STREAM_KEEPALIVE_MS = 3000;       // sin datagramas del cliente el stream se corta
+constexpr uint32_t TCP_MAGIC = 0x53544754; // "TGTS"
+constexpr uint32_t TCP_DEFAULT_CHUNK_BYTES = 16 * 1024;
+constexpr uint32_t TCP_MIN_CHUNK_BYTES = 256;
+constexpr uint32_t TCP_MAX_CHUNK_BYTES = 64 * 1024;
+constexpr uint32_t TCP_MIN_DURATION_MS = 1000;
+constexpr uint32_t TCP_MAX_DURATION_MS = 60000;
+
+// Features negociadas en el byte `pad` de TEST_START_REQ; el server devuelve las aceptadas en TEST_START_ACK.
+constexpr uint8_t UDP_FEATURE_TX_TIMESTAMPS = 0x01;
+constexpr uint8_t UDP_FEATURE_LATENCY_STATS = 0x02; // percentiles de delay e inter-arrival en TEST_END_SUMMARY
+constexpr uint8_t UDP_FEATURE_RESIDENCE = 0x04;     // residencia en el server dentro de los flags de DOWN_TICK
+constexpr uint8_t UDP_FEATURE_LOSS_RUNS = 0x08;     // TEST_END_SUMMARY con rachas de pérdida, fragmentado
+// Con UDP_FEATURE_LOSS_RUNS la pérdida va en la codificación más chica: rachas o el bitmap crudo.
+constexpr uint8_t UDP_LOSS_FORMAT_RUNS = 0;
+constexpr uint8_t UDP_LOSS_FORMAT_BITMAP = 1;
+// Features TCP en `reserved16` de START_REQ; las aceptadas vuelven en START_ACK.
+constexpr uint16_t TCP_FEATURE_SERIES = 0x01; // RESULT_SERIES antes del RESULT
+
+constexpr uint32_t DOWN_TICK_FLAG_OUT_OF_ORDER = 0x1;
+constexpr uint32_t DOWN_TICK_FLAG_TX_TIMESTAMP = 0x2; // al final del payload: uint32 txSeq + uint64 txNs
+constexpr uint32_t DOWN_TICK_FLAG_RESIDENCE = 0x4;    // bits 16-31: µs desde la recepción hasta el envío (satura)
+constexpr uint32_t DOWN_TICK_FLAG_SCHEDULED = 0x8;    // DOWN_TICK del stream: recvNs es el instante agendado
+constexpr size_t DOWN_TICK_FLAGS_OFFSET = 12 + 3 * sizeof(uint64_t); // header + clientSendNs, recvNs, sendNs
+constexpr uint32_t SYNC_REQ_FLAG_TX_FOLLOWUP = 0x1;
+
+enum class UdpMessageType : uint16_t {
+    SYNC_REQ = 1,
+    SYNC_RESP = 2,
+    TEST_START_REQ = 3,
+    TEST_START_ACK = 4,
+    UP_TICK = 5,
+    DOWN_TICK = 6,
+    TEST_END_REQ = 7,
+    TEST_END_SUMMARY = 8,
+    SYNC_FOLLOWUP = 9,
+};
+
+enum class TcpMessageType : uint16_t {
+    START_REQ = 1,
+    START_ACK = 2,
+    DATA = 3,
+    STOP = 4,
+    RESULT = 5,
+    BUSY = 6,
+    RESULT_SERIES = 7,
+};
+
+// Opciones TLV (type u8, len u8, valor) que pueden seguir al cuerpo fijo de START_REQ; START_ACK devuelve los
+// valores efectivos con los mismos tipos.
+enum class TcpStartOption : uint8_t {
+    CONGESTION = 1, // nombre ASCII del algoritmo (TCP_CONGESTION)
+    SNDBUF = 2,     // u32 bytes
+    RCVBUF = 3,     // u32 bytes
+    PACING_RATE = 4, // u64 bits/s objetivo del download; 0 = sin pacing
+};
+
+enum class ThroughputDirection : uint8_t {
+    DOWNLOAD = 1,
+    UPLOAD = 2,
+};
+
+struct UdpHeader {
+    UdpMessageType type;
+    uint16_t version;
+    uint32_t sessionId;
+    uint32_t seq;
+};
+
+struct TcpHeader {
+    uint32_t magic;
+    uint16_t version;
+    TcpMessageType type;
+    uint32_t sessionId;
+    uint32_t length;
+};
+
+template <typename T>
+void appendLe(std::vector<uint8_t>& buffer, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        buffer.push_back(static_cast<uint8_t>((static_cast<uint64_t>(value) >> (8U * i)) & 0xFFU));
+    }
+}
+
+template <typename T>
+bool readLe(const uint8_t* data, size_t size, size_t& offset, T& out) {
+    if (offset + sizeof(T) > size) {
+        return false;
+    }
+    uint64_t value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        value |= static_cast<uint64_t>(data[offset + i]) << (8U * i);
+    }
+    out = static_cast<T>(value);
+    offset += sizeof(T);
+    return true;
+}
+
+template <typename T>
+void putLe(uint8_t* out, size_t& offset, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        out[offset + i] = static_cast<uint8_t>((static_cast<uint64_t>(value) >> (8U * i)) & 0xFFU);
+    }
+    offset += sizeof(T);
+}
+
+// Escribe el header UDP v2 directo en un buffer ya reservado; devuelve los bytes escritos (12).
+inline size_t writeUdpHeader(uint8_t* out, UdpMessageType type, uint32_t sessionId, uint32_t seq) {
+    size_t offset = 0;
+    putLe<uint16_t>(out, offset, static_cast<uint16_t>(type));
+    putLe<uint16_t>(out, offset, UDP_PROTOCOL_VERSION);
+    putLe<uint32_t>(out, offset, sessionId);
+    putLe<uint32_t>(out, offset, seq);
+    return offset;
+}
+
+inline std::vector<uint8_t> makeUdpPacket(UdpMessageType type,
+                                          uint32_t sessionId,
+                                          uint32_t seq,
+                                          const std::vector<uint8_t>& body) {
+    std::vector<uint8_t> packet;
+    packet.reserve(12 + body.size());
+    appendLe<uint16_t>(packet, static_cast<uint16_t>(type));
+    appendLe<uint16_t>(packet, UDP_PROTOCOL_VERSION);
+    appendLe<uint32_t>(packet, sessionId);
+    appendLe<uint32_t>(packet, seq);
+    packet.insert(packet.end(), body.begin(), body.end());
+    return packet;
+}
+
+// Varints LEB128 (7 bits por byte, el bit alto indica que sigue otro): rachas de pérdida de TEST_END_SUMMARY.
+inline void appendVarint(std::vector<uint8_t>& buffer, uint32_t value) {
+    while (value >= 0x80U) {
+        buffer.push_back(static_cast<uint8_t>(value | 0x80U));
+        value >>= 7U;
+    }
+    buffer.push_back(static_cast<uint8_t>(value));
+}
+
+inline bool readVarint(const uint8_t* data, size_t size, size_t& offset, uint32_t& out) {
+    uint32_t value = 0;
+    for (uint32_t shift = 0; shift < 35U; shift += 7U) {
+        if (offset >= size) {
+            return false;
+        }
+        const uint8_t byte = data[offset++];
+        value |= static_cast<uint32_t>(byte & 0x7FU) << shift;
+        if ((byte & 0x80U) == 0) {
+            out = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool parseUdpHeader(const uint8_t* data, size_t size, UdpHeader& header) {
+    if (size < 12) {
+        return false;
+    }
+    size_t offset = 0;
+    uint16_t type = 0;
+    if (!readLe<uint16_t>(data, size, offset, type)) return false;
+    if (!readLe<uint16_t>(data, size, offset, header.version)) return false;
+    if (!readLe<uint32_t>(data, size, offset, header.sessionId)) return false;
+    if (!readLe<uint32_t>(data, size, offset, header.seq)) return false;
+
+    header.type = static_cast<UdpMessageType>(type);
+    return true;
+}
+
+inline std::vector<uint8_t> makeTcpFrame(TcpMessageType type, uint32_t sessionId, const std::vector<uint8_t>& body) {
+    std::vector<uint8_t> frame;
+    frame.reserve(16 + body.size());
+    appendLe<uint32_t>(frame, TCP_MAGIC);
+    appendLe<uint16_t>(frame, TCP_PROTOCOL_VERSION);
+    appendLe<uint16_t>(frame, static_cast<uint16_t>(type));
+    appendLe<uint32_t>(frame, sessionId);
+    appendLe<uint32_t>(frame, static_cast<uint32_t>(body.size()));
+    frame.insert(frame.end(), body.begin(), body.end());
+    return frame;
+}
+
+inline bool parseTcpHeader(const uint8_t* headerBuf, TcpHeader& header) {
+    size_t offset = 0;
+    uint16_t typeRaw = 0;
+    if (!readLe<uint32_t>(headerBuf, 16, offset, header.magic)) return false;
+    if (!readLe<uint16_t>(headerBuf, 16, offset, header.version)) return false;
+    if (!readLe<uint16_t>(headerBuf, 16, offset, typeRaw)) return false;
+    if (!readLe<uint32_t>(headerBuf, 16, offset, header.sessionId)) return false;
+    if (!readLe<uint32_t>(headerBuf, 16, offset, header.length)) return false;
+
+    header.type = static_cast<TcpMessageType>(typeRaw);
+    return header.magic == TCP_MAGIC && header.version == TCP_PROTOCOL_VERSION;
+}
+
+#endif
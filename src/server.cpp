@@ -1,52 +1,161 @@
+#include <algorithm>
 #include <arpa/inet.h>
 #include <cerrno>
 #include <cctype>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <dirent.h>
 #include <fcntl.h>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <ifaddrs.h>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <set>
+#include <signal.h>
 #include <sstream>
 #include <string>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
 #include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <unistd.h>
 #include <vector>
 #include <atomic>
+#include <linux/errqueue.h>
+#include <linux/io_uring.h>
+#include <linux/net_tstamp.h>
+#include <linux/perf_event.h>
+#include <linux/tcp.h>
 #include <linux/wireless.h>
+#include <sys/resource.h>
+#include <zlib.h>
+
+#include "logformat.h"
+#include "protocol.h"
+#include "udpsession.h"
+
+#ifdef SPEEDTEST_COUNT_ALLOCS
+#include <new>
+
+// Hook de verificación (make COUNT_ALLOCS=1): cuenta las allocations de cada thread para comprobar que el
+// camino UP_TICK -> DOWN_TICK no toca el heap en régimen estable.
+namespace {
+thread_local uint64_t gThreadAllocations = 0;
+}
+
+void* operator new(std::size_t size) {
+    ++gThreadAllocations;
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+#endif
 
 namespace {
 
+#ifdef SPEEDTEST_COUNT_ALLOCS
+constexpr bool kAllocationHookEnabled = true;
+uint64_t threadAllocationCount() {
+    return gThreadAllocations;
+}
+#else
+constexpr bool kAllocationHookEnabled = false;
+uint64_t threadAllocationCount() {
+    return 0;
+}
+#endif
+
 using SteadyClock = std::chrono::steady_clock;
 using SystemClock = std::chrono::system_clock;
 
-constexpr uint16_t UDP_PROTOCOL_VERSION = 2;
-constexpr uint16_t TCP_PROTOCOL_VERSION = 1;
-constexpr uint32_t UDP_MAX_PAYLOAD_BYTES = 1024;
-constexpr uint32_t UDP_MAX_PACKET_COUNT = 12000;
-constexpr uint32_t UDP_MIN_TICK_MS = 1;
-constexpr uint32_t UDP_MAX_TICK_MS = 2000;
-constexpr size_t UDP_MAX_DATAGRAM_BYTES = 1400;
-constexpr uint32_t TCP_MAGIC = 0x53544754; // "TGTS"
-constexpr uint32_t TCP_DEFAULT_CHUNK_BYTES = 16 * 1024;
-constexpr uint32_t TCP_MIN_CHUNK_BYTES = 256;
-constexpr uint32_t TCP_MAX_CHUNK_BYTES = 64 * 1024;
-constexpr uint32_t TCP_MIN_DURATION_MS = 1000;
-constexpr uint32_t TCP_MAX_DURATION_MS = 60000;
+constexpr size_t UDP_MAX_REPLY_BYTES = 2048; // TEST_END_SUMMARY con bitmap completo supera el datagrama máximo
+constexpr int UDP_DEFAULT_BATCH = 32;
+constexpr int UDP_MAX_BATCH = 64;
+constexpr int UDP_MAX_WORKERS = 64;
+constexpr size_t UDP_WORKER_SESSION_HEADROOM = 64; // slots extra por worker para el desbalance del hash
+constexpr size_t UDP_BATCH_HIST_BUCKETS = 7; // 1, 2-3, 4-7, 8-15, 16-31, 32-63, 64
+// Buckets (límite superior en µs, salvo residencia y desvío de agenda que van en ns) de los histogramas de /metrics.
+constexpr uint64_t METRICS_SESSION_DURATION_BOUNDS_US[] = {100000, 500000, 1000000, 2500000, 5000000, 10000000,
+                                                           15000000, 30000000, 60000000, 120000000};
+constexpr uint64_t METRICS_LOOP_ITERATION_BOUNDS_US[] = {10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000};
+constexpr uint64_t METRICS_RESIDENCE_BOUNDS_NS[] = {250,   500,   1000,   2000,   5000,    10000,
+                                                   20000, 50000, 100000, 500000, 1000000, 10000000};
+constexpr uint64_t METRICS_SCHEDULE_DEVIATION_BOUNDS_NS[] = {1000,   5000,   10000,   20000,   50000,   100000,
+                                                             200000, 500000, 1000000, 2000000, 5000000, 10000000};
+constexpr size_t METRICS_MAX_BOUNDS = 12;
+constexpr size_t METRICS_MAX_REQUEST_BYTES = 4096;
+constexpr size_t TCP_DOWNLOAD_RING_BYTES = 256 * 1024;
+constexpr size_t TCP_UPLOAD_BUFFER_BYTES = 256 * 1024;
+constexpr int TCP_MAX_WORKERS = 64;
+constexpr int TCP_DEFAULT_MAX_STREAMS = 8;
+constexpr int TCP_MAX_STREAMS = 16;
+constexpr uint64_t TCP_STREAM_WAIT_NS = 5000000ULL; // chequeo del stream 0 mientras espera al resto del grupo
+constexpr uint32_t TCP_MAX_START_BODY_BYTES = 4096;
+constexpr uint64_t TCP_CONTROL_TIMEOUT_NS = 1000000000ULL; // lectura de START_REQ y escritura de ACK/RESULT
+constexpr uint64_t TCP_ZEROCOPY_DRAIN_NS = 2000000000ULL;
+constexpr uint32_t TCP_MIN_SOCKET_BUFFER_BYTES = 4096;
+constexpr uint32_t TCP_DEFAULT_MAX_SOCKET_BUFFER_BYTES = 32 * 1024 * 1024;
+constexpr size_t TCP_CC_NAME_MAX = 15; // TCP_CA_NAME_MAX sin el terminador
+constexpr uint64_t TCP_MIN_PACING_BPS = 64000;
+constexpr uint64_t TCP_MAX_PACING_BPS = (UINT32_MAX - 1ULL) * 8; // tope de SO_MAX_PACING_RATE (u32 bytes/s)
+constexpr uint64_t TCP_PACING_BURST_NS = 2000000ULL; // ráfaga máxima del pacing en espacio de usuario
+constexpr uint64_t TCP_SAMPLE_INTERVAL_NS = 100000000ULL; // serie por intervalo (bytes + TCP_INFO)
+constexpr uint16_t TCP_SERIES_SAMPLE_BYTES = 60;
+constexpr unsigned URING_ENTRIES = 256;
+constexpr uint16_t URING_RX_GROUP = 0;
+constexpr uint16_t URING_RX_BUFFERS = 256; // potencia de 2 (ring de buffers provistos)
+constexpr uint32_t URING_RX_BUFFER_BYTES = 2048; // io_uring_recvmsg_out + nombre + control + datagrama
+constexpr uint32_t URING_RX_CONTROL_BYTES = 128;
+constexpr int TCP_SEND_BURST = 4; // envíos por evento antes de atender a otra conexión del worker
 constexpr int SESSION_IDLE_TIMEOUT_MS = 30000;
+constexpr uint64_t IDLE_WHEEL_TICK_NS = 1000000000ULL;
+constexpr size_t IDLE_WHEEL_SLOTS = 64; // cubre SESSION_IDLE_TIMEOUT_MS con un solo nivel
+constexpr size_t IDLE_EXPIRY_BUDGET = 64; // sesiones revisadas por pasada entre lotes de datagramas
+constexpr size_t LOG_RING_SLOTS = 4096; // potencia de 2; con slots de 256 bytes el ring ocupa 1 MB
+constexpr size_t LOG_SLOT_PAYLOAD_BYTES = 256 - sizeof(uint64_t); // slot de 256 bytes con su número de secuencia
+constexpr size_t LOG_MAX_RECORD_SLOTS = LOG_RING_SLOTS / 4;
+constexpr int LOG_WRITER_INTERVAL_MS = 50;
 
 enum class ServerLinkType : uint8_t {
     UNKNOWN = 0,
@@ -56,29 +165,32 @@ enum class ServerLinkType : uint8_t {
     OTHER = 4,
 };
 
-enum class UdpMessageType : uint16_t {
-    SYNC_REQ = 1,
-    SYNC_RESP = 2,
-    TEST_START_REQ = 3,
-    TEST_START_ACK = 4,
-    UP_TICK = 5,
-    DOWN_TICK = 6,
-    TEST_END_REQ = 7,
-    TEST_END_SUMMARY = 8,
+enum class UdpWaitMode : uint8_t {
+    EPOLL = 0,
+    SLEEP = 1, // loop legado: sleep de 2 ms cuando no hay datagramas (para comparar latencias)
+};
+
+enum class IoBackend : uint8_t {
+    EPOLL,
+    URING
 };
 
-enum class TcpMessageType : uint16_t {
-    START_REQ = 1,
-    START_ACK = 2,
-    DATA = 3,
-    STOP = 4,
-    RESULT = 5,
-    BUSY = 6,
+enum class TcpIoStatus : uint8_t {
+    PROGRESS,
+    WOULD_BLOCK,
+    FAILED
 };
 
-enum class ThroughputDirection : uint8_t {
-    DOWNLOAD = 1,
-    UPLOAD = 2,
+enum class TcpSendMode : uint8_t {
+    COPY = 0,     // legado: arma y copia cada frame DATA antes de send (para comparar)
+    WRITEV = 1,   // ring de frames ya armados enviado con writev
+    ZEROCOPY = 2, // mismo ring con MSG_ZEROCOPY
+};
+
+enum class TcpPacingMode : uint8_t {
+    NONE = 0,
+    KERNEL = 1, // SO_MAX_PACING_RATE (fq o pacing interno de TCP)
+    USER = 2,   // token bucket del worker
 };
 
 enum class LogLevel : int {
@@ -87,69 +199,151 @@ enum class LogLevel : int {
     VERBOSE = 2,
 };
 
-struct UdpHeader {
-    UdpMessageType type;
-    uint16_t version;
-    uint32_t sessionId;
-    uint32_t seq;
+enum class LogFormat : uint8_t {
+    JSON = 0,
+    BINARY = 1, // registros tipados; los archivos de días cerrados se comprimen (logexport los pasa a JSONL)
+};
+
+struct ServerOptions {
+    int port = 9000;
+    int tickOverrideMs = 0;
+    int maxSessions = 50;
+    int udpWorkers = 1;
+    int udpBatch = UDP_DEFAULT_BATCH;
+    int tcpWorkers = 0; // 0: uno por core
+    int tcpMaxStreams = TCP_DEFAULT_MAX_STREAMS;
+    UdpWaitMode udpWait = UdpWaitMode::EPOLL;
+    bool kernelTimestamps = false;
+    TcpSendMode tcpSendMode = TcpSendMode::WRITEV;
+    TcpPacingMode tcpPacing = TcpPacingMode::KERNEL;
+    IoBackend ioBackend = IoBackend::EPOLL;
+    std::vector<std::string> tcpCcAllow{"cubic", "reno", "bbr"};
+    uint32_t tcpMaxBufferBytes = TCP_DEFAULT_MAX_SOCKET_BUFFER_BYTES;
+    std::string logDir = ".";
+    LogLevel logLevel = LogLevel::SUMMARY;
+    LogFormat logFormat = LogFormat::JSON;
+    int metricsPort = 0; // 0: sin endpoint /metrics
+    std::string metricsBind = "127.0.0.1";
 };
 
-struct TcpHeader {
-    uint32_t magic;
-    uint16_t version;
-    TcpMessageType type;
-    uint32_t sessionId;
-    uint32_t length;
+enum class RejectReason : uint8_t {
+    BUSY = 0,         // sin lugar en --max-sessions
+    BAD_REQUEST = 1,  // parámetros o START inválidos
+    GROUP_CLOSED = 2, // stream TCP que llega a un grupo ya cerrado
 };
+constexpr size_t REJECT_REASONS = 3;
 
-struct UdpSessionKey {
-    uint32_t sessionId;
-    uint32_t ip;
-    uint16_t port;
+// Histograma acumulativo para /metrics: buckets fijos con contadores atómicos relajados, así los workers lo
+// actualizan sin locks y un scrape lee una foto aproximada sin frenarlos.
+class MetricHistogram {
+public:
+    // unitsPerSecond: unidad de los límites y de observe() (1e6 = µs).
+    template <size_t N>
+    explicit MetricHistogram(const uint64_t (&bounds)[N], double unitsPerSecond = 1e6)
+        : bounds_(bounds), boundCount_(N), unitsPerSecond_(unitsPerSecond) {
+        static_assert(N <= METRICS_MAX_BOUNDS, "demasiados buckets");
+    }
 
-    bool operator==(const UdpSessionKey& other) const {
-        return sessionId == other.sessionId && ip == other.ip && port == other.port;
+    void observe(uint64_t value) {
+        size_t i = 0;
+        while (i < boundCount_ && value > bounds_[i]) {
+            ++i;
+        }
+        buckets_[i].fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
     }
-};
 
-struct UdpSessionKeyHash {
-    size_t operator()(const UdpSessionKey& key) const {
-        size_t h1 = std::hash<uint32_t>{}(key.sessionId);
-        size_t h2 = std::hash<uint32_t>{}(key.ip);
-        size_t h3 = std::hash<uint16_t>{}(key.port);
-        return h1 ^ (h2 << 1U) ^ (h3 << 2U);
+    // Para histogramas con un solo escritor (los de cada worker UDP): load + store, sin read-modify-write.
+    void observeOwned(uint64_t value) {
+        size_t i = 0;
+        while (i < boundCount_ && value > bounds_[i]) {
+            ++i;
+        }
+        buckets_[i].store(buckets_[i].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum_.store(sum_.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
     }
-};
 
-struct UdpSession {
-    uint32_t sessionId = 0;
-    sockaddr_in client{};
-    uint32_t tickMs = 15;
-    uint32_t expectedCount = 0;
-    uint32_t payloadUpBytes = 64;
-    uint32_t payloadDownBytes = 64;
-    uint32_t upReceivedCount = 0;
-    uint32_t downSentCount = 0;
-    uint32_t upOutOfOrderCount = 0;
-    int64_t maxSeqSeen = -1;
-    std::vector<uint8_t> upBitmap;
-    uint64_t startedNs = 0;
-    uint64_t lastActivityNs = 0;
+    // Suma otro histograma con los mismos límites: así se exponen juntos los de todos los workers.
+    void add(const MetricHistogram& other) {
+        for (size_t i = 0; i < bucketCount(); ++i) {
+            buckets_[i].fetch_add(other.bucket(i), std::memory_order_relaxed);
+        }
+        sum_.fetch_add(other.sum_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    // Formato de exposición de Prometheus, en segundos.
+    void render(std::string& out, const char* name, const std::string& labels) const {
+        uint64_t cumulative = 0;
+        char line[256];
+        for (size_t i = 0; i <= boundCount_; ++i) {
+            cumulative += buckets_[i].load(std::memory_order_relaxed);
+            char le[32] = "+Inf";
+            if (i < boundCount_) {
+                snprintf(le, sizeof(le), "%g", static_cast<double>(bounds_[i]) / unitsPerSecond_);
+            }
+            snprintf(line, sizeof(line), "%s_bucket{%s,le=\"%s\"} %llu\n", name, labels.c_str(), le,
+                     static_cast<unsigned long long>(cumulative));
+            out += line;
+        }
+        snprintf(line, sizeof(line), "%s_sum{%s} %.9f\n%s_count{%s} %llu\n", name, labels.c_str(),
+                 static_cast<double>(sum_.load(std::memory_order_relaxed)) / unitsPerSecond_, name, labels.c_str(),
+                 static_cast<unsigned long long>(cumulative));
+        out += line;
+    }
+
+    size_t bucketCount() const { return boundCount_ + 1; }
+    uint64_t bucket(size_t i) const { return buckets_[i].load(std::memory_order_relaxed); }
+
+private:
+    const uint64_t* bounds_;
+    size_t boundCount_;
+    double unitsPerSecond_;
+    std::atomic<uint64_t> buckets_[METRICS_MAX_BOUNDS + 1] = {}; // el último es +Inf
+    std::atomic<uint64_t> sum_{0};
 };
 
-struct ServerOptions {
-    int port = 9000;
-    int tickOverrideMs = 0;
-    int maxSessions = 50;
-    std::string logDir = ".";
-    LogLevel logLevel = LogLevel::SUMMARY;
+// Métricas que cada worker UDP actualiza por datagrama respondido. Un solo escritor por instancia y una línea
+// de cache propia: con --udp-workers N no rebotan entre cores como lo harían en TrafficCounters. Las leen y
+// suman el thread de stats y /metrics.
+struct alignas(64) UdpWorkerCounters {
+    MetricHistogram syncRespResidence{METRICS_RESIDENCE_BOUNDS_NS, 1e9}; // recepción -> envío, por tipo de respuesta
+    MetricHistogram downTickResidence{METRICS_RESIDENCE_BOUNDS_NS, 1e9};
+    std::atomic<uint64_t> syncRespResidenceMaxNs{0};
+    std::atomic<uint64_t> downTickResidenceMaxNs{0};
+    MetricHistogram downlinkScheduleDeviation{METRICS_SCHEDULE_DEVIATION_BOUNDS_NS, 1e9};
+    std::atomic<uint64_t> downlinkScheduleDeviationMaxNs{0};
 };
 
 struct TrafficCounters {
     std::atomic<uint64_t> udpPacketsIn{0};
     std::atomic<uint64_t> udpPacketsOut{0};
+    std::atomic<uint64_t> udpBytesIn{0};
+    std::atomic<uint64_t> udpBytesOut{0};
     std::atomic<uint64_t> tcpBytesIn{0};
     std::atomic<uint64_t> tcpBytesOut{0};
+    std::atomic<uint64_t> udpRecvCalls{0};
+    std::atomic<uint64_t> udpSendCalls{0};
+    std::atomic<uint64_t> udpTxDropped{0}; // respuestas descartadas: sendmmsg con error o SQ de io_uring llena
+    std::atomic<uint64_t> udpRxBatchHist[UDP_BATCH_HIST_BUCKETS] = {};
+    std::atomic<uint64_t> udpTxBatchHist[UDP_BATCH_HIST_BUCKETS] = {};
+    std::atomic<uint64_t> udpWakeups{0};
+    std::atomic<uint64_t> uringEnters{0};
+    std::atomic<uint64_t> udpRxDelaySamples{0};
+    std::atomic<uint64_t> udpRxDelaySumNs{0};
+    std::atomic<uint64_t> udpRxDelayMaxNs{0};
+    std::atomic<uint64_t> udpTxTimestamps{0};
+    std::atomic<uint64_t> downTickAllocs{0};
+    std::atomic<uint64_t> udpIdleExpired{0};
+    std::atomic<uint64_t> udpExpiryNs{0};
+    std::atomic<uint64_t> udpExpiryMaxNs{0};
+    std::atomic<int> udpActiveSessions{0}; // las TCP son activeSessions - udpActiveSessions
+    std::atomic<uint64_t> udpRejections[REJECT_REASONS] = {};
+    std::atomic<uint64_t> tcpRejections[REJECT_REASONS] = {};
+    MetricHistogram udpSessionDuration{METRICS_SESSION_DURATION_BOUNDS_US};
+    MetricHistogram tcpSessionDuration{METRICS_SESSION_DURATION_BOUNDS_US};
+    MetricHistogram udpLoopIteration{METRICS_LOOP_ITERATION_BOUNDS_US}; // trabajo entre dos esperas del loop
+    MetricHistogram tcpLoopIteration{METRICS_LOOP_ITERATION_BOUNDS_US};
+    std::vector<std::unique_ptr<UdpWorkerCounters>> udpWorkers; // uno por worker, creados antes de los threads
 };
 
 struct ServerLinkSnapshot {
@@ -165,6 +359,43 @@ uint64_t nowNs() {
         .count();
 }
 
+uint64_t realtimeNs() {
+    timespec ts{};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+void atomicStoreMax(std::atomic<uint64_t>& target, uint64_t value) {
+    uint64_t current = target.load(std::memory_order_relaxed);
+    while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+// Máximo con un solo escritor (UdpWorkerCounters). Si coincide con el exchange(0) del lector, el máximo viejo
+// puede sobrevivir un intervalo más; no se pierde ninguno nuevo.
+void ownedStoreMax(std::atomic<uint64_t>& target, uint64_t value) {
+    if (value > target.load(std::memory_order_relaxed)) {
+        target.store(value, std::memory_order_relaxed);
+    }
+}
+
+void mergeUdpWorkerHistogram(const TrafficCounters& counters,
+                             MetricHistogram UdpWorkerCounters::*field,
+                             MetricHistogram& merged) {
+    for (const auto& worker : counters.udpWorkers) {
+        merged.add((*worker).*field);
+    }
+}
+
+// Máximo del intervalo entre todos los workers; lo deja en cero para el próximo.
+uint64_t takeUdpWorkerMax(TrafficCounters& counters, std::atomic<uint64_t> UdpWorkerCounters::*field) {
+    uint64_t maxValue = 0;
+    for (const auto& worker : counters.udpWorkers) {
+        maxValue = std::max(maxValue, ((*worker).*field).exchange(0));
+    }
+    return maxValue;
+}
+
 uint64_t nowMs() {
     return std::chrono::duration_cast<std::chrono::milliseconds>(
                SystemClock::now().time_since_epoch())
@@ -181,36 +412,6 @@ std::string nowDateKey() {
     return oss.str();
 }
 
-std::string jsonEscape(const std::string& input) {
-    std::ostringstream out;
-    for (char c : input) {
-        switch (c) {
-            case '"': out << "\\\""; break;
-            case '\\': out << "\\\\"; break;
-            case '\n': out << "\\n"; break;
-            case '\r': out << "\\r"; break;
-            case '\t': out << "\\t"; break;
-            default:
-                if (static_cast<unsigned char>(c) < 0x20) {
-                    out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
-                        << static_cast<int>(static_cast<unsigned char>(c)) << std::dec;
-                } else {
-                    out << c;
-                }
-                break;
-        }
-    }
-    return out.str();
-}
-
-std::string addrToString(const sockaddr_in& addr) {
-    char ip[INET_ADDRSTRLEN] = {0};
-    inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
-    std::ostringstream oss;
-    oss << ip << ":" << ntohs(addr.sin_port);
-    return oss.str();
-}
-
 std::string trim(const std::string& input) {
     size_t first = 0;
     while (first < input.size() && std::isspace(static_cast<unsigned char>(input[first]))) {
@@ -439,30 +640,216 @@ ServerLinkSnapshot detectServerLinkSnapshot() {
     return snapshot;
 }
 
+// Ring MPSC acotado para el logger: slots fijos con número de secuencia (esquema de Vyukov). Un registro que
+// no entra en un slot ocupa varios consecutivos; el productor los reserva con un único CAS y publica el primero
+// al final, así el consumidor nunca ve un registro a medias. Si no hay lugar el registro se descarta.
+class LogRing {
+public:
+    LogRing() : slots_(new Slot[LOG_RING_SLOTS]) {
+        for (size_t i = 0; i < LOG_RING_SLOTS; ++i) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool push(const uint8_t* data, size_t size) {
+        const size_t count = (size + LOG_SLOT_PAYLOAD_BYTES - 1) / LOG_SLOT_PAYLOAD_BYTES;
+        if (count > LOG_MAX_RECORD_SLOTS) {
+            return false;
+        }
+        uint64_t pos = enqueue_.load(std::memory_order_relaxed);
+        while (true) {
+            bool stale = false;
+            for (size_t i = 0; i < count && !stale; ++i) {
+                const uint64_t seq = slot(pos + i).seq.load(std::memory_order_acquire);
+                const auto diff = static_cast<int64_t>(seq - (pos + i));
+                if (diff < 0) {
+                    return false; // lleno: el writer todavía no liberó esta vuelta
+                }
+                stale = diff > 0;
+            }
+            if (stale) {
+                pos = enqueue_.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (enqueue_.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+
+        for (size_t i = count; i-- > 0;) {
+            const size_t offset = i * LOG_SLOT_PAYLOAD_BYTES;
+            Slot& target = slot(pos + i);
+            std::memcpy(target.bytes, data + offset, std::min(LOG_SLOT_PAYLOAD_BYTES, size - offset));
+            target.seq.store(pos + i + 1, std::memory_order_release);
+        }
+        return true;
+    }
+
+    // Un solo consumidor (el thread writer).
+    bool pop(std::vector<uint8_t>& out) {
+        const uint64_t dequeue = dequeue_.load(std::memory_order_relaxed);
+        Slot& first = slot(dequeue);
+        if (first.seq.load(std::memory_order_acquire) != dequeue + 1) {
+            return false;
+        }
+        uint32_t size = 0;
+        std::memcpy(&size, first.bytes, sizeof(size));
+        const size_t count = (size + LOG_SLOT_PAYLOAD_BYTES - 1) / LOG_SLOT_PAYLOAD_BYTES;
+        out.resize(size);
+        for (size_t i = 0; i < count; ++i) {
+            const size_t offset = i * LOG_SLOT_PAYLOAD_BYTES;
+            Slot& source = slot(dequeue + i);
+            std::memcpy(out.data() + offset, source.bytes, std::min<size_t>(LOG_SLOT_PAYLOAD_BYTES, size - offset));
+            source.seq.store(dequeue + i + LOG_RING_SLOTS, std::memory_order_release);
+        }
+        dequeue_.store(dequeue + count, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Slots ocupados (aproximado: reservados y todavía no leídos por el writer).
+    uint64_t depth() const {
+        const uint64_t dequeue = dequeue_.load(std::memory_order_relaxed);
+        return enqueue_.load(std::memory_order_relaxed) - dequeue;
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> seq{0};
+        uint8_t bytes[LOG_SLOT_PAYLOAD_BYTES];
+    };
+
+    Slot& slot(uint64_t pos) { return slots_[pos & (LOG_RING_SLOTS - 1)]; }
+
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<uint64_t> enqueue_{0};
+    alignas(64) std::atomic<uint64_t> dequeue_{0}; // atómico sólo para que depth() lo lea desde otro thread
+};
+
+// Los workers no formatean JSON ni tocan el archivo: cada log es un registro binario (claves y evento son
+// literales, se guardan como punteros) que va al ring. Un thread writer lo formatea, escribe por lotes y rota
+// el archivo por día. Si el ring se llena el registro se pierde y se cuenta en dropped().
+// Con LogFormat::BINARY el writer no arma JSON: copia los valores tal cual y cambia los punteros por ids de la
+// tabla de nombres del segmento (ver logformat.h). Los archivos de días cerrados los comprime a .gz otro thread.
 class JsonLogger {
 public:
-    JsonLogger(std::string directory, LogLevel level)
-        : dir_(std::move(directory)), level_(level) {
+    JsonLogger(std::string directory, LogLevel level, LogFormat format)
+        : dir_(std::move(directory)), level_(level), format_(format) {
         rotateIfNeeded();
+        writer_ = std::thread([this]() { writerLoop(); });
+        if (format_ == LogFormat::BINARY) {
+            queueStaleBinaryFiles();
+            compressor_ = std::thread([this]() { compressorLoop(); });
+        }
     }
 
-    void log(LogLevel level, const std::string& event, const std::string& extraJson = "") {
-        if (static_cast<int>(level) > static_cast<int>(level_)) {
-            return;
+    JsonLogger(const JsonLogger&) = delete;
+    JsonLogger& operator=(const JsonLogger&) = delete;
+
+    ~JsonLogger() {
+        {
+            std::lock_guard<std::mutex> lock(writerMu_);
+            stopping_ = true;
         }
-        std::lock_guard<std::mutex> lock(mu_);
-        rotateIfNeeded();
+        writerCv_.notify_one();
+        writer_.join();
+        if (compressor_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(compressMu_);
+                compressStopping_ = true;
+            }
+            compressCv_.notify_one();
+            compressor_.join();
+        }
+    }
 
-        file_ << "{\"tsMs\":" << nowMs()
-              << ",\"event\":\"" << jsonEscape(event) << "\"";
-        if (!extraJson.empty()) {
-            file_ << "," << extraJson;
+    bool enabled(LogLevel level) const { return static_cast<int>(level) <= static_cast<int>(level_); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    uint64_t queueDepth() const { return ring_.depth(); }
+
+    void submit(const uint8_t* data, size_t size) {
+        if (!ring_.push(data, size)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
         }
-        file_ << "}\n";
-        file_.flush();
     }
 
 private:
+    void writerLoop() {
+        std::vector<uint8_t> record;
+        std::string batch;
+        bool stopping = false;
+        while (!stopping) {
+            {
+                std::unique_lock<std::mutex> lock(writerMu_);
+                writerCv_.wait_for(lock, std::chrono::milliseconds(LOG_WRITER_INTERVAL_MS), [this]() { return stopping_; });
+                stopping = stopping_;
+            }
+            if (!ring_.pop(record)) {
+                continue;
+            }
+            // Se rota antes de codificar: en binario los ids de nombres son del segmento del archivo abierto.
+            rotateIfNeeded();
+            batch.clear();
+            do {
+                if (format_ == LogFormat::BINARY) {
+                    appendBinaryRecord(record, batch);
+                } else {
+                    LogReader reader(record.data(), record.size(), sizeof(uint32_t));
+                    formatLogRecord(reader, [](LogReader& r) { return r.take<const char*>(); }, batch);
+                }
+            } while (ring_.pop(record));
+            file_.write(batch.data(), static_cast<std::streamsize>(batch.size()));
+            file_.flush();
+        }
+    }
+
+    template <typename T>
+    static void put(std::string& out, const T& value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    static void putBinaryRecord(std::string& out, LogBinaryKind kind, const std::string& payload) {
+        put(out, static_cast<uint32_t>(payload.size() + 1));
+        put(out, kind);
+        out += payload;
+    }
+
+    // Devuelve el id del nombre; la primera vez lo define con un registro NAME antes del evento.
+    uint16_t nameId(const char* name, std::string& out) {
+        auto it = names_.find(name);
+        if (it != names_.end()) {
+            return it->second;
+        }
+        const auto id = static_cast<uint16_t>(names_.size());
+        names_.emplace(name, id);
+        std::string payload;
+        put(payload, id);
+        payload += name;
+        putBinaryRecord(out, LogBinaryKind::NAME, payload);
+        return id;
+    }
+
+    void appendBinaryRecord(const std::vector<uint8_t>& record, std::string& out) {
+        LogReader reader(record.data(), record.size(), sizeof(uint32_t));
+        std::string& body = binaryBody_;
+        body.clear();
+        put(body, reader.take<uint64_t>());
+        put(body, nameId(reader.take<const char*>(), out));
+        while (!reader.done()) {
+            const auto type = static_cast<LogFieldType>(reader.take<uint8_t>());
+            const uint16_t key = nameId(reader.take<const char*>(), out);
+            const size_t valueStart = reader.offset();
+            reader.skipValue(type);
+            put(body, type);
+            put(body, key);
+            body.append(reinterpret_cast<const char*>(record.data() + valueStart), reader.offset() - valueStart);
+        }
+        putBinaryRecord(out, LogBinaryKind::EVENT, body);
+    }
+
+    std::string pathFor(const std::string& key) const {
+        return dir_ + "/server_" + key + (format_ == LogFormat::BINARY ? LOG_BINARY_EXTENSION : ".jsonl");
+    }
+
     void rotateIfNeeded() {
         const std::string key = nowDateKey();
         if (file_.is_open() && key == currentKey_) {
@@ -470,267 +857,4041 @@ private:
         }
         if (file_.is_open()) {
             file_.close();
+            if (format_ == LogFormat::BINARY) {
+                queueCompression(pathFor(currentKey_));
+            }
         }
 
         currentKey_ = key;
-        std::string path = dir_ + "/server_" + key + ".jsonl";
-        file_.open(path, std::ios::out | std::ios::app);
+        std::string path = pathFor(key);
+        file_.open(path, std::ios::out | std::ios::app | std::ios::binary);
         if (!file_.is_open()) {
             std::cerr << "No se pudo abrir log en " << path << std::endl;
+            return;
+        }
+        if (format_ == LogFormat::BINARY) {
+            // Un segmento por apertura: si el archivo ya existía (reinicio en el mismo día) la tabla arranca de nuevo.
+            names_.clear();
+            std::string payload(LOG_BINARY_MAGIC, sizeof(LOG_BINARY_MAGIC));
+            put(payload, LOG_BINARY_VERSION);
+            std::string segment;
+            putBinaryRecord(segment, LogBinaryKind::SEGMENT, payload);
+            file_.write(segment.data(), static_cast<std::streamsize>(segment.size()));
+            file_.flush();
+        }
+    }
+
+    // Archivos binarios de días anteriores que quedaron sin comprimir (server detenido antes de rotar).
+    void queueStaleBinaryFiles() {
+        DIR* dir = opendir(dir_.c_str());
+        if (!dir) {
+            return;
+        }
+        const std::string current = "server_" + currentKey_ + LOG_BINARY_EXTENSION;
+        const std::string extension = LOG_BINARY_EXTENSION;
+        while (dirent* entry = readdir(dir)) {
+            const std::string name = entry->d_name;
+            if (name.rfind("server_", 0) == 0 && name.size() > extension.size() &&
+                name.compare(name.size() - extension.size(), extension.size(), extension) == 0 && name != current) {
+                queueCompression(dir_ + "/" + name);
+            }
+        }
+        closedir(dir);
+    }
+
+    void queueCompression(const std::string& path) {
+        {
+            std::lock_guard<std::mutex> lock(compressMu_);
+            compressQueue_.push_back(path);
+        }
+        compressCv_.notify_one();
+    }
+
+    void compressorLoop() {
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 10);
+        while (true) {
+            std::string path;
+            {
+                std::unique_lock<std::mutex> lock(compressMu_);
+                compressCv_.wait(lock, [this]() { return compressStopping_ || !compressQueue_.empty(); });
+                // Lo que quede pendiente al parar lo retoma queueStaleBinaryFiles en el próximo arranque.
+                if (compressStopping_) {
+                    return;
+                }
+                path = compressQueue_.front();
+                compressQueue_.erase(compressQueue_.begin());
+            }
+            gzipFile(path);
+        }
+    }
+
+    static void gzipFile(const std::string& path) {
+        const std::string target = path + ".gz";
+        FILE* in = fopen(path.c_str(), "rb");
+        if (!in) {
+            return;
+        }
+        gzFile out = gzopen(target.c_str(), "wb6");
+        if (!out) {
+            fclose(in);
+            std::cerr << "No se pudo crear " << target << std::endl;
+            return;
+        }
+        std::vector<char> buffer(1 << 16);
+        bool ok = true;
+        size_t n = 0;
+        while (ok && (n = fread(buffer.data(), 1, buffer.size(), in)) > 0) {
+            ok = gzwrite(out, buffer.data(), static_cast<unsigned>(n)) == static_cast<int>(n);
+        }
+        ok = ok && !ferror(in);
+        ok = gzclose(out) == Z_OK && ok;
+        fclose(in);
+        if (ok) {
+            unlink(path.c_str());
+        } else {
+            unlink(target.c_str());
+            std::cerr << "No se pudo comprimir " << path << std::endl;
         }
     }
 
-    std::mutex mu_;
     std::string dir_;
     LogLevel level_;
+    LogFormat format_;
+    LogRing ring_;
+    std::atomic<uint64_t> dropped_{0};
     std::string currentKey_;
     std::ofstream file_;
+    std::unordered_map<const char*, uint16_t> names_; // tabla del segmento binario abierto
+    std::string binaryBody_;
+    std::mutex writerMu_; // sólo writer y destructor: los productores no lo tocan
+    std::condition_variable writerCv_;
+    bool stopping_ = false;
+    std::thread writer_;
+    std::mutex compressMu_;
+    std::condition_variable compressCv_;
+    std::vector<std::string> compressQueue_;
+    bool compressStopping_ = false;
+    std::thread compressor_;
 };
 
-template <typename T>
-void appendLe(std::vector<uint8_t>& buffer, T value) {
-    for (size_t i = 0; i < sizeof(T); ++i) {
-        buffer.push_back(static_cast<uint8_t>((static_cast<uint64_t>(value) >> (8U * i)) & 0xFFU));
+// Arma un registro en un buffer por thread y lo entrega al ring al destruirse, de modo que una línea de log
+// es una sola expresión: LogRecord(logger, LogLevel::SUMMARY, "evento").u64("campo", v).str("otro", s);
+// Con el nivel deshabilitado todos los métodos son no-op.
+class LogRecord {
+public:
+    LogRecord(JsonLogger& logger, LogLevel level, const char* event)
+        : logger_(logger), enabled_(logger.enabled(level)), buffer_(scratch()) {
+        if (!enabled_) {
+            return;
+        }
+        buffer_.clear();
+        put(uint32_t{0});
+        put(nowMs());
+        put(event);
     }
-}
 
-template <typename T>
-bool readLe(const uint8_t* data, size_t size, size_t& offset, T& out) {
-    if (offset + sizeof(T) > size) {
-        return false;
-    }
-    uint64_t value = 0;
-    for (size_t i = 0; i < sizeof(T); ++i) {
-        value |= static_cast<uint64_t>(data[offset + i]) << (8U * i);
+    LogRecord(const LogRecord&) = delete;
+    LogRecord& operator=(const LogRecord&) = delete;
+
+    ~LogRecord() {
+        if (!enabled_) {
+            return;
+        }
+        const auto size = static_cast<uint32_t>(buffer_.size());
+        std::memcpy(buffer_.data(), &size, sizeof(size));
+        logger_.submit(buffer_.data(), buffer_.size());
     }
-    out = static_cast<T>(value);
-    offset += sizeof(T);
-    return true;
-}
 
-std::vector<uint8_t> makeUdpPacket(UdpMessageType type, uint32_t sessionId, uint32_t seq, const std::vector<uint8_t>& body) {
-    std::vector<uint8_t> packet;
-    packet.reserve(12 + body.size());
-    appendLe<uint16_t>(packet, static_cast<uint16_t>(type));
-    appendLe<uint16_t>(packet, UDP_PROTOCOL_VERSION);
-    appendLe<uint32_t>(packet, sessionId);
-    appendLe<uint32_t>(packet, seq);
-    packet.insert(packet.end(), body.begin(), body.end());
-    return packet;
-}
+    LogRecord& u64(const char* key, uint64_t value) { return field(LogFieldType::U64, key, value); }
+    LogRecord& i64(const char* key, int64_t value) { return field(LogFieldType::I64, key, value); }
+    LogRecord& f64(const char* key, double value) { return field(LogFieldType::F64, key, value); }
+    LogRecord& boolean(const char* key, bool value) { return field(LogFieldType::BOOL, key, static_cast<uint8_t>(value ? 1 : 0)); }
 
-bool parseUdpHeader(const uint8_t* data, size_t size, UdpHeader& header) {
-    if (size < 12) {
-        return false;
+    LogRecord& null(const char* key) {
+        if (enabled_) {
+            header(LogFieldType::NUL, key);
+        }
+        return *this;
     }
-    size_t offset = 0;
-    uint16_t type = 0;
-    if (!readLe<uint16_t>(data, size, offset, type)) return false;
-    if (!readLe<uint16_t>(data, size, offset, header.version)) return false;
-    if (!readLe<uint32_t>(data, size, offset, header.sessionId)) return false;
-    if (!readLe<uint32_t>(data, size, offset, header.seq)) return false;
 
-    header.type = static_cast<UdpMessageType>(type);
-    return true;
-}
+    LogRecord& str(const char* key, const char* value) { return str(key, value, std::strlen(value)); }
+    LogRecord& str(const char* key, const std::string& value) { return str(key, value.data(), value.size()); }
 
-std::vector<uint8_t> makeTcpFrame(TcpMessageType type, uint32_t sessionId, const std::vector<uint8_t>& body) {
-    std::vector<uint8_t> frame;
-    frame.reserve(16 + body.size());
-    appendLe<uint32_t>(frame, TCP_MAGIC);
-    appendLe<uint16_t>(frame, TCP_PROTOCOL_VERSION);
-    appendLe<uint16_t>(frame, static_cast<uint16_t>(type));
-    appendLe<uint32_t>(frame, sessionId);
-    appendLe<uint32_t>(frame, static_cast<uint32_t>(body.size()));
-    frame.insert(frame.end(), body.begin(), body.end());
-    return frame;
-}
+    LogRecord& addr(const char* key, const sockaddr_in& value) {
+        if (enabled_) {
+            header(LogFieldType::ADDR, key);
+            putAddr(value);
+        }
+        return *this;
+    }
 
-bool readExact(int fd, uint8_t* out, size_t bytes) {
-    size_t readTotal = 0;
-    while (readTotal < bytes) {
-        ssize_t n = recv(fd, out + readTotal, bytes - readTotal, 0);
-        if (n == 0) {
-            return false;
+    LogRecord& sessionTag(const char* key, uint32_t sessionId, const sockaddr_in& client) {
+        if (enabled_) {
+            header(LogFieldType::SESSION_TAG, key);
+            put(sessionId);
+            putAddr(client);
         }
-        if (n < 0) {
-            if (errno == EINTR) {
-                continue;
+        return *this;
+    }
+
+    LogRecord& u64Array(const char* key, const uint64_t* values, size_t count) {
+        if (enabled_) {
+            header(LogFieldType::U64_ARRAY, key);
+            put(static_cast<uint32_t>(count));
+            for (size_t i = 0; i < count; ++i) {
+                put(values[i]);
             }
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                return false;
+        }
+        return *this;
+    }
+
+    // rowFn(i, row) completa las `cols` columnas de la fila i.
+    template <typename RowFn>
+    LogRecord& u64Rows(const char* key, size_t rows, size_t cols, RowFn rowFn) {
+        if (enabled_) {
+            header(LogFieldType::U64_ROWS, key);
+            put(static_cast<uint32_t>(rows));
+            put(static_cast<uint32_t>(cols));
+            uint64_t row[16] = {};
+            for (size_t i = 0; i < rows; ++i) {
+                rowFn(i, row);
+                for (size_t c = 0; c < cols; ++c) {
+                    put(row[c]);
+                }
             }
-            return false;
         }
-        readTotal += static_cast<size_t>(n);
+        return *this;
     }
-    return true;
-}
 
-bool writeAll(int fd, const uint8_t* data, size_t bytes) {
-    size_t sent = 0;
-    while (sent < bytes) {
-        ssize_t n = send(fd, data + sent, bytes - sent, 0);
-        if (n < 0) {
-            if (errno == EINTR) {
-                continue;
+    LogRecord& strArray(const char* key, const std::vector<std::string>& values) {
+        if (enabled_) {
+            header(LogFieldType::STR_ARRAY, key);
+            put(static_cast<uint32_t>(values.size()));
+            for (const std::string& value : values) {
+                putString(value.data(), value.size());
             }
-            return false;
         }
-        sent += static_cast<size_t>(n);
+        return *this;
     }
-    return true;
-}
 
-bool readTcpFrame(int fd, TcpHeader& header, std::vector<uint8_t>& body) {
-    uint8_t headerBuf[16];
-    if (!readExact(fd, headerBuf, sizeof(headerBuf))) {
-        return false;
+private:
+    static std::vector<uint8_t>& scratch() {
+        thread_local std::vector<uint8_t> buffer;
+        return buffer;
     }
 
-    size_t offset = 0;
-    uint16_t typeRaw = 0;
-    if (!readLe<uint32_t>(headerBuf, sizeof(headerBuf), offset, header.magic)) return false;
-    if (!readLe<uint16_t>(headerBuf, sizeof(headerBuf), offset, header.version)) return false;
-    if (!readLe<uint16_t>(headerBuf, sizeof(headerBuf), offset, typeRaw)) return false;
-    if (!readLe<uint32_t>(headerBuf, sizeof(headerBuf), offset, header.sessionId)) return false;
-    if (!readLe<uint32_t>(headerBuf, sizeof(headerBuf), offset, header.length)) return false;
+    template <typename T>
+    void put(const T& value) {
+        const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+        buffer_.insert(buffer_.end(), bytes, bytes + sizeof(T));
+    }
 
-    header.type = static_cast<TcpMessageType>(typeRaw);
+    void putString(const char* value, size_t size) {
+        put(static_cast<uint32_t>(size));
+        buffer_.insert(buffer_.end(), value, value + size);
+    }
 
-    if (header.magic != TCP_MAGIC || header.version != TCP_PROTOCOL_VERSION) {
-        return false;
+    void putAddr(const sockaddr_in& value) {
+        put(static_cast<uint32_t>(value.sin_addr.s_addr));
+        put(static_cast<uint16_t>(value.sin_port));
     }
 
-    body.assign(header.length, 0);
-    if (header.length > 0 && !readExact(fd, body.data(), header.length)) {
-        return false;
+    void header(LogFieldType type, const char* key) {
+        put(type);
+        put(key);
     }
-    return true;
+
+    template <typename T>
+    LogRecord& field(LogFieldType type, const char* key, T value) {
+        if (enabled_) {
+            header(type, key);
+            put(value);
+        }
+        return *this;
+    }
+
+    LogRecord& str(const char* key, const char* value, size_t size) {
+        if (enabled_) {
+            header(LogFieldType::STR, key);
+            putString(value, size);
+        }
+        return *this;
+    }
+
+    JsonLogger& logger_;
+    bool enabled_;
+    std::vector<uint8_t>& buffer_;
+};
+
+// Palabra `word` del bitmap de recepción (bit i = seq word * 64 + i). Los seq desde `count` se leen como
+// recibidos para que el relleno del último byte no cuente como pérdida.
+uint64_t bitmapWord(const uint8_t* bitmap, uint32_t count, uint32_t word) {
+    const uint32_t firstSeq = word * 64U;
+    const uint32_t bytes = std::min<uint32_t>(8U, (count + 7U) / 8U - word * 8U);
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(bitmap[word * 8U + i]) << (8U * i);
+    }
+    if (count - firstSeq < 64U) {
+        value |= ~0ULL << (count - firstSeq);
+    }
+    return value;
 }
 
-void printHelp(const char* prog) {
-    std::cout
-        << "Usage: " << prog << " [options]\n"
-        << "  -p, --port <port>           Puerto UDP/TCP (default 9000)\n"
-        << "  -t, --tick <ms>             Override global tick UDP (>0)\n"
-        << "      --max-sessions <n>      Sesiones simultáneas máximas (default 50)\n"
-        << "      --log-dir <path>        Directorio de logs JSONL (default .)\n"
-        << "      --log-level <level>     summary|events|verbose (default summary)\n"
-        << "  -h, --help                  Mostrar ayuda\n";
+// Pérdidas como rachas de seq faltantes: pares varint (distancia desde el fin de la racha anterior, largo).
+// El bitmap se recorre de a 64 seq saltando con ctz, así el costo lo dominan las rachas y no los paquetes.
+void appendLossRuns(std::vector<uint8_t>& out, const uint8_t* bitmap, uint32_t count) {
+    const uint32_t words = (count + 63U) / 64U;
+    uint32_t word = 0;
+    uint32_t prevEnd = 0;
+    uint64_t missing = words > 0 ? ~bitmapWord(bitmap, count, 0) : 0;
+    while (word < words) {
+        if (missing == 0) {
+            if (++word < words) {
+                missing = ~bitmapWord(bitmap, count, word);
+            }
+            continue;
+        }
+        const auto startBit = static_cast<uint32_t>(__builtin_ctzll(missing));
+        const uint32_t start = word * 64U + startBit;
+        uint64_t received = ~missing & (~0ULL << startBit);
+        while (received == 0 && ++word < words) {
+            received = bitmapWord(bitmap, count, word);
+        }
+        const uint32_t end = word < words ? word * 64U + static_cast<uint32_t>(__builtin_ctzll(received)) : count;
+        appendVarint(out, start - prevEnd);
+        appendVarint(out, end - start);
+        prevEnd = end;
+        if (word < words) {
+            missing = ~bitmapWord(bitmap, count, word) & (~0ULL << (end - word * 64U));
+        }
+    }
 }
 
-LogLevel parseLogLevel(const std::string& value) {
-    if (value == "summary") return LogLevel::SUMMARY;
-    if (value == "events") return LogLevel::EVENTS;
-    if (value == "verbose") return LogLevel::VERBOSE;
-    return LogLevel::SUMMARY;
+size_t batchHistBucket(size_t batchSize) {
+    size_t bucket = 0;
+    while (batchSize > 1 && bucket + 1 < UDP_BATCH_HIST_BUCKETS) {
+        batchSize >>= 1U;
+        ++bucket;
+    }
+    return bucket;
 }
 
-bool parseOptions(int argc, char* argv[], ServerOptions& options) {
-    for (int i = 1; i < argc; ++i) {
+void logHistogram(LogRecord& record, const char* key, const std::atomic<uint64_t>* buckets, size_t count) {
+    uint64_t values[UDP_BATCH_HIST_BUCKETS] = {};
+    count = std::min(count, UDP_BATCH_HIST_BUCKETS);
+    for (size_t i = 0; i < count; ++i) {
+        values[i] = buckets[i].load();
+    }
+    record.u64Array(key, values, count);
+}
+
+void logMetricHistogram(LogRecord& record, const char* key, const MetricHistogram& histogram) {
+    uint64_t values[METRICS_MAX_BOUNDS + 1] = {};
+    for (size_t i = 0; i < histogram.bucketCount(); ++i) {
+        values[i] = histogram.bucket(i);
+    }
+    record.u64Array(key, values, histogram.bucketCount());
+}
+
+// Tipo de operación, guardado en los bits altos del user_data de cada SQE/CQE.
+enum class UringTag : uint8_t {
+    UDP_RX = 1,
+    UDP_TX = 2,
+    EPOLL = 3,
+    TCP_SEND = 4,
+    CANCEL = 5
+};
+
+inline uint64_t uringUserData(UringTag tag, uint32_t value) {
+    return (static_cast<uint64_t>(tag) << 56) | value;
+}
+
+inline UringTag uringTagOf(const io_uring_cqe& cqe) {
+    return static_cast<UringTag>(cqe.user_data >> 56);
+}
+
+inline uint32_t uringValueOf(const io_uring_cqe& cqe) {
+    return static_cast<uint32_t>(cqe.user_data);
+}
+
+// io_uring por syscalls directas (sin liburing): SQ/CQ mapeados, un ring de buffers provistos para RX y una
+// cola de CQEs diferidos para quien necesita esperar completions propias sin perder las ajenas.
+class IoUring {
+public:
+    IoUring() = default;
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    ~IoUring() {
+        if (bufRing_ != nullptr) {
+            munmap(bufRing_, bufRingBytes_);
+        }
+        if (sqes_ != nullptr) {
+            munmap(sqes_, sqesBytes_);
+        }
+        if (cqRing_ != nullptr && cqRing_ != sqRing_) {
+            munmap(cqRing_, cqRingBytes_);
+        }
+        if (sqRing_ != nullptr) {
+            munmap(sqRing_, sqRingBytes_);
+        }
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    bool init(unsigned entries) {
+        io_uring_params params{};
+        fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0) {
+            return false;
+        }
+        if ((params.features & IORING_FEAT_EXT_ARG) == 0 || (params.features & IORING_FEAT_NODROP) == 0) {
+            return false;
+        }
+
+        sqRingBytes_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingBytes_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMmap) {
+            sqRingBytes_ = cqRingBytes_ = std::max(sqRingBytes_, cqRingBytes_);
+        }
+        sqRing_ = mapRing(sqRingBytes_, IORING_OFF_SQ_RING);
+        if (sqRing_ == nullptr) {
+            return false;
+        }
+        cqRing_ = singleMmap ? sqRing_ : mapRing(cqRingBytes_, IORING_OFF_CQ_RING);
+        sqesBytes_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(mapRing(sqesBytes_, IORING_OFF_SQES));
+        if (cqRing_ == nullptr || sqes_ == nullptr) {
+            return false;
+        }
+
+        auto* sq = static_cast<uint8_t*>(sqRing_);
+        auto* cq = static_cast<uint8_t*>(cqRing_);
+        sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqEntries_ = params.sq_entries;
+        cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        localTail_ = submittedTail_ = *sqTail_;
+        return true;
+    }
+
+    // SQE en cero listo para llenar; si la SQ está llena primero se envía lo pendiente.
+    io_uring_sqe* nextSqe() {
+        if (localTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) {
+            submitAndWait(0, -1);
+            if (localTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) {
+                return nullptr;
+            }
+        }
+        const unsigned index = localTail_ & sqMask_;
+        sqArray_[index] = index;
+        ++localTail_;
+        io_uring_sqe* sqe = &sqes_[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // Un solo io_uring_enter: envía las SQEs pendientes y, si minComplete > 0, espera completions hasta
+    // timeoutNs (negativo: sin límite).
+    int submitAndWait(unsigned minComplete, int64_t timeoutNs) {
+        __atomic_store_n(sqTail_, localTail_, __ATOMIC_RELEASE);
+        const unsigned toSubmit = localTail_ - submittedTail_;
+        if (toSubmit == 0 && minComplete == 0) {
+            return 0;
+        }
+        unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+        __kernel_timespec ts{};
+        io_uring_getevents_arg arg{};
+        void* argp = nullptr;
+        size_t argSize = 0;
+        if (minComplete > 0 && timeoutNs >= 0) {
+            ts.tv_sec = timeoutNs / 1000000000LL;
+            ts.tv_nsec = timeoutNs % 1000000000LL;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+            argp = &arg;
+            argSize = sizeof(arg);
+            flags |= IORING_ENTER_EXT_ARG;
+        }
+        ++enters_;
+        int ret = static_cast<int>(syscall(__NR_io_uring_enter, fd_, toSubmit, minComplete, flags, argp, argSize));
+        if (ret > 0) {
+            submittedTail_ += static_cast<unsigned>(ret);
+        }
+        return ret;
+    }
+
+    // Devuelve primero los CQEs diferidos y después los nuevos.
+    size_t reap(io_uring_cqe* out, size_t max) {
+        size_t count = 0;
+        while (count < max && !deferred_.empty()) {
+            out[count++] = deferred_.back();
+            deferred_.pop_back();
+        }
+        return count + reapNew(out + count, max - count);
+    }
+
+    size_t reapNew(io_uring_cqe* out, size_t max) {
+        unsigned head = *cqHead_;
+        const unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        size_t count = 0;
+        while (head != tail && count < max) {
+            out[count++] = cqes_[head & cqMask_];
+            ++head;
+        }
+        __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    void defer(const io_uring_cqe& cqe) { deferred_.push_back(cqe); }
+    bool hasDeferred() const { return !deferred_.empty(); }
+
+    bool setupBufferRing(uint16_t group, uint16_t count, uint32_t bufferBytes) {
+        bufRingBytes_ = count * sizeof(io_uring_buf);
+        void* ring = mmap(nullptr, bufRingBytes_, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (ring == MAP_FAILED) {
+            return false;
+        }
+        bufRing_ = static_cast<io_uring_buf*>(ring);
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(bufRing_);
+        reg.ring_entries = count;
+        reg.bgid = group;
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            return false;
+        }
+        bufCount_ = count;
+        bufferBytes_ = bufferBytes;
+        bufferMemory_.resize(static_cast<size_t>(count) * bufferBytes);
+        for (uint16_t id = 0; id < count; ++id) {
+            recycleBuffer(id);
+        }
+        return true;
+    }
+
+    uint8_t* buffer(uint16_t id) { return bufferMemory_.data() + static_cast<size_t>(id) * bufferBytes_; }
+    uint32_t bufferBytes() const { return bufferBytes_; }
+
+    // El ring se maneja como arreglo plano de io_uring_buf: en C++ el flex array de io_uring_buf_ring queda
+    // desplazado. El tail es el campo resv de la primera entrada.
+    void recycleBuffer(uint16_t id) {
+        io_uring_buf& entry = bufRing_[bufTail_ & (bufCount_ - 1)];
+        entry.addr = reinterpret_cast<uint64_t>(buffer(id));
+        entry.len = bufferBytes_;
+        entry.bid = id;
+        ++bufTail_;
+        __atomic_store_n(&bufRing_[0].resv, bufTail_, __ATOMIC_RELEASE);
+    }
+
+    uint64_t enters() const { return enters_; }
+
+    // El kernel tiene que soportar los opcodes usados, EXT_ARG y rings de buffers provistos.
+    static bool supported() {
+        IoUring ring;
+        if (!ring.init(8) || !ring.setupBufferRing(0, 8, 64)) {
+            return false;
+        }
+        std::vector<uint8_t> storage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+        auto* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+        if (syscall(__NR_io_uring_register, ring.fd_, IORING_REGISTER_PROBE, probe, 256) < 0) {
+            return false;
+        }
+        for (int op : {IORING_OP_RECVMSG, IORING_OP_SENDMSG, IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL}) {
+            if (op > probe->last_op || (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    void* mapRing(size_t bytes, off_t offset) {
+        void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    int fd_ = -1;
+    void* sqRing_ = nullptr;
+    void* cqRing_ = nullptr;
+    size_t sqRingBytes_ = 0;
+    size_t cqRingBytes_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqesBytes_ = 0;
+    unsigned* sqHead_ = nullptr;
+    unsigned* sqTail_ = nullptr;
+    unsigned sqMask_ = 0;
+    unsigned* sqArray_ = nullptr;
+    unsigned sqEntries_ = 0;
+    unsigned* cqHead_ = nullptr;
+    unsigned* cqTail_ = nullptr;
+    unsigned cqMask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+    unsigned localTail_ = 0;
+    unsigned submittedTail_ = 0;
+    std::vector<io_uring_cqe> deferred_;
+    io_uring_buf* bufRing_ = nullptr;
+    size_t bufRingBytes_ = 0;
+    uint16_t bufCount_ = 0;
+    uint16_t bufTail_ = 0;
+    uint32_t bufferBytes_ = 0;
+    std::vector<uint8_t> bufferMemory_;
+    uint64_t enters_ = 0;
+};
+
+// Timestamp CLOCK_REALTIME de llegada según el kernel (SO_TIMESTAMPNS/SO_TIMESTAMPING), 0 si no vino.
+uint64_t cmsgRxRealtimeNs(const msghdr& hdr) {
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(const_cast<msghdr*>(&hdr), cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && (cmsg->cmsg_type == SCM_TIMESTAMPNS || cmsg->cmsg_type == SCM_TIMESTAMPING)) {
+            // scm_timestamping empieza con el timestamp software, igual que SCM_TIMESTAMPNS.
+            timespec ts{};
+            std::memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+        }
+    }
+    return 0;
+}
+
+// Lote de recepción para recvmmsg: buffers, direcciones e iovecs preasignados.
+class UdpRxBatch {
+public:
+    explicit UdpRxBatch(size_t capacity)
+        : buffers_(capacity * UDP_MAX_DATAGRAM_BYTES), controls_(capacity * CONTROL_BYTES), addrs_(capacity),
+          iovs_(capacity), msgs_(capacity) {
+        for (size_t i = 0; i < capacity; ++i) {
+            iovs_[i].iov_base = buffers_.data() + i * UDP_MAX_DATAGRAM_BYTES;
+            iovs_[i].iov_len = UDP_MAX_DATAGRAM_BYTES;
+        }
+    }
+
+    // Devuelve la cantidad de datagramas recibidos, 0 si no hay nada pendiente o -1 ante error.
+    int receive(int fd) {
+        for (size_t i = 0; i < msgs_.size(); ++i) {
+            msghdr& hdr = msgs_[i].msg_hdr;
+            std::memset(&hdr, 0, sizeof(hdr));
+            hdr.msg_name = &addrs_[i];
+            hdr.msg_namelen = sizeof(sockaddr_in);
+            hdr.msg_iov = &iovs_[i];
+            hdr.msg_iovlen = 1;
+            hdr.msg_control = controls_.data() + i * CONTROL_BYTES;
+            hdr.msg_controllen = CONTROL_BYTES;
+            msgs_[i].msg_len = 0;
+        }
+        while (true) {
+            int n = recvmmsg(fd, msgs_.data(), static_cast<unsigned int>(msgs_.size()), MSG_DONTWAIT, nullptr);
+            if (n >= 0) {
+                return n;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+    }
+
+    const uint8_t* data(size_t i) const { return buffers_.data() + i * UDP_MAX_DATAGRAM_BYTES; }
+    size_t size(size_t i) const { return msgs_[i].msg_len; }
+    const sockaddr_in& from(size_t i) const { return addrs_[i]; }
+
+    uint64_t kernelRxRealtimeNs(size_t i) const { return cmsgRxRealtimeNs(msgs_[i].msg_hdr); }
+
+private:
+    static constexpr size_t CONTROL_BYTES = 128;
+
+    std::vector<uint8_t> buffers_;
+    std::vector<uint8_t> controls_;
+    std::vector<sockaddr_in> addrs_;
+    std::vector<iovec> iovs_;
+    std::vector<mmsghdr> msgs_;
+};
+
+// Qué se envió en cada datagrama, para asociar el timestamp TX del kernel con su sesión.
+struct UdpTxMeta {
+    bool track = false;
+    UdpMessageType type = UdpMessageType::DOWN_TICK;
+    UdpSessionKey key{};
+    uint32_t seq = 0;
+    uint64_t clientSendNs = 0;
+    uint64_t arrivalNs = 0;      // recepción de la request (kernel o salida de recvmmsg); 0: no se mide
+    bool stampResidence = false; // DOWN_TICK con la feature: flush() escribe la residencia en flags
+};
+
+// Con SOF_TIMESTAMPING_OPT_ID el kernel numera los datagramas enviados por el socket en orden (0, 1, 2...);
+// el ring guarda la metadata de los últimos envíos indexada por ese id.
+class UdpTxTimestampRing {
+public:
+    UdpTxTimestampRing() : entries_(SIZE) {}
+
+    void record(const UdpTxMeta& meta) {
+        Entry& entry = entries_[nextId_ & (SIZE - 1)];
+        entry.id = nextId_;
+        entry.meta = meta;
+        ++nextId_;
+    }
+
+    const UdpTxMeta* lookup(uint32_t id) const {
+        const Entry& entry = entries_[id & (SIZE - 1)];
+        if (entry.id != id || !entry.meta.track) {
+            return nullptr;
+        }
+        return &entry.meta;
+    }
+
+private:
+    static constexpr size_t SIZE = 4096;
+
+    struct Entry {
+        uint32_t id = UINT32_MAX;
+        UdpTxMeta meta;
+    };
+
+    std::vector<Entry> entries_;
+    uint32_t nextId_ = 0;
+};
+
+// Lote de envío para sendmmsg: las respuestas se copian a slots fijos y salen juntas en flush(). Con io_uring
+// hay dos juegos de slots que se alternan en cada flush: mientras un lote está en vuelo se arma el siguiente.
+class UdpTxBatch {
+public:
+    UdpTxBatch(int fd, size_t capacity, TrafficCounters& counters, UdpWorkerCounters& workerCounters)
+        : fd_(fd), capacity_(capacity), buffers_(2 * capacity * UDP_MAX_REPLY_BYTES), addrs_(2 * capacity),
+          iovs_(2 * capacity), msgs_(2 * capacity), metas_(2 * capacity), counters_(counters),
+          workerCounters_(workerCounters) {}
+
+    ~UdpTxBatch() { flush(); }
+
+    void setTimestampRing(UdpTxTimestampRing* ring) { timestampRing_ = ring; }
+
+    // Con io_uring flush() sólo encola SENDMSG: los slots quedan en vuelo hasta sus CQEs (complete()).
+    void setUring(IoUring* ring) { ring_ = ring; }
+    size_t inflight() const { return inflight_[0] + inflight_[1]; }
+
+    void queue(const sockaddr_in& to, const std::vector<uint8_t>& packet, const UdpTxMeta& meta = UdpTxMeta{}) {
+        if (packet.size() > UDP_MAX_REPLY_BYTES) {
+            return;
+        }
+        std::memcpy(prepare(), packet.data(), packet.size());
+        commit(to, packet.size(), meta);
+    }
+
+    // Slot libre de UDP_MAX_REPLY_BYTES para armar la respuesta en el lugar; se confirma con commit().
+    uint8_t* prepare() {
+        if (count_ == capacity_) {
+            flush();
+        }
+        // Sólo se bloquea si el juego de slots que toca reusar sigue en vuelo (dos flush seguidos sin reap).
+        if (count_ == 0 && inflight_[set_] > 0) {
+            waitInflight(set_);
+        }
+        return buffers_.data() + (base() + count_) * UDP_MAX_REPLY_BYTES;
+    }
+
+    void commit(const sockaddr_in& to, size_t length, const UdpTxMeta& meta = UdpTxMeta{}) {
+        const size_t index = base() + count_;
+        addrs_[index] = to;
+        iovs_[index].iov_base = buffers_.data() + index * UDP_MAX_REPLY_BYTES;
+        iovs_[index].iov_len = length;
+        msghdr& hdr = msgs_[index].msg_hdr;
+        std::memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_name = &addrs_[index];
+        hdr.msg_namelen = sizeof(sockaddr_in);
+        hdr.msg_iov = &iovs_[index];
+        hdr.msg_iovlen = 1;
+        metas_[index] = meta;
+        ++count_;
+    }
+
+    void flush() {
+        if (count_ == 0) {
+            return;
+        }
+        counters_.udpTxBatchHist[batchHistBucket(count_)].fetch_add(1);
+        recordResidence();
+        if (ring_ != nullptr) {
+            for (size_t i = base(); i < base() + count_; ++i) {
+                io_uring_sqe* sqe = ring_->nextSqe();
+                if (sqe == nullptr) {
+                    // SQ llena aun después de enviar lo pendiente: se reintenta tras reapear las respuestas en vuelo.
+                    waitInflight(set_ ^ 1U);
+                    sqe = ring_->nextSqe();
+                }
+                if (sqe == nullptr) {
+                    counters_.udpTxDropped.fetch_add(1);
+                    continue;
+                }
+                sqe->opcode = IORING_OP_SENDMSG;
+                sqe->fd = fd_;
+                sqe->addr = reinterpret_cast<uint64_t>(&msgs_[i].msg_hdr);
+                sqe->len = 1;
+                sqe->user_data = uringUserData(UringTag::UDP_TX, static_cast<uint32_t>(i));
+                ++inflight_[set_];
+            }
+            count_ = 0;
+            set_ ^= 1U;
+            return;
+        }
+        size_t sent = 0;
+        while (sent < count_) {
+            counters_.udpSendCalls.fetch_add(1);
+            int n = sendmmsg(fd_, msgs_.data() + sent, static_cast<unsigned int>(count_ - sent), 0);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // Igual que con sendto: el datagrama que falla se descarta y se sigue con el resto.
+                counters_.udpTxDropped.fetch_add(1);
+                ++sent;
+                continue;
+            }
+            counters_.udpPacketsOut.fetch_add(static_cast<uint64_t>(n));
+            uint64_t bytes = 0;
+            for (int i = 0; i < n; ++i) {
+                bytes += msgs_[sent + static_cast<size_t>(i)].msg_len;
+            }
+            counters_.udpBytesOut.fetch_add(bytes);
+            if (timestampRing_ != nullptr) {
+                for (int i = 0; i < n; ++i) {
+                    timestampRing_->record(metas_[sent + static_cast<size_t>(i)]);
+                }
+            }
+            sent += static_cast<size_t>(n);
+        }
+        count_ = 0;
+    }
+
+    void complete(uint32_t index, int result) {
+        --inflight_[index / capacity_];
+        if (result < 0) {
+            counters_.udpTxDropped.fetch_add(1);
+            return;
+        }
+        counters_.udpPacketsOut.fetch_add(1);
+        counters_.udpBytesOut.fetch_add(static_cast<uint64_t>(result));
+        if (timestampRing_ != nullptr) {
+            timestampRing_->record(metas_[index]);
+        }
+    }
+
+    // Espera las completions de los SENDMSG en vuelo; los CQEs de otro tipo quedan diferidos en el ring.
+    void waitInflight() {
+        waitInflight(0);
+        waitInflight(1);
+    }
+
+private:
+    size_t base() const { return set_ * capacity_; }
+
+    void waitInflight(size_t set) {
+        io_uring_cqe cqes[64];
+        while (inflight_[set] > 0) {
+            ring_->submitAndWait(1, -1);
+            const size_t n = ring_->reapNew(cqes, 64);
+            for (size_t i = 0; i < n; ++i) {
+                if (uringTagOf(cqes[i]) == UringTag::UDP_TX) {
+                    complete(uringValueOf(cqes[i]), cqes[i].res);
+                } else {
+                    ring_->defer(cqes[i]);
+                }
+            }
+        }
+    }
+
+    // Residencia = recepción de la request hasta justo antes de entregar el lote al kernel (sendmmsg o SQEs).
+    void recordResidence() {
+        const uint64_t now = nowNs();
+        for (size_t i = base(); i < base() + count_; ++i) {
+            const UdpTxMeta& meta = metas_[i];
+            if (meta.arrivalNs == 0) {
+                continue;
+            }
+            const uint64_t residenceNs = now > meta.arrivalNs ? now - meta.arrivalNs : 0;
+            if (meta.type == UdpMessageType::SYNC_RESP) {
+                workerCounters_.syncRespResidence.observeOwned(residenceNs);
+                ownedStoreMax(workerCounters_.syncRespResidenceMaxNs, residenceNs);
+            } else {
+                workerCounters_.downTickResidence.observeOwned(residenceNs);
+                ownedStoreMax(workerCounters_.downTickResidenceMaxNs, residenceNs);
+            }
+            if (meta.stampResidence) {
+                const auto residenceUs = static_cast<uint16_t>(std::min<uint64_t>(residenceNs / 1000ULL, UINT16_MAX));
+                size_t offset = DOWN_TICK_FLAGS_OFFSET + sizeof(uint16_t);
+                putLe<uint16_t>(static_cast<uint8_t*>(iovs_[i].iov_base), offset, residenceUs);
+            }
+        }
+    }
+
+    int fd_;
+    size_t capacity_;
+    std::vector<uint8_t> buffers_;
+    std::vector<sockaddr_in> addrs_;
+    std::vector<iovec> iovs_;
+    std::vector<mmsghdr> msgs_;
+    std::vector<UdpTxMeta> metas_;
+    size_t count_ = 0;
+    size_t set_ = 0; // juego de slots que se está armando; sin io_uring siempre 0
+    TrafficCounters& counters_;
+    UdpWorkerCounters& workerCounters_;
+    UdpTxTimestampRing* timestampRing_ = nullptr;
+    IoUring* ring_ = nullptr;
+    size_t inflight_[2] = {0, 0};
+};
+
+// Parser incremental del stream de upload: recibe los bytes tal como los entrega recv (frames partidos en
+// cualquier punto) y cuenta el payload DATA sin copiarlo. Si aparece un header inválido avanza byte a byte
+// hasta reencontrar TCP_MAGIC en lugar de perder el resto de la sesión.
+class TcpUploadSink {
+public:
+    explicit TcpUploadSink(uint32_t sessionId) : sessionId_(sessionId) {}
+
+    void consume(const uint8_t* data, size_t size) {
+        size_t pos = 0;
+        while (pos < size && !stopped_) {
+            if (bodyRemaining_ > 0) {
+                const size_t take = static_cast<size_t>(std::min<uint64_t>(bodyRemaining_, size - pos));
+                if (countingData_) {
+                    payloadBytes_ += take;
+                }
+                bodyRemaining_ -= take;
+                pos += take;
+                continue;
+            }
+
+            const size_t take = std::min(sizeof(header_) - headerFill_, size - pos);
+            std::memcpy(header_ + headerFill_, data + pos, take);
+            headerFill_ += take;
+            pos += take;
+            if (headerFill_ < sizeof(header_)) {
+                break;
+            }
+
+            TcpHeader header{};
+            if (!parseTcpHeader(header_, header)) {
+                std::memmove(header_, header_ + 1, sizeof(header_) - 1);
+                headerFill_ = sizeof(header_) - 1;
+                ++resyncBytes_;
+                continue;
+            }
+            headerFill_ = 0;
+            bodyRemaining_ = header.length;
+            const bool ownFrame = header.sessionId == sessionId_;
+            countingData_ = ownFrame && header.type == TcpMessageType::DATA;
+            if (ownFrame && header.type == TcpMessageType::STOP) {
+                stopped_ = true;
+            }
+        }
+    }
+
+    uint64_t payloadBytes() const { return payloadBytes_; }
+    uint64_t resyncBytes() const { return resyncBytes_; }
+    bool stopped() const { return stopped_; }
+
+private:
+    uint32_t sessionId_;
+    uint8_t header_[16] = {};
+    size_t headerFill_ = 0;
+    uint64_t bodyRemaining_ = 0;
+    bool countingData_ = false;
+    bool stopped_ = false;
+    uint64_t payloadBytes_ = 0;
+    uint64_t resyncBytes_ = 0;
+};
+
+std::string tcpPacingModeToString(TcpPacingMode mode) {
+    switch (mode) {
+        case TcpPacingMode::KERNEL: return "kernel";
+        case TcpPacingMode::USER: return "user";
+        case TcpPacingMode::NONE:
+        default:
+            return "none";
+    }
+}
+
+// Pacing en espacio de usuario (GCRA): cada byte enviado adelanta un tiempo teórico en 1/rate y se puede
+// enviar mientras ese tiempo esté detrás del reloj. El crédito acumulado se limita a una ráfaga (al menos dos
+// frames), así el atraso de los timers no se pierde pero un socket frenado tampoco junta crédito de más.
+class TcpPacer {
+public:
+    TcpPacer(uint64_t bytesPerSec, size_t frameBytes, uint64_t startNs)
+        : bytesPerSec_(bytesPerSec), frameNs_(bytesToNs(frameBytes)) {
+        burstNs_ = std::max(TCP_PACING_BURST_NS, 2 * frameNs_);
+        tatNs_ = startNs - frameNs_; // el primer frame sale sin esperar
+    }
+
+    size_t budget(uint64_t now) {
+        tatNs_ = std::max(tatNs_, now - burstNs_);
+        return now <= tatNs_ ? 0 : static_cast<size_t>((now - tatNs_) * bytesPerSec_ / 1000000000ULL);
+    }
+
+    void consume(uint64_t bytes) { tatNs_ += bytesToNs(bytes); }
+
+    // Cuándo vuelve a haber crédito para un frame completo.
+    uint64_t resumeNs() const { return tatNs_ + frameNs_; }
+
+private:
+    uint64_t bytesToNs(uint64_t bytes) const { return bytes * 1000000000ULL / bytesPerSec_; }
+
+    uint64_t bytesPerSec_;
+    uint64_t frameNs_;
+    uint64_t burstNs_ = 0;
+    uint64_t tatNs_ = 0;
+};
+
+std::string tcpSendModeToString(TcpSendMode mode) {
+    switch (mode) {
+        case TcpSendMode::COPY: return "copy";
+        case TcpSendMode::ZEROCOPY: return "zerocopy";
+        case TcpSendMode::WRITEV:
+        default:
+            return "writev";
+    }
+}
+
+// Frames DATA completos (header + payload) armados una sola vez y repetidos en un buffer de ~256 KB. Como
+// todos los frames son iguales, cualquier tramo contiguo del ring (con wrap-around) es un stream válido.
+class TcpDownloadRing {
+public:
+    TcpDownloadRing(uint32_t sessionId, uint32_t chunkBytes) : chunkBytes_(chunkBytes) {
+        std::vector<uint8_t> payload(chunkBytes);
+        const uint8_t seed = static_cast<uint8_t>(sessionId & 0xFF);
+        for (uint32_t i = 0; i < chunkBytes; ++i) {
+            payload[i] = static_cast<uint8_t>(seed + i);
+        }
+        const std::vector<uint8_t> frame = makeTcpFrame(TcpMessageType::DATA, sessionId, payload);
+        frameBytes_ = frame.size();
+        size_t frames = (TCP_DOWNLOAD_RING_BYTES + frameBytes_ - 1) / frameBytes_;
+        if (frames < 4) {
+            frames = 4;
+        }
+        data_.resize(frames * frameBytes_);
+        for (size_t i = 0; i < frames; ++i) {
+            std::memcpy(data_.data() + i * frameBytes_, frame.data(), frameBytes_);
+        }
+    }
+
+    const uint8_t* data() const { return data_.data(); }
+    size_t size() const { return data_.size(); }
+    size_t frameBytes() const { return frameBytes_; }
+    uint32_t chunkBytes() const { return chunkBytes_; }
+
+private:
+    uint32_t chunkBytes_;
+    size_t frameBytes_ = 0;
+    std::vector<uint8_t> data_;
+};
+
+// Envía el stream de download desde el ring. streamBytes es la posición absoluta en el stream; payloadBytes
+// acumula sólo el payload de los frames que quedaron completos, igual que el conteo legado.
+class TcpDownloadSender {
+public:
+    TcpDownloadSender(int fd, const TcpDownloadRing& ring, TcpSendMode mode) : fd_(fd), ring_(ring), mode_(mode) {
+        if (mode_ == TcpSendMode::ZEROCOPY) {
+            int yes = 1;
+            if (setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &yes, sizeof(yes)) < 0) {
+                mode_ = TcpSendMode::WRITEV;
+            }
+        }
+    }
+
+    TcpSendMode mode() const { return mode_; }
+    uint64_t payloadBytes() const { return (streamBytes_ / ring_.frameBytes()) * ring_.chunkBytes(); }
+    bool frameAligned() const { return streamBytes_ % ring_.frameBytes() == 0; }
+    uint64_t streamBytes() const { return streamBytes_; }
+
+    // Con MSG_ZEROCOPY el kernel sigue leyendo el ring después de sendmsg: el dueño no debe liberarlo mientras
+    // queden notificaciones pendientes (salvo que la conexión deje de avanzar).
+    bool zerocopyPending() const { return zerocopyCompleted_ < zerocopySends_; }
+
+    // Un envío no bloqueante de hasta un ring completo (o maxBytes, para el pacing), o sólo lo que falta para
+    // cerrar el frame en curso si finishFrame es true.
+    TcpIoStatus sendOnce(bool finishFrame, size_t maxBytes = SIZE_MAX) {
+        iovec iov[2];
+        const int iovCount = fillIov(finishFrame, maxBytes, iov);
+
+        ssize_t n = 0;
+        if (mode_ == TcpSendMode::ZEROCOPY) {
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = static_cast<size_t>(iovCount);
+            n = sendmsg(fd_, &msg, MSG_ZEROCOPY | MSG_NOSIGNAL);
+            if (n > 0) {
+                ++zerocopySends_;
+                reapZerocopyCompletions();
+            } else if (n < 0 && errno == ENOBUFS) {
+                // Demasiadas notificaciones pendientes: se liberan y se espera a que el socket avance.
+                reapZerocopyCompletions();
+                return TcpIoStatus::WOULD_BLOCK;
+            }
+        } else {
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = static_cast<size_t>(iovCount);
+            n = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                return TcpIoStatus::PROGRESS;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? TcpIoStatus::WOULD_BLOCK : TcpIoStatus::FAILED;
+        }
+        streamBytes_ += static_cast<uint64_t>(n);
+        return TcpIoStatus::PROGRESS;
+    }
+
+    // Backend io_uring: el mismo envío como SENDMSG asíncrono. El msghdr y sus iovec quedan en el sender hasta
+    // que llegue el CQE (completeUring).
+    bool queueUring(IoUring& uring, uint64_t userData, bool finishFrame, size_t maxBytes = SIZE_MAX) {
+        io_uring_sqe* sqe = uring.nextSqe();
+        if (sqe == nullptr) {
+            return false;
+        }
+        uringMsg_ = msghdr{};
+        uringMsg_.msg_iov = uringIov_;
+        uringMsg_.msg_iovlen = static_cast<size_t>(fillIov(finishFrame, maxBytes, uringIov_));
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd_;
+        sqe->addr = reinterpret_cast<uint64_t>(&uringMsg_);
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = userData;
+        return true;
+    }
+
+    TcpIoStatus completeUring(int result) {
+        if (result >= 0) {
+            streamBytes_ += static_cast<uint64_t>(result);
+            return TcpIoStatus::PROGRESS;
+        }
+        return result == -EINTR || result == -EAGAIN ? TcpIoStatus::PROGRESS : TcpIoStatus::FAILED;
+    }
+
+    void reapZerocopyCompletions() {
+        while (true) {
+            uint8_t control[128];
+            msghdr msg{};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                return;
+            }
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if ((cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR)) {
+                    continue;
+                }
+                const auto* err = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cmsg));
+                if (err->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                    // ee_info..ee_data es el rango (inclusivo) de envíos completados.
+                    zerocopyCompleted_ += static_cast<uint64_t>(err->ee_data - err->ee_info) + 1;
+                }
+            }
+        }
+    }
+
+private:
+    int fillIov(bool finishFrame, size_t maxBytes, iovec* iov) const {
+        const size_t offset = static_cast<size_t>(streamBytes_ % ring_.size());
+        size_t budget = std::min(ring_.size(), maxBytes);
+        if (finishFrame) {
+            budget = ring_.frameBytes() - static_cast<size_t>(streamBytes_ % ring_.frameBytes());
+        }
+        iov[0].iov_base = const_cast<uint8_t*>(ring_.data() + offset);
+        iov[0].iov_len = std::min(budget, ring_.size() - offset);
+        if (iov[0].iov_len == budget) {
+            return 1;
+        }
+        iov[1].iov_base = const_cast<uint8_t*>(ring_.data());
+        iov[1].iov_len = budget - iov[0].iov_len;
+        return 2;
+    }
+
+    int fd_;
+    const TcpDownloadRing& ring_;
+    TcpSendMode mode_;
+    uint64_t streamBytes_ = 0;
+    uint64_t zerocopySends_ = 0;
+    uint64_t zerocopyCompleted_ = 0;
+    msghdr uringMsg_{};
+    iovec uringIov_[2] = {};
+};
+
+struct CpuUsage {
+    uint64_t cpuNs = 0;
+    uint64_t cycles = 0;
+    bool hasCycles = false;
+};
+
+// Lecturas de CPU del thread actual: tiempo de CPU siempre; ciclos sólo si perf_event_open está permitido
+// (en VMs/containers suele no estarlo). Los workers TCP atribuyen a cada sesión la diferencia entre las
+// lecturas tomadas alrededor de cada evento que procesan para ella.
+class ThreadCpuMeter {
+public:
+    ThreadCpuMeter() {
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_hv = 1;
+        perfFd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+    }
+
+    ThreadCpuMeter(const ThreadCpuMeter&) = delete;
+    ThreadCpuMeter& operator=(const ThreadCpuMeter&) = delete;
+
+    ~ThreadCpuMeter() {
+        if (perfFd_ >= 0) {
+            close(perfFd_);
+        }
+    }
+
+    CpuUsage sample() const {
+        CpuUsage usage;
+        usage.cpuNs = threadCpuNs();
+        usage.hasCycles = perfFd_ >= 0 && read(perfFd_, &usage.cycles, sizeof(usage.cycles)) == static_cast<ssize_t>(sizeof(usage.cycles));
+        return usage;
+    }
+
+    void accumulate(CpuUsage& total, const CpuUsage& since) const {
+        const CpuUsage now = sample();
+        total.cpuNs += now.cpuNs - since.cpuNs;
+        total.hasCycles = now.hasCycles && since.hasCycles;
+        if (total.hasCycles) {
+            total.cycles += now.cycles - since.cycles;
+        }
+    }
+
+private:
+    static uint64_t threadCpuNs() {
+        timespec ts{};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    int perfFd_ = -1;
+};
+
+void logCpuEfficiency(LogRecord& record, const CpuUsage& usage, uint64_t bytes) {
+    const uint64_t cpuNs = usage.cpuNs;
+    record.u64("cpuNs", cpuNs).f64("bytesPerCpuNs", cpuNs > 0 ? static_cast<double>(bytes) / cpuNs : 0.0);
+    if (usage.hasCycles && usage.cycles > 0) {
+        record.u64("cpuCycles", usage.cycles).f64("bytesPerCpuCycle", static_cast<double>(bytes) / usage.cycles);
+    } else {
+        record.null("cpuCycles").null("bytesPerCpuCycle");
+    }
+}
+
+void printHelp(const char* prog) {
+    std::cout
+        << "Usage: " << prog << " [options]\n"
+        << "  -p, --port <port>           Puerto UDP/TCP (default 9000)\n"
+        << "  -t, --tick <ms>             Override global tick UDP (>0)\n"
+        << "      --max-sessions <n>      Sesiones simultáneas máximas (default 50)\n"
+        << "      --udp-workers <n>       Workers UDP con socket SO_REUSEPORT propio (1-64, default 1)\n"
+        << "      --udp-batch <n>         Datagramas por recvmmsg/sendmmsg (1-64, default 32)\n"
+        << "      --udp-wait <mode>       epoll|sleep: espera por eventos o poll legado de 2 ms (default epoll)\n"
+        << "      --tcp-workers <n>       Workers TCP con event loop epoll (1-64, default uno por core)\n"
+        << "      --tcp-max-streams <n>   Conexiones paralelas por test TCP multi-stream (1-16, default 8)\n"
+        << "      --tcp-send-mode <mode>  copy|writev|zerocopy: envío del download TCP (default writev)\n"
+        << "      --tcp-pacing <mode>     kernel|user: cómo se sostiene la tasa pedida por un download con pacing (default kernel)\n"
+        << "      --tcp-cc-allow <lista>  Algoritmos de congestión que puede pedir un cliente (default cubic,reno,bbr)\n"
+        << "      --tcp-max-buffer <n>    Tope en bytes para SO_SNDBUF/SO_RCVBUF pedidos por el cliente (default 33554432)\n"
+        << "      --io-backend <mode>     epoll|uring: I/O de workers UDP/TCP (default epoll; uring cae a epoll si el kernel no lo soporta)\n"
+        << "      --kernel-timestamps     Timestamps RX/TX del kernel (SO_TIMESTAMPING) en SYNC_RESP y DOWN_TICK\n"
+        << "      --log-dir <path>        Directorio de logs (default .)\n"
+        << "      --log-level <level>     summary|events|verbose (default summary)\n"
+        << "      --log-format <fmt>      json|binary: JSONL o registros binarios comprimidos al rotar (default json)\n"
+        << "      --metrics-port <port>   Sirve /metrics (formato Prometheus) por HTTP en ese puerto (default apagado)\n"
+        << "      --metrics-bind <ip>     Dirección del listener de métricas (default 127.0.0.1)\n"
+        << "  -h, --help                  Mostrar ayuda\n";
+}
+
+LogLevel parseLogLevel(const std::string& value) {
+    if (value == "summary") return LogLevel::SUMMARY;
+    if (value == "events") return LogLevel::EVENTS;
+    if (value == "verbose") return LogLevel::VERBOSE;
+    return LogLevel::SUMMARY;
+}
+
+bool parseOptions(int argc, char* argv[], ServerOptions& options) {
+    for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
         if (arg == "-h" || arg == "--help") {
             printHelp(argv[0]);
             return false;
         }
-        if ((arg == "-p" || arg == "--port") && i + 1 < argc) {
-            options.port = std::atoi(argv[++i]);
-            continue;
+        if ((arg == "-p" || arg == "--port") && i + 1 < argc) {
+            options.port = std::atoi(argv[++i]);
+            continue;
+        }
+        if ((arg == "-t" || arg == "--tick") && i + 1 < argc) {
+            options.tickOverrideMs = std::atoi(argv[++i]);
+            continue;
+        }
+        if (arg == "--max-sessions" && i + 1 < argc) {
+            options.maxSessions = std::atoi(argv[++i]);
+            continue;
+        }
+        if (arg == "--udp-workers" && i + 1 < argc) {
+            options.udpWorkers = std::atoi(argv[++i]);
+            continue;
+        }
+        if (arg == "--udp-batch" && i + 1 < argc) {
+            options.udpBatch = std::atoi(argv[++i]);
+            continue;
+        }
+        if (arg == "--udp-wait" && i + 1 < argc) {
+            const std::string mode = argv[++i];
+            if (mode == "epoll") {
+                options.udpWait = UdpWaitMode::EPOLL;
+            } else if (mode == "sleep") {
+                options.udpWait = UdpWaitMode::SLEEP;
+            } else {
+                std::cerr << "--udp-wait debe ser epoll o sleep" << std::endl;
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--tcp-workers" && i + 1 < argc) {
+            options.tcpWorkers = std::atoi(argv[++i]);
+            if (options.tcpWorkers <= 0) {
+                std::cerr << "--tcp-workers debe estar entre 1 y " << TCP_MAX_WORKERS << std::endl;
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--tcp-max-streams" && i + 1 < argc) {
+            options.tcpMaxStreams = std::atoi(argv[++i]);
+            continue;
+        }
+        if (arg == "--tcp-pacing" && i + 1 < argc) {
+            const std::string mode = argv[++i];
+            if (mode == "kernel") {
+                options.tcpPacing = TcpPacingMode::KERNEL;
+            } else if (mode == "user") {
+                options.tcpPacing = TcpPacingMode::USER;
+            } else {
+                std::cerr << "--tcp-pacing debe ser kernel o user" << std::endl;
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--tcp-cc-allow" && i + 1 < argc) {
+            options.tcpCcAllow.clear();
+            std::stringstream list(argv[++i]);
+            std::string name;
+            while (std::getline(list, name, ',')) {
+                if (name.empty()) {
+                    continue;
+                }
+                if (name.size() > TCP_CC_NAME_MAX) {
+                    std::cerr << "--tcp-cc-allow: nombre de algoritmo demasiado largo: " << name << std::endl;
+                    return false;
+                }
+                options.tcpCcAllow.push_back(name);
+            }
+            continue;
+        }
+        if (arg == "--tcp-max-buffer" && i + 1 < argc) {
+            options.tcpMaxBufferBytes = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+            continue;
+        }
+        if (arg == "--tcp-send-mode" && i + 1 < argc) {
+            const std::string mode = argv[++i];
+            if (mode == "copy") {
+                options.tcpSendMode = TcpSendMode::COPY;
+            } else if (mode == "writev") {
+                options.tcpSendMode = TcpSendMode::WRITEV;
+            } else if (mode == "zerocopy") {
+                options.tcpSendMode = TcpSendMode::ZEROCOPY;
+            } else {
+                std::cerr << "--tcp-send-mode debe ser copy, writev o zerocopy" << std::endl;
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--io-backend" && i + 1 < argc) {
+            const std::string mode = argv[++i];
+            if (mode == "epoll") {
+                options.ioBackend = IoBackend::EPOLL;
+            } else if (mode == "uring") {
+                options.ioBackend = IoBackend::URING;
+            } else {
+                std::cerr << "--io-backend debe ser epoll o uring" << std::endl;
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--kernel-timestamps") {
+            options.kernelTimestamps = true;
+            continue;
+        }
+        if (arg == "--log-dir" && i + 1 < argc) {
+            options.logDir = argv[++i];
+            continue;
+        }
+        if (arg == "--log-level" && i + 1 < argc) {
+            options.logLevel = parseLogLevel(argv[++i]);
+            continue;
+        }
+        if (arg == "--metrics-port" && i + 1 < argc) {
+            options.metricsPort = std::atoi(argv[++i]);
+            if (options.metricsPort < 1 || options.metricsPort > 65535) {
+                std::cerr << "--metrics-port debe estar entre 1 y 65535" << std::endl;
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--metrics-bind" && i + 1 < argc) {
+            options.metricsBind = argv[++i];
+            in_addr probe{};
+            if (inet_pton(AF_INET, options.metricsBind.c_str(), &probe) != 1) {
+                std::cerr << "--metrics-bind debe ser una dirección IPv4" << std::endl;
+                return false;
+            }
+            continue;
+        }
+        if (arg == "--log-format" && i + 1 < argc) {
+            const std::string format = argv[++i];
+            if (format == "json") {
+                options.logFormat = LogFormat::JSON;
+            } else if (format == "binary") {
+                options.logFormat = LogFormat::BINARY;
+            } else {
+                std::cerr << "--log-format debe ser json o binary" << std::endl;
+                return false;
+            }
+            continue;
+        }
+
+        std::cerr << "Opción inválida: " << arg << std::endl;
+        printHelp(argv[0]);
+        return false;
+    }
+
+    if (options.port <= 0 || options.port > 65535) {
+        std::cerr << "Puerto inválido" << std::endl;
+        return false;
+    }
+    if (options.maxSessions <= 0) {
+        std::cerr << "--max-sessions debe ser > 0" << std::endl;
+        return false;
+    }
+    if (options.udpWorkers <= 0 || options.udpWorkers > UDP_MAX_WORKERS) {
+        std::cerr << "--udp-workers debe estar entre 1 y " << UDP_MAX_WORKERS << std::endl;
+        return false;
+    }
+    if (options.udpBatch <= 0 || options.udpBatch > UDP_MAX_BATCH) {
+        std::cerr << "--udp-batch debe estar entre 1 y " << UDP_MAX_BATCH << std::endl;
+        return false;
+    }
+    if (options.tcpWorkers == 0) {
+        options.tcpWorkers = std::max(1, std::min(static_cast<int>(std::thread::hardware_concurrency()), TCP_MAX_WORKERS));
+    }
+    if (options.tcpMaxStreams <= 0 || options.tcpMaxStreams > TCP_MAX_STREAMS) {
+        std::cerr << "--tcp-max-streams debe estar entre 1 y " << TCP_MAX_STREAMS << std::endl;
+        return false;
+    }
+    if (options.tcpMaxBufferBytes < TCP_MIN_SOCKET_BUFFER_BYTES) {
+        std::cerr << "--tcp-max-buffer debe ser al menos " << TCP_MIN_SOCKET_BUFFER_BYTES << std::endl;
+        return false;
+    }
+    if (options.tcpWorkers > TCP_MAX_WORKERS) {
+        std::cerr << "--tcp-workers debe estar entre 1 y " << TCP_MAX_WORKERS << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int createUdpSocket(int port, bool reusePort, bool& kernelTimestamps) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("socket UDP");
+        return -1;
+    }
+
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0) {
+        perror("SO_REUSEPORT UDP");
+        close(fd);
+        return -1;
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        perror("bind UDP");
+        close(fd);
+        return -1;
+    }
+
+    // Timestamp de llegada del kernel para medir cuánto espera cada datagrama en la cola del socket.
+    // Con --kernel-timestamps se usa SO_TIMESTAMPING para tener también el timestamp de salida (TX).
+    if (kernelTimestamps) {
+        int tsFlags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                      SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+        if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &tsFlags, sizeof(tsFlags)) < 0) {
+            perror("SO_TIMESTAMPING UDP (se usan timestamps de usuario)");
+            kernelTimestamps = false;
+        }
+    }
+    if (!kernelTimestamps) {
+        setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &yes, sizeof(yes));
+    }
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    return fd;
+}
+
+int createTcpSocket(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket TCP");
+        return -1;
+    }
+
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        perror("bind TCP");
+        close(fd);
+        return -1;
+    }
+
+    if (listen(fd, 128) < 0) {
+        perror("listen TCP");
+        close(fd);
+        return -1;
+    }
+
+    // Lo comparten todos los workers TCP (EPOLLEXCLUSIVE): accept nunca debe bloquear a uno que perdió la carrera.
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    return fd;
+}
+
+int createMetricsSocket(const std::string& bindIp, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket métricas");
+        return -1;
+    }
+
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    inet_pton(AF_INET, bindIp.c_str(), &addr.sin_addr);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        perror("bind métricas");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, 16) < 0) {
+        perror("listen métricas");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Foto de los contadores en formato de exposición de Prometheus. Sólo lee atómicos: un scrape no toma locks
+// ni frena a los workers.
+std::string renderMetrics(const TrafficCounters& counters,
+                          const std::atomic<int>& activeSessions,
+                          const JsonLogger& logger,
+                          const ServerOptions& options) {
+    static const char* const rejectReasons[REJECT_REASONS] = {"busy", "bad_request", "group_closed"};
+    std::string out;
+    out.reserve(8192);
+    const auto family = [&](const char* name, const char* type, const char* help) {
+        out += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+    };
+    const auto sample = [&](const char* name, const std::string& labels, uint64_t value) {
+        out += name;
+        out += labels.empty() ? "" : "{" + labels + "}";
+        out += " " + std::to_string(value) + "\n";
+    };
+
+    family("speedtest_udp_packets_total", "counter", "Datagramas UDP recibidos y enviados.");
+    sample("speedtest_udp_packets_total", "direction=\"in\"", counters.udpPacketsIn.load());
+    sample("speedtest_udp_packets_total", "direction=\"out\"", counters.udpPacketsOut.load());
+    family("speedtest_udp_bytes_total", "counter", "Bytes de payload UDP recibidos y enviados.");
+    sample("speedtest_udp_bytes_total", "direction=\"in\"", counters.udpBytesIn.load());
+    sample("speedtest_udp_bytes_total", "direction=\"out\"", counters.udpBytesOut.load());
+    family("speedtest_tcp_bytes_total", "counter", "Bytes de payload de los tests TCP recibidos y enviados.");
+    sample("speedtest_tcp_bytes_total", "direction=\"in\"", counters.tcpBytesIn.load());
+    sample("speedtest_tcp_bytes_total", "direction=\"out\"", counters.tcpBytesOut.load());
+
+    const int udpActive = std::max(0, counters.udpActiveSessions.load());
+    const int tcpActive = std::max(0, activeSessions.load() - udpActive);
+    family("speedtest_active_sessions", "gauge", "Sesiones en curso (un grupo TCP multi-stream cuenta una).");
+    sample("speedtest_active_sessions", "transport=\"udp\"", static_cast<uint64_t>(udpActive));
+    sample("speedtest_active_sessions", "transport=\"tcp\"", static_cast<uint64_t>(tcpActive));
+    family("speedtest_max_sessions", "gauge", "Límite de sesiones simultáneas (--max-sessions).");
+    sample("speedtest_max_sessions", "", static_cast<uint64_t>(options.maxSessions));
+
+    family("speedtest_session_rejections_total", "counter", "Sesiones rechazadas por motivo.");
+    for (size_t i = 0; i < REJECT_REASONS; ++i) {
+        const std::string reason = std::string(",reason=\"") + rejectReasons[i] + "\"";
+        sample("speedtest_session_rejections_total", "transport=\"udp\"" + reason, counters.udpRejections[i].load());
+        sample("speedtest_session_rejections_total", "transport=\"tcp\"" + reason, counters.tcpRejections[i].load());
+    }
+
+    family("speedtest_session_duration_seconds", "histogram", "Duración de las sesiones terminadas.");
+    counters.udpSessionDuration.render(out, "speedtest_session_duration_seconds", "transport=\"udp\"");
+    counters.tcpSessionDuration.render(out, "speedtest_session_duration_seconds", "transport=\"tcp\"");
+    family("speedtest_loop_iteration_seconds", "histogram", "Trabajo de cada vuelta de los event loops, sin la espera.");
+    counters.udpLoopIteration.render(out, "speedtest_loop_iteration_seconds", "loop=\"udp\"");
+    counters.tcpLoopIteration.render(out, "speedtest_loop_iteration_seconds", "loop=\"tcp\"");
+
+    family("speedtest_udp_residence_seconds", "histogram",
+           "Tiempo en el server desde la recepción de la request hasta el envío de la respuesta.");
+    MetricHistogram syncRespResidence{METRICS_RESIDENCE_BOUNDS_NS, 1e9};
+    MetricHistogram downTickResidence{METRICS_RESIDENCE_BOUNDS_NS, 1e9};
+    mergeUdpWorkerHistogram(counters, &UdpWorkerCounters::syncRespResidence, syncRespResidence);
+    mergeUdpWorkerHistogram(counters, &UdpWorkerCounters::downTickResidence, downTickResidence);
+    syncRespResidence.render(out, "speedtest_udp_residence_seconds", "type=\"sync_resp\"");
+    downTickResidence.render(out, "speedtest_udp_residence_seconds", "type=\"down_tick\"");
+    family("speedtest_udp_downlink_schedule_deviation_seconds", "histogram",
+           "Atraso de cada DOWN_TICK del stream respecto de su instante agendado.");
+    MetricHistogram downlinkScheduleDeviation{METRICS_SCHEDULE_DEVIATION_BOUNDS_NS, 1e9};
+    mergeUdpWorkerHistogram(counters, &UdpWorkerCounters::downlinkScheduleDeviation, downlinkScheduleDeviation);
+    downlinkScheduleDeviation.render(out, "speedtest_udp_downlink_schedule_deviation_seconds", "type=\"down_tick\"");
+
+    family("speedtest_log_queue_depth", "gauge", "Slots ocupados del ring del logger.");
+    sample("speedtest_log_queue_depth", "", logger.queueDepth());
+    family("speedtest_log_queue_capacity", "gauge", "Slots totales del ring del logger.");
+    sample("speedtest_log_queue_capacity", "", LOG_RING_SLOTS);
+    family("speedtest_log_dropped_total", "counter", "Registros de log descartados con el ring lleno.");
+    sample("speedtest_log_dropped_total", "", logger.dropped());
+    return out;
+}
+
+// Listener HTTP mínimo para /metrics, en su propio thread: una conexión por vez, con timeouts para que un
+// cliente lento no lo deje colgado. Cualquier otro path responde 404.
+template <typename RenderFn>
+void serveMetrics(int listenFd, const std::atomic<bool>& running, RenderFn render) {
+    while (running.load()) {
+        pollfd pfd{};
+        pfd.fd = listenFd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 200) <= 0) {
+            continue;
+        }
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        timeval timeout{};
+        timeout.tv_sec = 1;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < METRICS_MAX_REQUEST_BYTES) {
+            const ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                break;
+            }
+            request.append(buffer, static_cast<size_t>(n));
+        }
+
+        const bool isMetrics = request.rfind("GET /metrics ", 0) == 0 || request.rfind("GET /metrics?", 0) == 0;
+        const std::string body = isMetrics ? render() : "not found\n";
+        std::string response = isMetrics ? "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                                         : "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n";
+        response += "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        size_t sent = 0;
+        while (sent < response.size()) {
+            const ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                break;
+            }
+            sent += static_cast<size_t>(n);
+        }
+        close(fd);
+    }
+}
+
+// Rueda de timers de un nivel para el timeout de inactividad. Cada sesión vive en el bucket de su deadline
+// (lastActivityNs + timeout); los UP_TICK sólo actualizan lastActivityNs. Al vencer un bucket se revisan sus
+// sesiones: las que siguen inactivas expiran y las que tuvieron actividad se reprograman. Todo es O(1) por
+// sesión y los enlaces son índices de slot dentro de la propia sesión.
+class IdleTimerWheel {
+public:
+    IdleTimerWheel(UdpSessionTable& table, uint64_t timeoutNs, uint64_t nowNs)
+        : table_(table), timeoutNs_(timeoutNs), heads_(IDLE_WHEEL_SLOTS, NONE), currentTick_(nowNs / IDLE_WHEEL_TICK_NS) {}
+
+    void schedule(UdpSession& session) {
+        unlink(session);
+        uint64_t tick = (session.lastActivityNs + timeoutNs_) / IDLE_WHEEL_TICK_NS;
+        if (tick < currentTick_) {
+            tick = currentTick_;
+        }
+        const uint32_t bucket = static_cast<uint32_t>(tick % IDLE_WHEEL_SLOTS);
+        const uint32_t slot = table_.slotOf(session);
+        session.wheelBucket = bucket;
+        session.wheelPrev = NONE;
+        session.wheelNext = heads_[bucket];
+        if (heads_[bucket] != NONE) {
+            table_.at(heads_[bucket]).wheelPrev = slot;
+        }
+        heads_[bucket] = slot;
+    }
+
+    void unlink(UdpSession& session) {
+        if (session.wheelBucket == NONE) {
+            return;
+        }
+        if (session.wheelPrev != NONE) {
+            table_.at(session.wheelPrev).wheelNext = session.wheelNext;
+        } else {
+            heads_[session.wheelBucket] = session.wheelNext;
+        }
+        if (session.wheelNext != NONE) {
+            table_.at(session.wheelNext).wheelPrev = session.wheelPrev;
+        }
+        session.wheelBucket = NONE;
+        session.wheelPrev = NONE;
+        session.wheelNext = NONE;
+    }
+
+    // Procesa los buckets ya vencidos revisando como mucho `budget` sesiones. `expire` debe sacar la sesión
+    // de la tabla (y de la rueda). Devuelve true si quedó trabajo pendiente para la próxima pasada.
+    template <typename Fn>
+    bool advance(uint64_t nowNs, size_t budget, Fn&& expire) {
+        const uint64_t nowTick = nowNs / IDLE_WHEEL_TICK_NS;
+        while (currentTick_ < nowTick) {
+            const uint32_t bucket = static_cast<uint32_t>(currentTick_ % IDLE_WHEEL_SLOTS);
+            while (heads_[bucket] != NONE) {
+                if (budget == 0) {
+                    return true;
+                }
+                --budget;
+                UdpSession& session = table_.at(heads_[bucket]);
+                if (session.lastActivityNs + timeoutNs_ <= nowNs) {
+                    expire(session);
+                } else {
+                    schedule(session);
+                }
+            }
+            ++currentTick_;
+        }
+        return false;
+    }
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    UdpSessionTable& table_;
+    uint64_t timeoutNs_;
+    std::vector<uint32_t> heads_;
+    uint64_t currentTick_;
+};
+
+bool tryReserveSession(std::atomic<int>& activeSessions, int maxSessions) {
+    int current = activeSessions.load();
+    while (current < maxSessions) {
+        if (activeSessions.compare_exchange_weak(current, current + 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Próximo DOWN_TICK de una sesión en modo stream, en el min-heap del worker. Las entradas no se borran al
+// terminar la sesión: `startedNs` distingue las de sesiones ya cerradas o reiniciadas con la misma clave.
+struct DownlinkDeadline {
+    uint64_t deadlineNs;
+    UdpSessionKey key;
+    uint64_t startedNs;
+
+    bool operator>(const DownlinkDeadline& other) const { return deadlineNs > other.deadlineNs; }
+};
+
+// Slots del slab de sesiones de cada worker. El límite es global y el kernel reparte por hash de la 4-tupla,
+// así que a cada worker le toca ~maxSessions/N: se reserva el doble más un margen en vez de --max-sessions
+// completo en cada uno (64 workers x 10000 sesiones serían varios GB tocados al arrancar). Un worker con el
+// slab lleno rechaza la sesión aunque quede lugar global.
+size_t udpWorkerSessionCapacity(const ServerOptions& options) {
+    const auto maxSessions = static_cast<size_t>(options.maxSessions);
+    const auto workers = static_cast<size_t>(options.udpWorkers);
+    if (workers <= 1) {
+        return maxSessions;
+    }
+    const size_t share = (maxSessions + workers - 1) / workers;
+    return std::min(maxSessions, 2 * share + UDP_WORKER_SESSION_HEADROOM);
+}
+
+// Loop UDP v2 de un worker: socket SO_REUSEPORT propio y tabla de sesiones propia, sin locks compartidos.
+class UdpWorker {
+public:
+    UdpWorker(int index,
+              int fd,
+              const ServerOptions& options,
+              TrafficCounters& counters,
+              JsonLogger& logger,
+              std::atomic<int>& activeSessions,
+              std::atomic<bool>& running)
+        : index_(index), fd_(fd), options_(options), counters_(counters),
+          workerCounters_(*counters.udpWorkers[static_cast<size_t>(index)]), logger_(logger),
+          activeSessions_(activeSessions), running_(running),
+          rxBatch_(static_cast<size_t>(options.udpBatch)),
+          txBatch_(fd, static_cast<size_t>(options.udpBatch), counters, workerCounters_),
+          sessions_(udpWorkerSessionCapacity(options)),
+          idleWheel_(sessions_, static_cast<uint64_t>(SESSION_IDLE_TIMEOUT_MS) * 1000000ULL, nowNs()) {
+        if (options.kernelTimestamps) {
+            txBatch_.setTimestampRing(&txTimestamps_);
+        }
+        downlinkHeap_.reserve(static_cast<size_t>(options.maxSessions) * 2);
+    }
+
+    void run() {
+        // Los timeouts de io_uring y el sleep usan el slack del thread (50 µs por defecto): los DOWN_TICK del
+        // stream salen en el instante agendado.
+        prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+        if (options_.ioBackend == IoBackend::URING) {
+            if (runUring() || !running_.load()) {
+                return;
+            }
+            std::cerr << "io_uring no disponible en el worker UDP " << index_ << ", se usa epoll" << std::endl;
+        }
+
+        int epollFd = epoll_create1(EPOLL_CLOEXEC);
+        int cleanupTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        int downlinkTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (epollFd < 0 || cleanupTimerFd < 0 || downlinkTimerFd < 0) {
+            perror("epoll/timerfd UDP");
+            running_.store(false);
+            return;
+        }
+        itimerspec cleanupPeriod{};
+        cleanupPeriod.it_value.tv_sec = 1;
+        cleanupPeriod.it_interval.tv_sec = 1;
+        timerfd_settime(cleanupTimerFd, 0, &cleanupPeriod, nullptr);
+
+        epoll_event udpEvent{};
+        udpEvent.events = EPOLLIN;
+        udpEvent.data.fd = fd_;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd_, &udpEvent);
+        epoll_event timerEvent{};
+        timerEvent.events = EPOLLIN;
+        timerEvent.data.fd = cleanupTimerFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, cleanupTimerFd, &timerEvent);
+        epoll_event downlinkEvent{};
+        downlinkEvent.events = EPOLLIN;
+        downlinkEvent.data.fd = downlinkTimerFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, downlinkTimerFd, &downlinkEvent);
+
+        bool expiryPending = false;
+        uint64_t armedDeadlineNs = 0;
+
+        while (running_.load()) {
+            const uint64_t iterationStartNs = nowNs();
+            bool anyPacket = false;
+            while (true) {
+                counters_.udpRecvCalls.fetch_add(1);
+                int received = rxBatch_.receive(fd_);
+                if (received < 0) {
+                    perror("recvmmsg UDP");
+                    break;
+                }
+                if (received == 0) {
+                    break;
+                }
+                anyPacket = true;
+                counters_.udpPacketsIn.fetch_add(static_cast<uint64_t>(received));
+                counters_.udpRxBatchHist[batchHistBucket(static_cast<size_t>(received))].fetch_add(1);
+
+                const uint64_t dequeuedRealtimeNs = realtimeNs();
+                const uint64_t dequeuedNs = nowNs();
+                uint64_t bytes = 0;
+                for (int i = 0; i < received; ++i) {
+                    bytes += rxBatch_.size(i);
+                    onDatagram(rxBatch_.data(i), rxBatch_.size(i), rxBatch_.from(i),
+                               rxBatch_.kernelRxRealtimeNs(i), dequeuedRealtimeNs, dequeuedNs);
+                }
+                counters_.udpBytesIn.fetch_add(bytes);
+                publishRxDelay();
+                // Bajo carga el drenaje puede durar varios lotes: los DOWN_TICK que vencen en el medio salen
+                // junto con las respuestas de cada lote en vez de esperar a que se vacíe el socket.
+                sendDueDownTicks();
+                txBatch_.flush();
+                expiryPending = expireIdleSessions();
+            }
+
+            sendDueDownTicks();
+            txBatch_.flush();
+
+            if (options_.kernelTimestamps) {
+                drainTxTimestamps();
+            }
+
+            expiryPending = expireIdleSessions();
+            counters_.udpLoopIteration.observe((nowNs() - iterationStartNs) / 1000ULL);
+
+            if (options_.udpWait == UdpWaitMode::SLEEP) {
+                if (!anyPacket) {
+                    std::this_thread::sleep_for(std::chrono::nanoseconds(untilNextDownTickNs(2000000ULL)));
+                }
+                continue;
+            }
+
+            // timerfd absoluto al DOWN_TICK más próximo: a diferencia del timeout de epoll_wait no redondea a ms.
+            if (!downlinkHeap_.empty() && downlinkHeap_.front().deadlineNs != armedDeadlineNs) {
+                armedDeadlineNs = downlinkHeap_.front().deadlineNs;
+                itimerspec deadline{};
+                deadline.it_value.tv_sec = static_cast<time_t>(armedDeadlineNs / 1000000000ULL);
+                deadline.it_value.tv_nsec = static_cast<long>(armedDeadlineNs % 1000000000ULL);
+                timerfd_settime(downlinkTimerFd, TFD_TIMER_ABSTIME, &deadline, nullptr);
+            }
+
+            // El socket ya quedó drenado: se bloquea hasta que llegue un datagrama o venza un timer (si la pasada
+            // anterior dejó expiraciones pendientes, sólo se consulta sin bloquear).
+            epoll_event events[3];
+            int ready = epoll_wait(epollFd, events, 3, expiryPending ? 0 : -1);
+            counters_.udpWakeups.fetch_add(1);
+            for (int i = 0; i < ready; ++i) {
+                if (events[i].data.fd == cleanupTimerFd || events[i].data.fd == downlinkTimerFd) {
+                    uint64_t expirations = 0;
+                    ssize_t ignored = read(events[i].data.fd, &expirations, sizeof(expirations));
+                    (void)ignored;
+                }
+            }
+        }
+
+        close(downlinkTimerFd);
+        close(cleanupTimerFd);
+        close(epollFd);
+    }
+
+private:
+    void onDatagram(const uint8_t* data,
+                    size_t size,
+                    const sockaddr_in& from,
+                    uint64_t kernelRxNs,
+                    uint64_t dequeuedRealtimeNs,
+                    uint64_t dequeuedNs) {
+        uint64_t queuedNs = 0;
+        if (kernelRxNs != 0 && dequeuedRealtimeNs > kernelRxNs) {
+            queuedNs = dequeuedRealtimeNs - kernelRxNs;
+            ++rxDelaySamples_;
+            rxDelaySumNs_ += queuedNs;
+            rxDelayMaxNs_ = std::max(rxDelayMaxNs_, queuedNs);
+        }
+        // recvNs en el reloj monotónico del protocolo: el del kernel si está habilitado, si no el actual.
+        const uint64_t rxNs = options_.kernelTimestamps && kernelRxNs != 0 ? dequeuedNs - queuedNs : 0;
+        handleDatagram(data, size, from, rxNs, rxNs != 0 ? rxNs : dequeuedNs);
+    }
+
+    // La demora de cola se acumula por lote y se publica una vez, como udpPacketsIn: los contadores son de
+    // todos los workers y un read-modify-write por datagrama se pelea la línea de cache con los demás.
+    void publishRxDelay() {
+        if (rxDelaySamples_ == 0) {
+            return;
+        }
+        counters_.udpRxDelaySamples.fetch_add(rxDelaySamples_);
+        counters_.udpRxDelaySumNs.fetch_add(rxDelaySumNs_);
+        atomicStoreMax(counters_.udpRxDelayMaxNs, rxDelayMaxNs_);
+        rxDelaySamples_ = 0;
+        rxDelaySumNs_ = 0;
+        rxDelayMaxNs_ = 0;
+    }
+
+    // Backend io_uring: un recvmsg multishot sobre el ring de buffers provistos entrega los datagramas y las
+    // respuestas salen como SENDMSG en el mismo ring, así que cada vuelta hace un solo io_uring_enter que envía
+    // lo pendiente y espera el próximo evento. Devuelve false si el kernel no acepta algo y hay que usar epoll.
+    bool runUring() {
+        IoUring ring;
+        if (!ring.init(URING_ENTRIES) || !ring.setupBufferRing(URING_RX_GROUP, URING_RX_BUFFERS, URING_RX_BUFFER_BYTES)) {
+            return false;
+        }
+        msghdr rxTemplate{};
+        rxTemplate.msg_namelen = sizeof(sockaddr_in);
+        rxTemplate.msg_controllen = URING_RX_CONTROL_BYTES;
+        armUringRecv(ring, rxTemplate);
+        txBatch_.setUring(&ring);
+
+        std::vector<io_uring_cqe> cqes(URING_ENTRIES * 2);
+        bool expiryPending = false;
+        bool supported = true;
+        while (running_.load() && supported) {
+            const uint64_t entersBefore = ring.enters();
+            // Los SENDMSG de la vuelta anterior completan casi siempre en el mismo enter: se esperan sus CQEs
+            // más uno, así el envío de las respuestas y la espera del próximo datagrama son una sola syscall.
+            const unsigned waitFor = ring.hasDeferred() ? 0 : 1 + static_cast<unsigned>(txBatch_.inflight());
+            const uint64_t timeoutNs = untilNextDownTickNs(expiryPending ? 0 : IDLE_WHEEL_TICK_NS);
+            ring.submitAndWait(waitFor, static_cast<int64_t>(timeoutNs));
+            const uint64_t iterationStartNs = nowNs();
+            counters_.udpWakeups.fetch_add(1);
+            const size_t n = ring.reap(cqes.data(), cqes.size());
+
+            // Primero las completions de envío: liberan los slots que van a usar las respuestas de esta vuelta.
+            for (size_t i = 0; i < n; ++i) {
+                if (uringTagOf(cqes[i]) == UringTag::UDP_TX) {
+                    txBatch_.complete(uringValueOf(cqes[i]), cqes[i].res);
+                }
+            }
+
+            const uint64_t dequeuedRealtimeNs = realtimeNs();
+            const uint64_t dequeuedNs = nowNs();
+            size_t received = 0;
+            uint64_t receivedBytes = 0;
+            bool rearm = false;
+            for (size_t i = 0; i < n; ++i) {
+                const io_uring_cqe& cqe = cqes[i];
+                if (uringTagOf(cqe) != UringTag::UDP_RX) {
+                    continue;
+                }
+                if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+                    rearm = true;
+                }
+                if (cqe.res == -EINVAL || cqe.res == -EOPNOTSUPP) {
+                    supported = false;
+                }
+                if (cqe.res < 0 || (cqe.flags & IORING_CQE_F_BUFFER) == 0) {
+                    continue;
+                }
+                const auto bufferId = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                const uint8_t* buffer = ring.buffer(bufferId);
+                io_uring_recvmsg_out out{};
+                std::memcpy(&out, buffer, sizeof(out));
+                const uint8_t* name = buffer + sizeof(out);
+                uint8_t* control = const_cast<uint8_t*>(name) + rxTemplate.msg_namelen;
+                const uint8_t* payload = control + rxTemplate.msg_controllen;
+                const size_t available = static_cast<size_t>(cqe.res) - static_cast<size_t>(payload - buffer);
+                sockaddr_in from{};
+                std::memcpy(&from, name, std::min<size_t>(out.namelen, sizeof(from)));
+                msghdr controlHdr{};
+                controlHdr.msg_control = control;
+                controlHdr.msg_controllen = out.controllen;
+                onDatagram(payload, std::min<size_t>(out.payloadlen, available), from,
+                           cmsgRxRealtimeNs(controlHdr), dequeuedRealtimeNs, dequeuedNs);
+                receivedBytes += std::min<size_t>(out.payloadlen, available);
+                ring.recycleBuffer(bufferId);
+                ++received;
+            }
+            if (received > 0) {
+                counters_.udpPacketsIn.fetch_add(received);
+                counters_.udpBytesIn.fetch_add(receivedBytes);
+                publishRxDelay();
+                counters_.udpRxBatchHist[batchHistBucket(received)].fetch_add(1);
+            }
+            sendDueDownTicks();
+            txBatch_.flush();
+            if (rearm && supported) {
+                armUringRecv(ring, rxTemplate);
+            }
+
+            if (options_.kernelTimestamps) {
+                drainTxTimestamps();
+            }
+            expiryPending = expireIdleSessions();
+            counters_.uringEnters.fetch_add(ring.enters() - entersBefore);
+            counters_.udpLoopIteration.observe((nowNs() - iterationStartNs) / 1000ULL);
+        }
+
+        txBatch_.flush();
+        txBatch_.waitInflight();
+        txBatch_.setUring(nullptr);
+        return supported;
+    }
+
+    void armUringRecv(IoUring& ring, msghdr& rxTemplate) {
+        io_uring_sqe* sqe = ring.nextSqe();
+        if (sqe == nullptr) {
+            return;
+        }
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = fd_;
+        sqe->addr = reinterpret_cast<uint64_t>(&rxTemplate);
+        sqe->len = 1;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_RX_GROUP;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->user_data = uringUserData(UringTag::UDP_RX, 0);
+    }
+
+    // arrivalNs: desde cuándo cuenta la residencia de la respuesta (el rxNs del kernel o la salida del lote).
+    void handleDatagram(const uint8_t* buffer, size_t n, const sockaddr_in& client, uint64_t rxNs, uint64_t arrivalNs) {
+        if (n < 12) {
+            return;
+        }
+
+        UdpHeader header{};
+        if (!parseUdpHeader(buffer, n, header)) {
+            return;
+        }
+        if (header.version != UDP_PROTOCOL_VERSION) {
+            return;
+        }
+
+        const uint8_t* body = buffer + 12;
+        const size_t bodySize = n - 12;
+
+        UdpSessionKey key{header.sessionId, client.sin_addr.s_addr, client.sin_port};
+
+        if (header.type == UdpMessageType::SYNC_REQ) {
+            size_t offset = 0;
+            uint64_t clientSendNs = 0;
+            uint32_t syncFlags = 0;
+            if (!readLe<uint64_t>(body, bodySize, offset, clientSendNs)) {
+                return;
+            }
+            if (offset != bodySize && (!readLe<uint32_t>(body, bodySize, offset, syncFlags) || offset != bodySize)) {
+                return;
+            }
+
+            const uint64_t recvNs = rxNs != 0 ? rxNs : nowNs();
+            const uint64_t sendNs = nowNs();
+            std::vector<uint8_t> responseBody;
+            appendLe<uint64_t>(responseBody, clientSendNs);
+            appendLe<uint64_t>(responseBody, recvNs);
+            appendLe<uint64_t>(responseBody, sendNs);
+            auto packet = makeUdpPacket(UdpMessageType::SYNC_RESP, header.sessionId, header.seq, responseBody);
+
+            UdpTxMeta meta;
+            meta.track = options_.kernelTimestamps && (syncFlags & SYNC_REQ_FLAG_TX_FOLLOWUP) != 0;
+            meta.type = UdpMessageType::SYNC_RESP;
+            meta.key = key;
+            meta.seq = header.seq;
+            meta.clientSendNs = clientSendNs;
+            meta.arrivalNs = arrivalNs;
+            txBatch_.queue(client, packet, meta);
+            return;
+        }
+
+        if (header.type == UdpMessageType::TEST_START_REQ) {
+            size_t offset = 0;
+            uint8_t runMode = 0;
+            uint8_t requestedFeatures = 0;
+            uint16_t pad16 = 0;
+            uint32_t tickMs = 0;
+            uint32_t durationMs = 0;
+            uint32_t packetCount = 0;
+            uint32_t payloadUpBytes = 0;
+            uint32_t payloadDownBytes = 0;
+
+            if (!readLe<uint8_t>(body, bodySize, offset, runMode) ||
+                !readLe<uint8_t>(body, bodySize, offset, requestedFeatures) ||
+                !readLe<uint16_t>(body, bodySize, offset, pad16) ||
+                !readLe<uint32_t>(body, bodySize, offset, tickMs) ||
+                !readLe<uint32_t>(body, bodySize, offset, durationMs) ||
+                !readLe<uint32_t>(body, bodySize, offset, packetCount) ||
+                !readLe<uint32_t>(body, bodySize, offset, payloadUpBytes) ||
+                !readLe<uint32_t>(body, bodySize, offset, payloadDownBytes) ||
+                offset != bodySize) {
+                return;
+            }
+
+            bool accepted = true;
+            uint32_t acceptedTick = options_.tickOverrideMs > 0 ? static_cast<uint32_t>(options_.tickOverrideMs) : tickMs;
+            if (acceptedTick < UDP_MIN_TICK_MS || acceptedTick > UDP_MAX_TICK_MS) {
+                accepted = false;
+            }
+
+            if (payloadUpBytes > UDP_MAX_PAYLOAD_BYTES || payloadDownBytes > UDP_MAX_PAYLOAD_BYTES) {
+                accepted = false;
+            }
+
+            uint32_t resolvedCount = packetCount;
+            if (runMode == 0 || (runMode == UDP_RUN_MODE_DOWNLINK_STREAM && durationMs > 0)) {
+                if (durationMs < acceptedTick) {
+                    durationMs = acceptedTick;
+                }
+                resolvedCount = static_cast<uint32_t>(
+                    std::ceil(static_cast<double>(durationMs) / static_cast<double>(acceptedTick)));
+            }
+            if (resolvedCount == 0 || resolvedCount > UDP_MAX_PACKET_COUNT) {
+                accepted = false;
+            }
+
+            const bool validRequest = accepted;
+            UdpSession* existing = sessions_.find(key);
+            if (accepted && existing == nullptr && !tryReserveSession(activeSessions_, options_.maxSessions)) {
+                accepted = false;
+            }
+            UdpSession* slot = nullptr;
+            if (accepted) {
+                slot = existing != nullptr ? existing : sessions_.insert(key);
+                if (slot == nullptr) {
+                    activeSessions_.fetch_sub(1);
+                    accepted = false;
+                } else if (existing == nullptr) {
+                    counters_.udpActiveSessions.fetch_add(1);
+                }
+            }
+            if (!accepted) {
+                const RejectReason reason = validRequest ? RejectReason::BUSY : RejectReason::BAD_REQUEST;
+                counters_.udpRejections[static_cast<size_t>(reason)].fetch_add(1);
+            }
+
+            const uint8_t acceptedFeatures = requestedFeatures & supportedFeatures();
+            if (accepted) {
+                UdpSession& session = *slot;
+                session.sessionId = header.sessionId;
+                session.client = client;
+                session.tickMs = acceptedTick;
+                session.expectedCount = resolvedCount;
+                session.payloadUpBytes = payloadUpBytes;
+                session.payloadDownBytes = payloadDownBytes;
+                session.upReceivedCount = 0;
+                session.downSentCount = 0;
+                session.upOutOfOrderCount = 0;
+                session.maxSeqSeen = -1;
+                session.upBitmapBytes = (resolvedCount + 7U) / 8U;
+                std::memset(session.upBitmap, 0, session.upBitmapBytes);
+                session.startedNs = nowNs();
+                session.lastActivityNs = session.startedNs;
+                session.features = acceptedFeatures;
+                session.lastTxSeq = 0;
+                session.lastTxNs = 0;
+                session.lastArrivalSeq = -1;
+                session.lastArrivalNs = 0;
+                session.upDelayBaseSet = false;
+                session.upDelayHist.clear();
+                session.interArrivalHist.clear();
+                session.runMode = runMode;
+                session.nextDownSeq = 0;
+                session.downDeviationHist.clear();
+                idleWheel_.schedule(session);
+                if (runMode == UDP_RUN_MODE_DOWNLINK_STREAM) {
+                    session.downStreamStartNs = session.startedNs + static_cast<uint64_t>(acceptedTick) * 1000000ULL;
+                    scheduleDownTick(session);
+                }
+
+                LogRecord(logger_, LogLevel::SUMMARY, "session_start")
+                    .str("transport", "udp")
+                    .sessionTag("session", header.sessionId, client)
+                    .u64("runMode", runMode)
+                    .u64("tickMs", acceptedTick)
+                    .u64("resolvedCount", resolvedCount)
+                    .u64("payloadUp", payloadUpBytes)
+                    .u64("payloadDown", payloadDownBytes)
+                    .i64("worker", index_);
+            }
+
+            uint8_t* out = txBatch_.prepare();
+            size_t length = writeUdpHeader(out, UdpMessageType::TEST_START_ACK, header.sessionId, header.seq);
+            putLe<uint32_t>(out, length, acceptedTick);
+            putLe<uint32_t>(out, length, resolvedCount);
+            putLe<uint32_t>(out, length, payloadUpBytes);
+            putLe<uint32_t>(out, length, payloadDownBytes);
+            putLe<uint8_t>(out, length, static_cast<uint8_t>(accepted ? 1 : 0));
+            putLe<uint8_t>(out, length, accepted ? acceptedFeatures : 0);
+            putLe<uint8_t>(out, length, 0);
+            putLe<uint8_t>(out, length, 0);
+            txBatch_.commit(client, length);
+            return;
+        }
+
+        if (header.type == UdpMessageType::UP_TICK) {
+            size_t offset = 0;
+            uint64_t clientSendNs = 0;
+            uint32_t payloadSize = 0;
+            if (!readLe<uint64_t>(body, bodySize, offset, clientSendNs) ||
+                !readLe<uint32_t>(body, bodySize, offset, payloadSize) ||
+                payloadSize > UDP_MAX_PAYLOAD_BYTES ||
+                offset + payloadSize != bodySize) {
+                return;
+            }
+
+            const uint64_t allocsBefore = threadAllocationCount();
+            uint32_t flags = 0;
+            uint64_t recvNs = rxNs != 0 ? rxNs : nowNs();
+
+            UdpSession* found = sessions_.find(key);
+            if (found == nullptr) {
+                return;
+            }
+            UdpSession& session = *found;
+            session.lastActivityNs = recvNs;
+            uint32_t seq = header.seq;
+            if (seq >= session.expectedCount) {
+                return;
+            }
+            const size_t byteIndex = seq / 8U;
+            const uint8_t bit = static_cast<uint8_t>(1U << (seq % 8U));
+            if ((session.upBitmap[byteIndex] & bit) == 0) {
+                session.upBitmap[byteIndex] |= bit;
+                session.upReceivedCount += 1;
+            }
+
+            const bool outOfOrder = session.maxSeqSeen >= 0 && static_cast<int64_t>(seq) < session.maxSeqSeen;
+            if (outOfOrder) {
+                session.upOutOfOrderCount += 1;
+                flags |= 0x1U;
+            }
+            if (static_cast<int64_t>(seq) > session.maxSeqSeen) {
+                session.maxSeqSeen = static_cast<int64_t>(seq);
+            }
+            recordUpTickLatency(session, seq, clientSendNs, recvNs);
+            if (session.runMode == UDP_RUN_MODE_DOWNLINK_STREAM) {
+                return; // el downlink sale de la agenda del stream; el UP_TICK sólo mide la subida
+            }
+            session.downSentCount += 1;
+
+            const uint64_t sendNs = queueDownTick(session, seq, clientSendNs, recvNs, flags, arrivalNs);
+            counters_.downTickAllocs.fetch_add(threadAllocationCount() - allocsBefore);
+            LogRecord(logger_, LogLevel::VERBOSE, "udp_tick")
+                .sessionTag("session", header.sessionId, client)
+                .u64("seq", header.seq)
+                .u64("clientSendNs", clientSendNs)
+                .u64("recvNs", recvNs)
+                .u64("sendNs", sendNs)
+                .u64("flags", flags)
+                .u64("upBytes", payloadSize)
+                .u64("downBytes", session.payloadDownBytes);
+            return;
+        }
+
+        if (header.type == UdpMessageType::TEST_END_REQ) {
+            const UdpSession* found = sessions_.find(key);
+            if (found == nullptr) {
+                return;
+            }
+            const UdpSession& session = *found;
+
+            std::vector<uint8_t> summaryBody;
+            appendLe<uint32_t>(summaryBody, session.expectedCount);
+            appendLe<uint32_t>(summaryBody, session.upReceivedCount);
+            appendLe<uint32_t>(summaryBody, session.downSentCount);
+            appendLe<uint32_t>(summaryBody, session.upOutOfOrderCount);
+            const bool lossRuns = (session.features & UDP_FEATURE_LOSS_RUNS) != 0;
+            if (lossRuns) {
+                // Con pérdida alternada las rachas ocupan más que el bitmap: va la más chica, así el resumen
+                // usa la menor cantidad de fragmentos (perder uno es perder todo el resumen).
+                std::vector<uint8_t> runs;
+                if (session.upReceivedCount < session.expectedCount) {
+                    appendLossRuns(runs, session.upBitmap, session.expectedCount);
+                }
+                if (runs.size() <= session.upBitmapBytes) {
+                    appendLe<uint8_t>(summaryBody, UDP_LOSS_FORMAT_RUNS);
+                    appendLe<uint32_t>(summaryBody, static_cast<uint32_t>(runs.size()));
+                    summaryBody.insert(summaryBody.end(), runs.begin(), runs.end());
+                } else {
+                    appendLe<uint8_t>(summaryBody, UDP_LOSS_FORMAT_BITMAP);
+                    appendLe<uint32_t>(summaryBody, session.upBitmapBytes);
+                    summaryBody.insert(summaryBody.end(), session.upBitmap, session.upBitmap + session.upBitmapBytes);
+                }
+            } else {
+                appendLe<uint32_t>(summaryBody, session.upBitmapBytes);
+                summaryBody.insert(summaryBody.end(), session.upBitmap, session.upBitmap + session.upBitmapBytes);
+            }
+            if ((session.features & UDP_FEATURE_LATENCY_STATS) != 0) {
+                appendLatencyStats(summaryBody, session.upDelayHist);
+                appendLatencyStats(summaryBody, session.interArrivalHist);
+                if (session.runMode == UDP_RUN_MODE_DOWNLINK_STREAM) {
+                    appendLatencyStats(summaryBody, session.downDeviationHist);
+                }
+            }
+
+            if (lossRuns) {
+                queueSummaryFragments(client, header, summaryBody);
+            } else {
+                auto summary =
+                    makeUdpPacket(UdpMessageType::TEST_END_SUMMARY, header.sessionId, header.seq, summaryBody);
+                txBatch_.queue(client, summary);
+            }
+
+            removeSession(key, "client_end");
+            return;
+        }
+    }
+
+    // Cada datagrama lleva `fragmentIndex u16` + `fragmentCount u16` y el tramo siguiente del resumen, sin pasar
+    // de UDP_MAX_DATAGRAM_BYTES: el cliente concatena los tramos en orden.
+    void queueSummaryFragments(const sockaddr_in& client, const UdpHeader& header, const std::vector<uint8_t>& body) {
+        const size_t count =
+            std::max<size_t>(1, (body.size() + UDP_SUMMARY_FRAGMENT_BYTES - 1) / UDP_SUMMARY_FRAGMENT_BYTES);
+        for (size_t index = 0; index < count; ++index) {
+            const size_t first = index * UDP_SUMMARY_FRAGMENT_BYTES;
+            const size_t chunk = std::min(UDP_SUMMARY_FRAGMENT_BYTES, body.size() - first);
+            uint8_t* out = txBatch_.prepare();
+            size_t length = writeUdpHeader(out, UdpMessageType::TEST_END_SUMMARY, header.sessionId, header.seq);
+            putLe<uint16_t>(out, length, static_cast<uint16_t>(index));
+            putLe<uint16_t>(out, length, static_cast<uint16_t>(count));
+            std::memcpy(out + length, body.data() + first, chunk);
+            txBatch_.commit(client, length + chunk);
+        }
+    }
+
+    // Sólo escalares de la sesión: el DOWN_TICK se arma directo en el slot del lote, sin allocations. Completa
+    // `flags` con los bits que agrega y devuelve el sendNs escrito en el paquete.
+    uint64_t queueDownTick(UdpSession& session,
+                           uint32_t seq,
+                           uint64_t clientSendNs,
+                           uint64_t recvNs,
+                           uint32_t& flags,
+                           uint64_t arrivalNs) {
+        const bool reportTx = (session.features & UDP_FEATURE_TX_TIMESTAMPS) != 0 && session.lastTxNs != 0;
+        if (reportTx) {
+            flags |= DOWN_TICK_FLAG_TX_TIMESTAMP;
+        }
+        // La residencia sólo tiene sentido para ecos: un DOWN_TICK agendado no responde a ninguna request.
+        const bool stampResidence = (session.features & UDP_FEATURE_RESIDENCE) != 0 && arrivalNs != 0;
+        if (stampResidence) {
+            flags |= DOWN_TICK_FLAG_RESIDENCE;
+        }
+
+        UdpTxMeta meta;
+        meta.track = (session.features & UDP_FEATURE_TX_TIMESTAMPS) != 0;
+        meta.type = UdpMessageType::DOWN_TICK;
+        meta.key = session.key;
+        meta.seq = seq;
+        meta.arrivalNs = arrivalNs;
+        meta.stampResidence = stampResidence;
+
+        uint8_t* out = txBatch_.prepare();
+        size_t length = writeUdpHeader(out, UdpMessageType::DOWN_TICK, session.sessionId, seq);
+        const uint64_t sendNs = nowNs();
+        putLe<uint64_t>(out, length, clientSendNs);
+        putLe<uint64_t>(out, length, recvNs);
+        putLe<uint64_t>(out, length, sendNs);
+        putLe<uint32_t>(out, length, flags);
+        putLe<uint32_t>(out, length, session.payloadDownBytes);
+        std::memset(out + length, static_cast<int>(seq & 0xFF), session.payloadDownBytes);
+        length += session.payloadDownBytes;
+        if (reportTx) {
+            putLe<uint32_t>(out, length, session.lastTxSeq);
+            putLe<uint64_t>(out, length, session.lastTxNs);
+        }
+        txBatch_.commit(session.client, length, meta);
+        return sendNs;
+    }
+
+    void scheduleDownTick(const UdpSession& session) {
+        const uint64_t tickNs = static_cast<uint64_t>(session.tickMs) * 1000000ULL;
+        const uint64_t deadlineNs = session.downStreamStartNs + session.nextDownSeq * tickNs;
+        downlinkHeap_.push_back({deadlineNs, session.key, session.startedNs});
+        std::push_heap(downlinkHeap_.begin(), downlinkHeap_.end(), std::greater<DownlinkDeadline>());
+    }
+
+    // Espera máxima hasta el próximo DOWN_TICK agendado, acotada por capNs.
+    uint64_t untilNextDownTickNs(uint64_t capNs) const {
+        if (downlinkHeap_.empty()) {
+            return capNs;
+        }
+        const uint64_t now = nowNs();
+        const uint64_t deadlineNs = downlinkHeap_.front().deadlineNs;
+        return deadlineNs > now ? std::min(capNs, deadlineNs - now) : 0;
+    }
+
+    // Envía los DOWN_TICK vencidos del stream. La agenda es absoluta (inicio + seq * tick): un envío tardío
+    // sale enseguida y no corre los siguientes, así el desvío registrado es el del scheduler y no se acumula.
+    // Sin datagramas del cliente por UDP_STREAM_KEEPALIVE_MS el stream se corta: el server no emite tráfico
+    // hacia una dirección que dejó de hablarle.
+    void sendDueDownTicks() {
+        uint64_t now = nowNs();
+        while (!downlinkHeap_.empty() && downlinkHeap_.front().deadlineNs <= now) {
+            std::pop_heap(downlinkHeap_.begin(), downlinkHeap_.end(), std::greater<DownlinkDeadline>());
+            const DownlinkDeadline due = downlinkHeap_.back();
+            downlinkHeap_.pop_back();
+            UdpSession* session = sessions_.find(due.key);
+            if (session == nullptr || session->startedNs != due.startedNs) {
+                continue;
+            }
+            if (session->lastActivityNs + static_cast<uint64_t>(UDP_STREAM_KEEPALIVE_MS) * 1000000ULL < now) {
+                LogRecord(logger_, LogLevel::SUMMARY, "udp_stream_stop")
+                    .sessionTag("session", session->sessionId, session->client)
+                    .u64("downSent", session->downSentCount);
+                continue;
+            }
+
+            const uint32_t seq = session->nextDownSeq;
+            uint32_t flags = DOWN_TICK_FLAG_SCHEDULED;
+            now = queueDownTick(*session, seq, 0, due.deadlineNs, flags, 0);
+            const uint64_t deviationNs = now - due.deadlineNs;
+            session->downDeviationHist.record(deviationNs / 1000ULL);
+            workerCounters_.downlinkScheduleDeviation.observeOwned(deviationNs);
+            ownedStoreMax(workerCounters_.downlinkScheduleDeviationMaxNs, deviationNs);
+            session->downSentCount += 1;
+            session->nextDownSeq += 1;
+            if (session->nextDownSeq < session->expectedCount) {
+                scheduleDownTick(*session);
+            }
+            LogRecord(logger_, LogLevel::VERBOSE, "udp_stream_tick")
+                .sessionTag("session", session->sessionId, session->client)
+                .u64("seq", seq)
+                .u64("scheduledNs", due.deadlineNs)
+                .u64("sendNs", now)
+                .u64("flags", flags)
+                .u64("downBytes", session->payloadDownBytes);
+        }
+    }
+
+    uint8_t supportedFeatures() const {
+        return (options_.kernelTimestamps ? UDP_FEATURE_TX_TIMESTAMPS : 0) | UDP_FEATURE_LATENCY_STATS |
+               UDP_FEATURE_RESIDENCE | UDP_FEATURE_LOSS_RUNS;
+    }
+
+    // El delay de subida se mide contra el mínimo de la sesión: el server no conoce el offset entre relojes,
+    // y el mínimo lo absorbe junto con el delay base del camino. Si aparece un mínimo nuevo se corre la base y
+    // el histograma se desplaza. El inter-arrival sólo usa paquetes en orden, descontando los saltos de seq.
+    static void recordUpTickLatency(UdpSession& session, uint32_t seq, uint64_t clientSendNs, uint64_t recvNs) {
+        const auto rawNs = static_cast<int64_t>(recvNs - clientSendNs);
+        if (!session.upDelayBaseSet) {
+            session.upDelayBaseSet = true;
+            session.upDelayBaseNs = rawNs;
+        } else if (rawNs < session.upDelayBaseNs) {
+            session.upDelayHist.shift(static_cast<uint64_t>(session.upDelayBaseNs - rawNs) / 1000ULL);
+            session.upDelayBaseNs = rawNs;
+        }
+        session.upDelayHist.record(static_cast<uint64_t>(rawNs - session.upDelayBaseNs) / 1000ULL);
+
+        if (static_cast<int64_t>(seq) > session.lastArrivalSeq) {
+            if (session.lastArrivalSeq >= 0) {
+                const uint64_t expectedNs =
+                    static_cast<uint64_t>(seq - session.lastArrivalSeq) * session.tickMs * 1000000ULL;
+                const uint64_t gapNs = recvNs - session.lastArrivalNs;
+                const uint64_t deviationNs = gapNs > expectedNs ? gapNs - expectedNs : expectedNs - gapNs;
+                session.interArrivalHist.record(deviationNs / 1000ULL);
+            }
+            session.lastArrivalSeq = seq;
+            session.lastArrivalNs = recvNs;
+        }
+    }
+
+    static void appendLatencyStats(std::vector<uint8_t>& body, const LatencyHistogram& hist) {
+        appendLe<uint32_t>(body, static_cast<uint32_t>(hist.count()));
+        appendLe<uint32_t>(body, static_cast<uint32_t>(hist.percentile(50.0)));
+        appendLe<uint32_t>(body, static_cast<uint32_t>(hist.percentile(90.0)));
+        appendLe<uint32_t>(body, static_cast<uint32_t>(hist.percentile(99.0)));
+        appendLe<uint32_t>(body, static_cast<uint32_t>(std::min<uint64_t>(hist.max(), UINT32_MAX)));
+    }
+
+    // Lee los timestamps TX de la cola de errores del socket: los de SYNC_RESP salen como SYNC_FOLLOWUP y los
+    // de DOWN_TICK quedan en la sesión para viajar en el próximo tick.
+    void drainTxTimestamps() {
+        const uint64_t realtimeToSteadyNs = realtimeNs() - nowNs();
+        while (true) {
+            uint8_t control[256];
+            msghdr msg{};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+
+            uint64_t txRealtimeNs = 0;
+            const sock_extended_err* err = nullptr;
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                    timespec ts{};
+                    std::memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                    txRealtimeNs = static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+                } else if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) {
+                    err = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cmsg));
+                }
+            }
+            if (err == nullptr || err->ee_origin != SO_EE_ORIGIN_TIMESTAMPING || txRealtimeNs == 0) {
+                continue;
+            }
+            const UdpTxMeta* meta = txTimestamps_.lookup(err->ee_data);
+            if (meta == nullptr) {
+                continue;
+            }
+            counters_.udpTxTimestamps.fetch_add(1);
+            const uint64_t txNs = txRealtimeNs - realtimeToSteadyNs;
+
+            if (meta->type == UdpMessageType::SYNC_RESP) {
+                sockaddr_in to{};
+                to.sin_family = AF_INET;
+                to.sin_addr.s_addr = meta->key.ip;
+                to.sin_port = meta->key.port;
+                std::vector<uint8_t> followupBody;
+                appendLe<uint64_t>(followupBody, meta->clientSendNs);
+                appendLe<uint64_t>(followupBody, txNs);
+                auto followup = makeUdpPacket(UdpMessageType::SYNC_FOLLOWUP, meta->key.sessionId, meta->seq, followupBody);
+                txBatch_.queue(to, followup);
+            } else if (meta->type == UdpMessageType::DOWN_TICK) {
+                UdpSession* session = sessions_.find(meta->key);
+                if (session != nullptr) {
+                    session->lastTxSeq = meta->seq;
+                    session->lastTxNs = txNs;
+                }
+            }
+        }
+        txBatch_.flush();
+    }
+
+    void removeSession(const UdpSessionKey& key, const char* reason) {
+        UdpSession* session = sessions_.find(key);
+        if (session == nullptr) {
+            return;
+        }
+
+        LogRecord record(logger_, LogLevel::SUMMARY, "session_end");
+        record.str("transport", "udp")
+            .sessionTag("session", session->sessionId, session->client)
+            .str("reason", reason)
+            .u64("expectedCount", session->expectedCount)
+            .u64("upReceived", session->upReceivedCount)
+            .u64("downSent", session->downSentCount)
+            .u64("upOutOfOrder", session->upOutOfOrderCount)
+            .u64("upDelayP50Us", session->upDelayHist.percentile(50.0))
+            .u64("upDelayP90Us", session->upDelayHist.percentile(90.0))
+            .u64("upDelayP99Us", session->upDelayHist.percentile(99.0))
+            .u64("upDelayMaxUs", session->upDelayHist.max())
+            .u64("interArrivalDevP50Us", session->interArrivalHist.percentile(50.0))
+            .u64("interArrivalDevP90Us", session->interArrivalHist.percentile(90.0))
+            .u64("interArrivalDevP99Us", session->interArrivalHist.percentile(99.0))
+            .u64("interArrivalDevMaxUs", session->interArrivalHist.max());
+        if (session->runMode == UDP_RUN_MODE_DOWNLINK_STREAM) {
+            record.u64("downScheduleDevP50Us", session->downDeviationHist.percentile(50.0))
+                .u64("downScheduleDevP90Us", session->downDeviationHist.percentile(90.0))
+                .u64("downScheduleDevP99Us", session->downDeviationHist.percentile(99.0))
+                .u64("downScheduleDevMaxUs", session->downDeviationHist.max());
+        }
+
+        counters_.udpSessionDuration.observe((nowNs() - session->startedNs) / 1000ULL);
+        idleWheel_.unlink(*session);
+        sessions_.erase(key);
+        activeSessions_.fetch_sub(1);
+        counters_.udpActiveSessions.fetch_sub(1);
+    }
+
+    bool expireIdleSessions() {
+        const uint64_t startNs = nowNs();
+        size_t expired = 0;
+        const bool pending = idleWheel_.advance(startNs, IDLE_EXPIRY_BUDGET, [&](UdpSession& session) {
+            removeSession(session.key, "idle_timeout");
+            ++expired;
+        });
+        if (expired > 0 || pending) {
+            const uint64_t spentNs = nowNs() - startNs;
+            counters_.udpIdleExpired.fetch_add(expired);
+            counters_.udpExpiryNs.fetch_add(spentNs);
+            atomicStoreMax(counters_.udpExpiryMaxNs, spentNs);
+        }
+        return pending;
+    }
+
+    int index_;
+    int fd_;
+    const ServerOptions& options_;
+    TrafficCounters& counters_;
+    UdpWorkerCounters& workerCounters_;
+    JsonLogger& logger_;
+    std::atomic<int>& activeSessions_;
+    std::atomic<bool>& running_;
+    UdpRxBatch rxBatch_;
+    UdpTxBatch txBatch_;
+    UdpTxTimestampRing txTimestamps_;
+    UdpSessionTable sessions_;
+    IdleTimerWheel idleWheel_;
+    std::vector<DownlinkDeadline> downlinkHeap_; // min-heap por deadlineNs
+    uint64_t rxDelaySamples_ = 0; // demora de cola del lote en curso, ver publishRxDelay()
+    uint64_t rxDelaySumNs_ = 0;
+    uint64_t rxDelayMaxNs_ = 0;
+};
+
+struct TcpSocketRequest {
+    bool present = false; // el cliente mandó opciones: START_ACK devuelve los efectivos
+    std::string congestion;
+    uint32_t sndBuf = 0;
+    uint32_t rcvBuf = 0;
+    uint64_t pacingBps = 0;
+};
+
+// Tipos desconocidos se ignoran para que clientes nuevos puedan hablar con servers viejos.
+bool parseTcpStartOptions(const uint8_t* body, size_t size, size_t offset, TcpSocketRequest& request) {
+    while (offset < size) {
+        uint8_t type = 0;
+        uint8_t len = 0;
+        if (!readLe<uint8_t>(body, size, offset, type) || !readLe<uint8_t>(body, size, offset, len) ||
+            offset + len > size) {
+            return false;
+        }
+        request.present = true;
+        const uint8_t* value = body + offset;
+        switch (static_cast<TcpStartOption>(type)) {
+            case TcpStartOption::CONGESTION:
+                if (len == 0 || len > TCP_CC_NAME_MAX) {
+                    return false;
+                }
+                request.congestion.assign(reinterpret_cast<const char*>(value), len);
+                break;
+            case TcpStartOption::SNDBUF:
+            case TcpStartOption::RCVBUF: {
+                size_t valueOffset = 0;
+                uint32_t bytes = 0;
+                if (len != sizeof(uint32_t) || !readLe<uint32_t>(value, len, valueOffset, bytes)) {
+                    return false;
+                }
+                (type == static_cast<uint8_t>(TcpStartOption::SNDBUF) ? request.sndBuf : request.rcvBuf) = bytes;
+                break;
+            }
+            case TcpStartOption::PACING_RATE: {
+                size_t valueOffset = 0;
+                if (len != sizeof(uint64_t) || !readLe<uint64_t>(value, len, valueOffset, request.pacingBps)) {
+                    return false;
+                }
+                break;
+            }
+        }
+        offset += len;
+    }
+    return true;
+}
+
+struct TcpIntervalSample {
+    uint32_t elapsedMs = 0;
+    uint64_t bytes = 0; // acumulado
+    uint32_t srttUs = 0;
+    uint32_t rttvarUs = 0;
+    uint32_t cwnd = 0; // segmentos
+    uint32_t totalRetrans = 0;
+    uint64_t deliveryRate = 0; // bytes/s
+    uint64_t busyUs = 0;
+    uint64_t rwndLimitedUs = 0;
+    uint64_t sndbufLimitedUs = 0;
+};
+
+// Kernels viejos devuelven un tcp_info más corto: los campos que no llegan quedan en 0.
+TcpIntervalSample sampleTcpInfo(int fd, uint64_t elapsedNs, uint64_t bytes) {
+    TcpIntervalSample sample;
+    sample.elapsedMs = static_cast<uint32_t>(elapsedNs / 1000000ULL);
+    sample.bytes = bytes;
+    tcp_info info{};
+    socklen_t len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+        sample.srttUs = info.tcpi_rtt;
+        sample.rttvarUs = info.tcpi_rttvar;
+        sample.cwnd = info.tcpi_snd_cwnd;
+        sample.totalRetrans = info.tcpi_total_retrans;
+        sample.deliveryRate = info.tcpi_delivery_rate;
+        sample.busyUs = info.tcpi_busy_time;
+        sample.rwndLimitedUs = info.tcpi_rwnd_limited;
+        sample.sndbufLimitedUs = info.tcpi_sndbuf_limited;
+    }
+    return sample;
+}
+
+void logIntervalSeries(LogRecord& record, const std::vector<TcpIntervalSample>& samples) {
+    record.u64("seriesIntervalMs", TCP_SAMPLE_INTERVAL_NS / 1000000ULL);
+    record.u64Rows("series", samples.size(), 10, [&](size_t i, uint64_t* row) {
+        const TcpIntervalSample& s = samples[i];
+        row[0] = s.elapsedMs;
+        row[1] = s.bytes;
+        row[2] = s.srttUs;
+        row[3] = s.rttvarUs;
+        row[4] = s.cwnd;
+        row[5] = s.totalRetrans;
+        row[6] = s.deliveryRate;
+        row[7] = s.busyUs;
+        row[8] = s.rwndLimitedUs;
+        row[9] = s.sndbufLimitedUs;
+    });
+}
+
+std::vector<uint8_t> intervalSeriesBody(const std::vector<TcpIntervalSample>& samples) {
+    std::vector<uint8_t> body;
+    body.reserve(8 + samples.size() * TCP_SERIES_SAMPLE_BYTES);
+    appendLe<uint32_t>(body, static_cast<uint32_t>(TCP_SAMPLE_INTERVAL_NS / 1000000ULL));
+    appendLe<uint16_t>(body, static_cast<uint16_t>(samples.size()));
+    appendLe<uint16_t>(body, TCP_SERIES_SAMPLE_BYTES);
+    for (const TcpIntervalSample& s : samples) {
+        appendLe<uint32_t>(body, s.elapsedMs);
+        appendLe<uint64_t>(body, s.bytes);
+        appendLe<uint32_t>(body, s.srttUs);
+        appendLe<uint32_t>(body, s.rttvarUs);
+        appendLe<uint32_t>(body, s.cwnd);
+        appendLe<uint32_t>(body, s.totalRetrans);
+        appendLe<uint64_t>(body, s.deliveryRate);
+        appendLe<uint64_t>(body, s.busyUs);
+        appendLe<uint64_t>(body, s.rwndLimitedUs);
+        appendLe<uint64_t>(body, s.sndbufLimitedUs);
+    }
+    return body;
+}
+
+// Qué tan cerca quedó un download con pacing de la tasa pedida, medido sobre los intervalos de la serie.
+struct TcpPacingStats {
+    uint64_t achievedBps = 0;
+    uint64_t intervalRmsErrorBps = 0; // desvío cuadrático medio de cada intervalo respecto del objetivo
+    uint16_t intervals = 0;
+    uint16_t intervalsWithin10Pct = 0;
+};
+
+TcpPacingStats computePacingStats(const std::vector<TcpIntervalSample>& samples,
+                                  uint64_t targetBps,
+                                  uint64_t bytes,
+                                  uint64_t durationNs) {
+    TcpPacingStats stats;
+    stats.achievedBps = static_cast<uint64_t>(static_cast<double>(bytes) * 8e9 / static_cast<double>(durationNs));
+    double sumSquares = 0.0;
+    uint32_t prevMs = 0;
+    uint64_t prevBytes = 0;
+    for (const TcpIntervalSample& sample : samples) {
+        const uint32_t spanMs = sample.elapsedMs - prevMs;
+        if (spanMs < TCP_SAMPLE_INTERVAL_NS / 2000000ULL) {
+            continue; // cola final más corta que medio intervalo
+        }
+        const double rate = static_cast<double>(sample.bytes - prevBytes) * 8000.0 / spanMs;
+        const double error = rate - static_cast<double>(targetBps);
+        sumSquares += error * error;
+        ++stats.intervals;
+        if (std::fabs(error) <= 0.1 * static_cast<double>(targetBps)) {
+            ++stats.intervalsWithin10Pct;
+        }
+        prevMs = sample.elapsedMs;
+        prevBytes = sample.bytes;
+    }
+    if (stats.intervals > 0) {
+        stats.intervalRmsErrorBps = static_cast<uint64_t>(std::sqrt(sumSquares / stats.intervals));
+    }
+    return stats;
+}
+
+struct TcpStreamGroup {
+    uint32_t sessionId = 0;
+    uint32_t clientIp = 0;
+    ThroughputDirection direction = ThroughputDirection::DOWNLOAD;
+    uint8_t streams = 0;
+    uint32_t durationMs = 0;
+    uint32_t chunkBytes = 0;
+    uint64_t startNs = 0;
+    uint64_t deadlineNs = 0;
+    uint64_t endNs = 0;
+    uint8_t joined = 0;
+    uint8_t finished = 0;
+    uint8_t open = 0;
+    bool closed = false; // el stream 0 terminó: no se aceptan más uniones
+    std::vector<uint64_t> streamBytes;
+};
+
+enum class TcpJoinResult : uint8_t {
+    CREATED,
+    JOINED,
+    BUSY,
+    REJECTED
+};
+
+// Tests TCP multi-stream: conexiones con el mismo sessionId y la misma IP de cliente (posiblemente atendidas
+// por workers distintos) forman un grupo que ocupa un solo lugar en activeSessions. Sólo se toca al unirse o
+// terminar un stream, así que alcanza con un mutex.
+class TcpStreamGroups {
+public:
+    TcpStreamGroups(std::atomic<int>& activeSessions, int maxSessions)
+        : activeSessions_(activeSessions), maxSessions_(maxSessions) {}
+
+    // El primer START_REQ crea el grupo (stream 0) y fija duración, chunk y deadline para todos.
+    TcpJoinResult join(uint32_t sessionId,
+                       uint32_t clientIp,
+                       ThroughputDirection direction,
+                       uint8_t streams,
+                       uint32_t durationMs,
+                       uint32_t chunkBytes,
+                       std::shared_ptr<TcpStreamGroup>& group,
+                       uint8_t& index) {
+        std::lock_guard<std::mutex> lock(mu_);
+        const auto key = std::make_pair(sessionId, clientIp);
+        auto it = groups_.find(key);
+        if (it != groups_.end()) {
+            TcpStreamGroup& existing = *it->second;
+            if (existing.closed || existing.direction != direction || existing.streams != streams ||
+                existing.joined >= existing.streams || nowNs() >= existing.deadlineNs) {
+                return TcpJoinResult::REJECTED;
+            }
+            index = existing.joined++;
+            ++existing.open;
+            group = it->second;
+            return TcpJoinResult::JOINED;
+        }
+
+        if (!tryReserveSession(activeSessions_, maxSessions_)) {
+            return TcpJoinResult::BUSY;
+        }
+        auto created = std::make_shared<TcpStreamGroup>();
+        created->sessionId = sessionId;
+        created->clientIp = clientIp;
+        created->direction = direction;
+        created->streams = streams;
+        created->durationMs = durationMs;
+        created->chunkBytes = chunkBytes;
+        created->startNs = nowNs();
+        created->deadlineNs = created->startNs + static_cast<uint64_t>(durationMs) * 1000000ULL;
+        created->joined = 1;
+        created->open = 1;
+        created->streamBytes.assign(streams, 0);
+        groups_[key] = created;
+        group = created;
+        index = 0;
+        return TcpJoinResult::CREATED;
+    }
+
+    void finishStream(TcpStreamGroup& group, uint8_t index, uint64_t bytes, uint64_t endNs) {
+        std::lock_guard<std::mutex> lock(mu_);
+        group.streamBytes[index] = bytes;
+        ++group.finished;
+        group.endNs = std::max(group.endNs, endNs);
+        if (index == 0) {
+            group.closed = true;
+        }
+    }
+
+    // Copia consistente para armar el RESULT agregado; ready indica que todos los streams unidos terminaron.
+    TcpStreamGroup snapshot(const TcpStreamGroup& group, bool& ready) {
+        std::lock_guard<std::mutex> lock(mu_);
+        ready = group.closed && group.finished == group.joined;
+        return group;
+    }
+
+    void release(const std::shared_ptr<TcpStreamGroup>& group) {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (--group->open > 0) {
+            return;
+        }
+        auto it = groups_.find(std::make_pair(group->sessionId, group->clientIp));
+        if (it != groups_.end() && it->second == group) {
+            groups_.erase(it);
+        }
+        activeSessions_.fetch_sub(1);
+    }
+
+private:
+    std::mutex mu_;
+    std::map<std::pair<uint32_t, uint32_t>, std::shared_ptr<TcpStreamGroup>> groups_;
+    std::atomic<int>& activeSessions_;
+    int maxSessions_;
+};
+
+enum class TcpConnState : uint8_t {
+    READ_START,
+    SEND_ACK,
+    DOWNLOAD,
+    FINISH_FRAME,
+    UPLOAD,
+    WAIT_STREAMS, // stream 0 de un grupo: espera a los demás antes del RESULT agregado
+    SEND_RESULT,
+    DRAIN_ZEROCOPY,
+    LINGER, // RESULT enviado y SHUT_WR hecho: descarta lo que siga llegando hasta EOF o timeout
+    CLOSING // backend io_uring: cerrada, esperando el CQE del envío en vuelo antes de liberar el fd y el ring
+};
+
+struct TcpConnection {
+    int fd = -1;
+    sockaddr_in client{};
+    TcpConnState state = TcpConnState::READ_START;
+    uint32_t interest = 0;
+    bool registered = true; // en el epoll del worker; con io_uring el download sale del epoll
+    bool sendInflight = false;
+    uint64_t timerNs = 0;
+    std::vector<uint8_t> input; // START_REQ en construcción
+    size_t inputFill = 0;
+    std::vector<uint8_t> output; // START_ACK o RESULT pendiente de escribir
+    size_t outputOffset = 0;
+    uint32_t sessionId = 0;
+    ThroughputDirection direction = ThroughputDirection::DOWNLOAD;
+    bool accepted = false;
+    bool reserved = false; // ocupa un lugar propio en activeSessions (sesión de un solo stream)
+    std::shared_ptr<TcpStreamGroup> group;
+    uint8_t streamIndex = 0;
+    uint32_t durationMs = 0;
+    uint32_t chunkBytes = 0;
+    uint64_t startNs = 0;
+    uint64_t deadlineNs = 0;
+    uint64_t transferredBytes = 0;
+    uint16_t features = 0;
+    TcpSocketRequest socketRequest;
+    std::string congestion; // valores efectivos del socket, leídos después de aplicar el pedido
+    uint32_t sndBuf = 0;
+    uint32_t rcvBuf = 0;
+    uint64_t pacingBps = 0;
+    TcpPacingMode pacingMode = TcpPacingMode::NONE;
+    std::unique_ptr<TcpPacer> pacer;
+    uint64_t pacingWaitNs = 0; // pacing en espacio de usuario: la conexión espera hasta acá sin epoll
+    uint64_t nextSampleNs = 0;
+    std::vector<TcpIntervalSample> samples;
+    TcpSendMode sendMode = TcpSendMode::WRITEV;
+    std::unique_ptr<TcpDownloadRing> ring;
+    std::unique_ptr<TcpDownloadSender> sender;
+    std::vector<uint8_t> copyPayload; // modo copy: un frame nuevo por chunk, como el loop legado
+    std::vector<uint8_t> copyFrame;
+    size_t copyOffset = 0;
+    std::unique_ptr<TcpUploadSink> sink;
+    CpuUsage cpu;
+};
+
+// Event loop TCP: cada worker tiene su epoll y comparte el socket de escucha (EPOLLEXCLUSIVE); las conexiones
+// son no bloqueantes y recorren START_REQ -> START_ACK -> DATA -> RESULT como máquina de estados. Los timeouts
+// de control y el deadline de cada sesión viven en un set ordenado que define el timeout de epoll_wait.
+class TcpWorker {
+public:
+    TcpWorker(int index,
+              int listenFd,
+              const ServerOptions& options,
+              const ServerLinkSnapshot& serverLink,
+              TrafficCounters& counters,
+              JsonLogger& logger,
+              TcpStreamGroups& groups,
+              std::atomic<int>& activeSessions,
+              std::atomic<bool>& running)
+        : index_(index), listenFd_(listenFd), options_(options), serverLink_(serverLink), counters_(counters),
+          logger_(logger), groups_(groups), activeSessions_(activeSessions), running_(running),
+          uploadBuffer_(TCP_UPLOAD_BUFFER_BYTES) {}
+
+    void run() {
+        epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd_ < 0) {
+            perror("epoll TCP");
+            running_.store(false);
+            return;
+        }
+        epoll_event listenEvent{};
+        listenEvent.events = EPOLLIN | EPOLLEXCLUSIVE;
+        listenEvent.data.fd = listenFd_;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenFd_, &listenEvent) < 0) {
+            perror("epoll_ctl TCP listen");
+            running_.store(false);
+            close(epollFd_);
+            return;
+        }
+
+        if (options_.ioBackend == IoBackend::URING) {
+            uring_ = std::make_unique<IoUring>();
+            if (uring_->init(URING_ENTRIES)) {
+                armEpollPoll();
+            } else {
+                std::cerr << "io_uring no disponible en el worker TCP " << index_ << ", se usa epoll" << std::endl;
+                uring_.reset();
+            }
+        }
+
+        epoll_event events[64];
+        std::vector<io_uring_cqe> cqes(uring_ ? URING_ENTRIES * 2 : 0);
+        bool epollPending = false;
+        while (running_.load()) {
+            int ready = 0;
+            uint64_t iterationStartNs = 0;
+            if (uring_) {
+                // El epoll queda anidado en el ring con un poll multishot: el único punto de espera es
+                // io_uring_enter. Como ese poll sólo avisa flancos, mientras epoll devuelva eventos se lo
+                // vuelve a consultar sin bloquear.
+                const uint64_t entersBefore = uring_->enters();
+                uring_->submitAndWait(epollPending ? 0 : 1, epollPending ? 0 : nextTimeoutNs());
+                iterationStartNs = nowNs();
+                const size_t n = uring_->reap(cqes.data(), cqes.size());
+                bool epollReady = epollPending;
+                for (size_t i = 0; i < n; ++i) {
+                    if (uringTagOf(cqes[i]) == UringTag::EPOLL) {
+                        epollReady = true;
+                        if ((cqes[i].flags & IORING_CQE_F_MORE) == 0) {
+                            armEpollPoll();
+                        }
+                    } else if (uringTagOf(cqes[i]) == UringTag::TCP_SEND) {
+                        handleSendCompletion(static_cast<int>(uringValueOf(cqes[i])), cqes[i].res);
+                    }
+                }
+                counters_.uringEnters.fetch_add(uring_->enters() - entersBefore);
+                ready = epollReady ? epoll_wait(epollFd_, events, 64, 0) : 0;
+                epollPending = ready > 0;
+            } else {
+                ready = epoll_wait(epollFd_, events, 64, nextTimeoutMs());
+                iterationStartNs = nowNs();
+            }
+            // El accept va al final del lote: un fd recién cerrado puede reaparecer en accept y recibir
+            // eventos viejos de la conexión anterior.
+            bool acceptPending = false;
+            for (int i = 0; i < ready; ++i) {
+                if (events[i].data.fd == listenFd_) {
+                    acceptPending = true;
+                    continue;
+                }
+                TcpConnection* conn = connectionFor(events[i].data.fd);
+                if (conn != nullptr) {
+                    handleEvent(*conn, events[i].events);
+                }
+            }
+            if (acceptPending) {
+                acceptConnection();
+            }
+            expireTimers();
+            counters_.tcpLoopIteration.observe((nowNs() - iterationStartNs) / 1000ULL);
+        }
+
+        for (auto& conn : connections_) {
+            if (conn) {
+                closeConnection(*conn);
+            }
+        }
+        if (uring_) {
+            // Los envíos en vuelo todavía apuntan a rings de download: se espera su CQE antes de liberarlos.
+            std::vector<io_uring_cqe> tail(URING_ENTRIES * 2);
+            const uint64_t deadlineNs = nowNs() + TCP_CONTROL_TIMEOUT_NS;
+            while (sendsInflight_ > 0 && nowNs() < deadlineNs) {
+                uring_->submitAndWait(1, 100000000LL);
+                const size_t n = uring_->reap(tail.data(), tail.size());
+                for (size_t i = 0; i < n; ++i) {
+                    if (uringTagOf(tail[i]) == UringTag::TCP_SEND) {
+                        handleSendCompletion(static_cast<int>(uringValueOf(tail[i])), tail[i].res);
+                    }
+                }
+            }
+            uring_.reset();
+            for (auto& conn : connections_) {
+                if (conn) {
+                    conn->sendInflight = false;
+                    closeConnection(*conn);
+                }
+            }
+        }
+        close(epollFd_);
+    }
+
+private:
+    TcpConnection* connectionFor(int fd) {
+        if (fd < 0 || static_cast<size_t>(fd) >= connections_.size()) {
+            return nullptr;
+        }
+        return connections_[static_cast<size_t>(fd)].get();
+    }
+
+    // Una conexión por wakeup: con el listen en level-triggered el resto del backlog despierta a otro worker.
+    void acceptConnection() {
+        sockaddr_in client{};
+        socklen_t len = sizeof(client);
+        int clientFd = accept4(listenFd_, reinterpret_cast<sockaddr*>(&client), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientFd < 0) {
+            return;
+        }
+
+        if (static_cast<size_t>(clientFd) >= connections_.size()) {
+            connections_.resize(static_cast<size_t>(clientFd) + 1);
+        }
+        auto conn = std::make_unique<TcpConnection>();
+        conn->fd = clientFd;
+        conn->client = client;
+        conn->input.resize(16);
+        conn->interest = EPOLLIN;
+        epoll_event event{};
+        event.events = conn->interest;
+        event.data.fd = clientFd;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, clientFd, &event) < 0) {
+            close(clientFd);
+            return;
+        }
+        connections_[static_cast<size_t>(clientFd)] = std::move(conn);
+        setTimer(*connections_[static_cast<size_t>(clientFd)], nowNs() + TCP_CONTROL_TIMEOUT_NS);
+    }
+
+    void handleEvent(TcpConnection& conn, uint32_t events) {
+        if (conn.sendInflight) {
+            return;
+        }
+        eventCpuStart_ = cpuMeter_.sample();
+        const int fd = conn.fd;
+        if ((events & EPOLLERR) != 0 && conn.sender) {
+            conn.sender->reapZerocopyCompletions();
+        }
+
+        switch (conn.state) {
+            case TcpConnState::READ_START:
+                readStart(conn);
+                break;
+            case TcpConnState::SEND_ACK:
+            case TcpConnState::SEND_RESULT:
+                flushOutput(conn);
+                break;
+            case TcpConnState::DOWNLOAD:
+            case TcpConnState::FINISH_FRAME:
+                pumpDownload(conn);
+                break;
+            case TcpConnState::UPLOAD:
+                pumpUpload(conn);
+                break;
+            case TcpConnState::DRAIN_ZEROCOPY:
+                if ((events & EPOLLHUP) != 0) {
+                    closeConnection(conn);
+                } else if (!conn.sender->zerocopyPending()) {
+                    lingerClose(conn);
+                }
+                break;
+            case TcpConnState::LINGER:
+                drainLinger(conn);
+                break;
+            case TcpConnState::WAIT_STREAMS:
+            case TcpConnState::CLOSING:
+                break;
+        }
+
+        if (TcpConnection* still = connectionFor(fd)) {
+            cpuMeter_.accumulate(still->cpu, eventCpuStart_);
+        }
+    }
+
+    void readStart(TcpConnection& conn) {
+        while (true) {
+            ssize_t n = recv(conn.fd, conn.input.data() + conn.inputFill, conn.input.size() - conn.inputFill, 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            if (n <= 0) {
+                rejectStart(conn);
+                return;
+            }
+            conn.inputFill += static_cast<size_t>(n);
+            if (conn.inputFill < conn.input.size()) {
+                continue;
+            }
+
+            TcpHeader header{};
+            if (!parseTcpHeader(conn.input.data(), header) || header.type != TcpMessageType::START_REQ ||
+                header.length > TCP_MAX_START_BODY_BYTES) {
+                rejectStart(conn);
+                return;
+            }
+            if (conn.input.size() == 16 && header.length > 0) {
+                conn.input.resize(16 + header.length);
+                continue;
+            }
+            conn.sessionId = header.sessionId;
+            processStart(conn, conn.input.data() + 16, header.length);
+            return;
+        }
+    }
+
+    void rejectStart(TcpConnection& conn) {
+        counters_.tcpRejections[static_cast<size_t>(RejectReason::BAD_REQUEST)].fetch_add(1);
+        LogRecord(logger_, LogLevel::EVENTS, "session_error")
+            .str("transport", "tcp")
+            .addr("client", conn.client)
+            .str("reason", "invalid_start");
+        closeConnection(conn);
+    }
+
+    void processStart(TcpConnection& conn, const uint8_t* body, size_t bodySize) {
+        size_t offset = 0;
+        uint8_t directionRaw = 0;
+        uint8_t requestedStreams = 0; // ex `reserved`: 0/1 es un test de una sola conexión
+        uint16_t features = 0; // ex `reserved16`
+        uint32_t durationMs = 0;
+        uint32_t chunkBytes = 0;
+        if (!readLe<uint8_t>(body, bodySize, offset, directionRaw) ||
+            !readLe<uint8_t>(body, bodySize, offset, requestedStreams) ||
+            !readLe<uint16_t>(body, bodySize, offset, features) ||
+            !readLe<uint32_t>(body, bodySize, offset, durationMs) ||
+            !readLe<uint32_t>(body, bodySize, offset, chunkBytes) ||
+            !parseTcpStartOptions(body, bodySize, offset, conn.socketRequest)) {
+            LogRecord(logger_, LogLevel::EVENTS, "session_error")
+                .str("transport", "tcp")
+                .u64("sessionId", conn.sessionId)
+                .str("reason", "bad_start_payload");
+            counters_.tcpRejections[static_cast<size_t>(RejectReason::BAD_REQUEST)].fetch_add(1);
+            closeConnection(conn);
+            return;
+        }
+
+        if (durationMs < TCP_MIN_DURATION_MS || durationMs > TCP_MAX_DURATION_MS) {
+            durationMs = 12000;
+        }
+        if (chunkBytes < TCP_MIN_CHUNK_BYTES || chunkBytes > TCP_MAX_CHUNK_BYTES) {
+            chunkBytes = TCP_DEFAULT_CHUNK_BYTES;
+        }
+
+        conn.direction = static_cast<ThroughputDirection>(directionRaw);
+        conn.accepted = conn.direction == ThroughputDirection::DOWNLOAD || conn.direction == ThroughputDirection::UPLOAD;
+        conn.durationMs = durationMs;
+        conn.chunkBytes = chunkBytes;
+        conn.features = features & TCP_FEATURE_SERIES;
+        std::vector<uint8_t>().swap(conn.input);
+
+        bool busy = false;
+        bool groupClosed = false;
+        if (conn.accepted && requestedStreams > 1) {
+            const auto streams = static_cast<uint8_t>(std::min<int>(requestedStreams, options_.tcpMaxStreams));
+            const TcpJoinResult join = groups_.join(conn.sessionId, conn.client.sin_addr.s_addr, conn.direction, streams,
+                                                    durationMs, chunkBytes, conn.group, conn.streamIndex);
+            if (join == TcpJoinResult::CREATED || join == TcpJoinResult::JOINED) {
+                // Los streams que se suman heredan duración y chunk del stream 0.
+                conn.durationMs = conn.group->durationMs;
+                conn.chunkBytes = conn.group->chunkBytes;
+            } else {
+                busy = join == TcpJoinResult::BUSY;
+                groupClosed = join == TcpJoinResult::REJECTED;
+                conn.accepted = false;
+            }
+        } else if (conn.accepted) {
+            conn.reserved = tryReserveSession(activeSessions_, options_.maxSessions);
+            busy = !conn.reserved;
+            conn.accepted = conn.reserved;
+        }
+
+        if (!conn.accepted) {
+            const RejectReason reason = busy ? RejectReason::BUSY
+                                      : groupClosed ? RejectReason::GROUP_CLOSED : RejectReason::BAD_REQUEST;
+            counters_.tcpRejections[static_cast<size_t>(reason)].fetch_add(1);
+        }
+        if (busy) {
+            LogRecord(logger_, LogLevel::EVENTS, "session_rejected")
+                .str("transport", "tcp")
+                .u64("sessionId", conn.sessionId)
+                .addr("client", conn.client)
+                .str("reason", "busy");
+            std::vector<uint8_t> busyBody;
+            appendLe<uint32_t>(busyBody, 1000U);
+            conn.output = makeTcpFrame(TcpMessageType::BUSY, 0, busyBody);
+        } else {
+            if (conn.accepted) {
+                applySocketRequest(conn);
+            }
+            std::vector<uint8_t> ackBody;
+            appendLe<uint8_t>(ackBody, static_cast<uint8_t>(conn.accepted ? 1 : 0));
+            appendLe<uint8_t>(ackBody, static_cast<uint8_t>(options_.tcpMaxStreams));
+            appendLe<uint16_t>(ackBody, conn.streamIndex);
+            appendLe<uint32_t>(ackBody, conn.durationMs);
+            appendLe<uint32_t>(ackBody, conn.chunkBytes);
+            appendLe<uint8_t>(ackBody, static_cast<uint8_t>(serverLink_.type));
+            appendLe<uint8_t>(ackBody, 0);
+            appendLe<uint16_t>(ackBody, conn.features);
+            appendLe<uint32_t>(ackBody, serverLink_.downMbps);
+            appendLe<uint32_t>(ackBody, serverLink_.upMbps);
+            if (conn.accepted && conn.socketRequest.present) {
+                appendLe<uint8_t>(ackBody, static_cast<uint8_t>(TcpStartOption::CONGESTION));
+                appendLe<uint8_t>(ackBody, static_cast<uint8_t>(conn.congestion.size()));
+                ackBody.insert(ackBody.end(), conn.congestion.begin(), conn.congestion.end());
+                appendLe<uint8_t>(ackBody, static_cast<uint8_t>(TcpStartOption::SNDBUF));
+                appendLe<uint8_t>(ackBody, sizeof(uint32_t));
+                appendLe<uint32_t>(ackBody, conn.sndBuf);
+                appendLe<uint8_t>(ackBody, static_cast<uint8_t>(TcpStartOption::RCVBUF));
+                appendLe<uint8_t>(ackBody, sizeof(uint32_t));
+                appendLe<uint32_t>(ackBody, conn.rcvBuf);
+                appendLe<uint8_t>(ackBody, static_cast<uint8_t>(TcpStartOption::PACING_RATE));
+                appendLe<uint8_t>(ackBody, sizeof(uint64_t));
+                appendLe<uint64_t>(ackBody, conn.pacingBps);
+            }
+            conn.output = makeTcpFrame(TcpMessageType::START_ACK, conn.sessionId, ackBody);
+        }
+        conn.outputOffset = 0;
+        conn.state = TcpConnState::SEND_ACK;
+        setInterest(conn, EPOLLOUT);
+        setTimer(conn, nowNs() + TCP_CONTROL_TIMEOUT_NS);
+        flushOutput(conn);
+    }
+
+    void flushOutput(TcpConnection& conn) {
+        while (conn.outputOffset < conn.output.size()) {
+            ssize_t n = send(conn.fd,
+                             conn.output.data() + conn.outputOffset,
+                             conn.output.size() - conn.outputOffset,
+                             MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            if (n <= 0) {
+                closeConnection(conn);
+                return;
+            }
+            conn.outputOffset += static_cast<size_t>(n);
+        }
+
+        if (conn.state == TcpConnState::SEND_ACK) {
+            if (conn.accepted) {
+                beginTransfer(conn);
+            } else {
+                closeConnection(conn);
+            }
+            return;
+        }
+
+        if (conn.sender && conn.sender->zerocopyPending()) {
+            conn.state = TcpConnState::DRAIN_ZEROCOPY;
+            setInterest(conn, 0);
+            setTimer(conn, nowNs() + TCP_ZEROCOPY_DRAIN_NS);
+            return;
+        }
+        lingerClose(conn);
+    }
+
+    // Cerrar con datos sin leer hace que el kernel mande RST, y el RST puede descartar el RESULT que el cliente
+    // todavía no leyó (típico en un upload que sigue enviando cuando vence el deadline). Se cierra sólo la
+    // escritura y se drena la entrada hasta que el cliente cierre o venza el timeout de control.
+    void lingerClose(TcpConnection& conn) {
+        if (shutdown(conn.fd, SHUT_WR) != 0) {
+            closeConnection(conn);
+            return;
+        }
+        conn.state = TcpConnState::LINGER;
+        setInterest(conn, EPOLLIN);
+        setTimer(conn, nowNs() + TCP_CONTROL_TIMEOUT_NS);
+        drainLinger(conn);
+    }
+
+    // Como en pumpUpload, a lo sumo TCP_SEND_BURST lecturas por wakeup: un cliente que sigue subiendo no retiene
+    // al worker y el timer de control llega a vencer. El epoll es level-triggered, el resto sale en otra vuelta.
+    void drainLinger(TcpConnection& conn) {
+        for (int burst = 0; burst < TCP_SEND_BURST; ++burst) {
+            const ssize_t n = recv(conn.fd, uploadBuffer_.data(), uploadBuffer_.size(), 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            if (n <= 0) {
+                closeConnection(conn);
+                return;
+            }
+        }
+    }
+
+    // El algoritmo sólo se aplica si está en --tcp-cc-allow y los buffers se recortan a --tcp-max-buffer; lo
+    // efectivo se relee del socket (el kernel duplica SO_SNDBUF/SO_RCVBUF y los limita por wmem_max/rmem_max).
+    void applySocketRequest(TcpConnection& conn) {
+        const TcpSocketRequest& request = conn.socketRequest;
+        if (!request.congestion.empty() &&
+            std::find(options_.tcpCcAllow.begin(), options_.tcpCcAllow.end(), request.congestion) !=
+                options_.tcpCcAllow.end()) {
+            setsockopt(conn.fd, IPPROTO_TCP, TCP_CONGESTION, request.congestion.data(),
+                       static_cast<socklen_t>(request.congestion.size()));
+        }
+        if (request.sndBuf != 0) {
+            const int bytes = static_cast<int>(
+                std::min(std::max(request.sndBuf, TCP_MIN_SOCKET_BUFFER_BYTES), options_.tcpMaxBufferBytes));
+            setsockopt(conn.fd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes));
+        }
+        if (request.rcvBuf != 0) {
+            const int bytes = static_cast<int>(
+                std::min(std::max(request.rcvBuf, TCP_MIN_SOCKET_BUFFER_BYTES), options_.tcpMaxBufferBytes));
+            setsockopt(conn.fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+        }
+
+        if (request.pacingBps != 0 && conn.direction == ThroughputDirection::DOWNLOAD) {
+            // Acotada también arriba: el GCRA multiplica ns por bytes/s y una tasa arbitraria lo desbordaría.
+            conn.pacingBps = std::min(std::max(request.pacingBps, TCP_MIN_PACING_BPS), TCP_MAX_PACING_BPS);
+            const uint64_t bytesPerSec = conn.pacingBps / 8;
+            conn.pacingMode = TcpPacingMode::USER;
+            if (options_.tcpPacing == TcpPacingMode::KERNEL) {
+                const auto rate = static_cast<uint32_t>(bytesPerSec);
+                if (setsockopt(conn.fd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate)) == 0) {
+                    conn.pacingMode = TcpPacingMode::KERNEL;
+                    // Lo escrito y no enviado queda acotado a ~10 ms de tasa: los bytes contados siguen al cable.
+                    const int lowat = static_cast<int>(
+                        std::max<uint64_t>(2ULL * (conn.chunkBytes + 16), std::min<uint64_t>(bytesPerSec / 100, INT32_MAX)));
+                    setsockopt(conn.fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+                }
+            }
+        }
+
+        char name[TCP_CC_NAME_MAX + 1] = {};
+        socklen_t nameLen = sizeof(name);
+        if (getsockopt(conn.fd, IPPROTO_TCP, TCP_CONGESTION, name, &nameLen) == 0) {
+            conn.congestion.assign(name, strnlen(name, sizeof(name)));
+        }
+        int bytes = 0;
+        socklen_t len = sizeof(bytes);
+        if (getsockopt(conn.fd, SOL_SOCKET, SO_SNDBUF, &bytes, &len) == 0) {
+            conn.sndBuf = static_cast<uint32_t>(bytes);
+        }
+        len = sizeof(bytes);
+        if (getsockopt(conn.fd, SOL_SOCKET, SO_RCVBUF, &bytes, &len) == 0) {
+            conn.rcvBuf = static_cast<uint32_t>(bytes);
+        }
+    }
+
+    static void logSocketFields(LogRecord& record, const TcpConnection& conn) {
+        const TcpSocketRequest& request = conn.socketRequest;
+        record.str("cc", conn.congestion).u64("sndBuf", conn.sndBuf).u64("rcvBuf", conn.rcvBuf);
+        if (!request.congestion.empty()) {
+            record.str("ccRequested", request.congestion);
+        }
+        if (request.sndBuf != 0) {
+            record.u64("sndBufRequested", request.sndBuf);
+        }
+        if (request.rcvBuf != 0) {
+            record.u64("rcvBufRequested", request.rcvBuf);
+        }
+        if (conn.pacingMode != TcpPacingMode::NONE) {
+            record.str("pacing", tcpPacingModeToString(conn.pacingMode)).u64("targetBps", conn.pacingBps);
+        }
+    }
+
+    void beginTransfer(TcpConnection& conn) {
+        {
+            LogRecord record(logger_, LogLevel::SUMMARY, "session_start");
+            record.str("transport", "tcp")
+                .u64("sessionId", conn.sessionId)
+                .addr("client", conn.client)
+                .str("direction", conn.direction == ThroughputDirection::DOWNLOAD ? "download" : "upload")
+                .u64("durationMs", conn.durationMs)
+                .u64("chunkBytes", conn.chunkBytes)
+                .i64("worker", index_);
+            logStreamFields(record, conn);
+            logSocketFields(record, conn);
+            record.str("serverIface", serverLink_.iface)
+                .str("serverLinkType", serverLinkTypeToString(serverLink_.type))
+                .u64("serverLinkDownMbps", serverLink_.downMbps)
+                .u64("serverLinkUpMbps", serverLink_.upMbps);
+        }
+
+        conn.startNs = nowNs();
+        conn.deadlineNs = conn.group ? conn.group->deadlineNs
+                                     : conn.startNs + static_cast<uint64_t>(conn.durationMs) * 1000000ULL;
+        conn.sendMode = options_.tcpSendMode;
+        std::vector<uint8_t>().swap(conn.output);
+        // Muestreo por timer del worker, fuera del loop de DATA; la reserva evita crecer durante el test.
+        conn.samples.reserve((conn.deadlineNs - conn.startNs) / TCP_SAMPLE_INTERVAL_NS + 2);
+        conn.nextSampleNs = conn.startNs + TCP_SAMPLE_INTERVAL_NS;
+
+        if (conn.direction == ThroughputDirection::DOWNLOAD) {
+            if (conn.sendMode == TcpSendMode::COPY) {
+                conn.copyPayload.resize(conn.chunkBytes);
+                const uint8_t seed = static_cast<uint8_t>(conn.sessionId & 0xFF);
+                for (uint32_t i = 0; i < conn.chunkBytes; ++i) {
+                    conn.copyPayload[i] = static_cast<uint8_t>(seed + i);
+                }
+                conn.copyFrame = makeTcpFrame(TcpMessageType::DATA, conn.sessionId, conn.copyPayload);
+            } else {
+                // Con io_uring los envíos son SENDMSG comunes: MSG_ZEROCOPY no aplica a ese camino.
+                const TcpSendMode mode = uring_ && conn.sendMode == TcpSendMode::ZEROCOPY ? TcpSendMode::WRITEV : conn.sendMode;
+                conn.ring = std::make_unique<TcpDownloadRing>(conn.sessionId, conn.chunkBytes);
+                conn.sender = std::make_unique<TcpDownloadSender>(conn.fd, *conn.ring, mode);
+                conn.sendMode = conn.sender->mode();
+            }
+            if (conn.pacingMode == TcpPacingMode::USER) {
+                conn.pacer = std::make_unique<TcpPacer>(conn.pacingBps / 8, conn.chunkBytes + 16, conn.startNs);
+            }
+            conn.state = TcpConnState::DOWNLOAD;
+            setTransferTimer(conn);
+            if (uring_ && conn.sender) {
+                detachFromEpoll(conn);
+                submitDownload(conn);
+                return;
+            }
+            setInterest(conn, EPOLLOUT);
+        } else {
+            conn.sink = std::make_unique<TcpUploadSink>(conn.sessionId);
+            conn.state = TcpConnState::UPLOAD;
+            setInterest(conn, EPOLLIN);
+            setTransferTimer(conn);
+        }
+    }
+
+    void setTransferTimer(TcpConnection& conn) {
+        uint64_t atNs = std::min(conn.deadlineNs, conn.nextSampleNs);
+        if (conn.pacingWaitNs != 0) {
+            atNs = std::min(atNs, conn.pacingWaitNs);
+        }
+        setTimer(conn, atNs);
+    }
+
+    // El timer de la transferencia es el primero entre muestra, fin del pacing y deadline; devuelve true si no
+    // venció ni el deadline ni la espera de pacing (sólo había que muestrear).
+    bool onlySampleDue(TcpConnection& conn, uint64_t now) {
+        if (now >= conn.nextSampleNs && now < conn.deadlineNs) {
+            conn.samples.push_back(sampleTcpInfo(conn.fd, now - conn.startNs, conn.transferredBytes));
+            conn.nextSampleNs += TCP_SAMPLE_INTERVAL_NS;
+            if (conn.nextSampleNs <= now) {
+                conn.nextSampleNs = now + TCP_SAMPLE_INTERVAL_NS;
+            }
+        }
+        if (now >= conn.deadlineNs || !running_.load() || (conn.pacingWaitNs != 0 && now >= conn.pacingWaitNs)) {
+            conn.pacingWaitNs = 0;
+            setTransferTimer(conn);
+            return false;
+        }
+        setTransferTimer(conn);
+        return true;
+    }
+
+    // Sin lugar en el token bucket: la conexión sale del epoll hasta que su timer marque el próximo frame.
+    bool pacingPaused(TcpConnection& conn, size_t& budget) {
+        budget = conn.pacer->budget(nowNs());
+        if (budget > 0) {
+            return false;
         }
-        if ((arg == "-t" || arg == "--tick") && i + 1 < argc) {
-            options.tickOverrideMs = std::atoi(argv[++i]);
-            continue;
+        conn.pacingWaitNs = conn.pacer->resumeNs();
+        detachFromEpoll(conn);
+        setTransferTimer(conn);
+        return true;
+    }
+
+    bool downloadFrameAligned(const TcpConnection& conn) const {
+        return conn.sender ? conn.sender->frameAligned() : conn.copyOffset == 0;
+    }
+
+    TcpIoStatus sendCopyFrame(TcpConnection& conn) {
+        const ssize_t n = send(conn.fd,
+                         conn.copyFrame.data() + conn.copyOffset,
+                         conn.copyFrame.size() - conn.copyOffset,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                return TcpIoStatus::PROGRESS;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? TcpIoStatus::WOULD_BLOCK : TcpIoStatus::FAILED;
         }
-        if (arg == "--max-sessions" && i + 1 < argc) {
-            options.maxSessions = std::atoi(argv[++i]);
-            continue;
+        conn.copyOffset += static_cast<size_t>(n);
+        if (conn.pacer) {
+            conn.pacer->consume(static_cast<uint64_t>(n));
         }
-        if (arg == "--log-dir" && i + 1 < argc) {
-            options.logDir = argv[++i];
-            continue;
+        if (conn.copyOffset == conn.copyFrame.size()) {
+            conn.copyOffset = 0;
+            conn.transferredBytes += conn.copyPayload.size();
+            counters_.tcpBytesOut.fetch_add(conn.copyPayload.size());
+            conn.copyFrame = makeTcpFrame(TcpMessageType::DATA, conn.sessionId, conn.copyPayload);
+        }
+        return TcpIoStatus::PROGRESS;
+    }
+
+    void pumpDownload(TcpConnection& conn) {
+        for (int burst = 0; burst < TCP_SEND_BURST; ++burst) {
+            if (conn.state == TcpConnState::DOWNLOAD && (nowNs() >= conn.deadlineNs || !running_.load())) {
+                // El RESULT tiene que caer en un límite de frame: se completa el DATA que quedó a medias.
+                conn.state = TcpConnState::FINISH_FRAME;
+                setTimer(conn, nowNs() + TCP_CONTROL_TIMEOUT_NS);
+            }
+            const bool finishing = conn.state == TcpConnState::FINISH_FRAME;
+            if (finishing && downloadFrameAligned(conn)) {
+                finishTransfer(conn, true);
+                return;
+            }
+
+            size_t budget = SIZE_MAX;
+            if (conn.pacer && !finishing && pacingPaused(conn, budget)) {
+                return;
+            }
+
+            TcpIoStatus status = TcpIoStatus::PROGRESS;
+            if (conn.sender) {
+                const uint64_t before = conn.sender->streamBytes();
+                status = conn.sender->sendOnce(finishing, budget);
+                if (conn.pacer) {
+                    conn.pacer->consume(conn.sender->streamBytes() - before);
+                }
+                const uint64_t sent = conn.sender->payloadBytes();
+                counters_.tcpBytesOut.fetch_add(sent - conn.transferredBytes);
+                conn.transferredBytes = sent;
+            } else {
+                status = sendCopyFrame(conn);
+            }
+            if (status == TcpIoStatus::FAILED) {
+                finishTransfer(conn, false);
+                return;
+            }
+            if (status == TcpIoStatus::WOULD_BLOCK) {
+                return;
+            }
+        }
+    }
+
+    // Backend io_uring: un SENDMSG en vuelo por conexión; cada CQE avanza el stream y encola el siguiente.
+    void submitDownload(TcpConnection& conn) {
+        if (conn.state == TcpConnState::DOWNLOAD && (nowNs() >= conn.deadlineNs || !running_.load())) {
+            conn.state = TcpConnState::FINISH_FRAME;
+            setTimer(conn, nowNs() + TCP_CONTROL_TIMEOUT_NS);
+        }
+        const bool finishing = conn.state == TcpConnState::FINISH_FRAME;
+        if (finishing && conn.sender->frameAligned()) {
+            finishTransfer(conn, true);
+            return;
+        }
+        size_t budget = SIZE_MAX;
+        if (conn.pacer && !finishing && pacingPaused(conn, budget)) {
+            return;
+        }
+        if (!conn.sender->queueUring(*uring_, uringUserData(UringTag::TCP_SEND, static_cast<uint32_t>(conn.fd)), finishing, budget)) {
+            finishTransfer(conn, false);
+            return;
+        }
+        conn.sendInflight = true;
+        ++sendsInflight_;
+    }
+
+    void handleSendCompletion(int fd, int result) {
+        TcpConnection* conn = connectionFor(fd);
+        if (conn == nullptr || !conn->sendInflight) {
+            return;
+        }
+        eventCpuStart_ = cpuMeter_.sample();
+        conn->sendInflight = false;
+        --sendsInflight_;
+        if (conn->state == TcpConnState::CLOSING) {
+            closeConnection(*conn);
+            return;
+        }
+
+        const uint64_t before = conn->sender->streamBytes();
+        const TcpIoStatus status = conn->sender->completeUring(result);
+        if (conn->pacer) {
+            conn->pacer->consume(conn->sender->streamBytes() - before);
+        }
+        const uint64_t sent = conn->sender->payloadBytes();
+        counters_.tcpBytesOut.fetch_add(sent - conn->transferredBytes);
+        conn->transferredBytes = sent;
+        if (status == TcpIoStatus::FAILED) {
+            finishTransfer(*conn, false);
+        } else {
+            submitDownload(*conn);
+        }
+        if (TcpConnection* still = connectionFor(fd)) {
+            cpuMeter_.accumulate(still->cpu, eventCpuStart_);
+        }
+    }
+
+    void armEpollPoll() {
+        io_uring_sqe* sqe = uring_->nextSqe();
+        if (sqe == nullptr) {
+            return;
+        }
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = epollFd_;
+        sqe->poll32_events = EPOLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = uringUserData(UringTag::EPOLL, 0);
+    }
+
+    void pumpUpload(TcpConnection& conn) {
+        for (int burst = 0; burst < TCP_SEND_BURST; ++burst) {
+            ssize_t n = recv(conn.fd, uploadBuffer_.data(), uploadBuffer_.size(), 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (n <= 0) {
+                finishTransfer(conn, true);
+                return;
+            }
+            conn.sink->consume(uploadBuffer_.data(), static_cast<size_t>(n));
+            counters_.tcpBytesIn.fetch_add(conn.sink->payloadBytes() - conn.transferredBytes);
+            conn.transferredBytes = conn.sink->payloadBytes();
+            if (conn.sink->stopped()) {
+                finishTransfer(conn, true);
+                return;
+            }
+        }
+        if (nowNs() >= conn.deadlineNs || !running_.load()) {
+            finishTransfer(conn, true);
+        }
+    }
+
+    // sendResult es false cuando el stream de download quedó cortado a mitad de un frame: ya no se puede
+    // enmarcar un RESULT válido.
+    void finishTransfer(TcpConnection& conn, bool sendResult) {
+        const uint64_t endNs = nowNs();
+        const uint64_t durationNs = endNs > conn.startNs ? (endNs - conn.startNs) : 1ULL;
+        if (!conn.group) {
+            counters_.tcpSessionDuration.observe(durationNs / 1000ULL); // los grupos cuentan una vez, al cerrar
+        }
+        cpuMeter_.accumulate(conn.cpu, eventCpuStart_);
+        eventCpuStart_ = cpuMeter_.sample();
+        conn.samples.push_back(sampleTcpInfo(conn.fd, endNs - conn.startNs, conn.transferredBytes));
+        TcpPacingStats pacing;
+        if (conn.pacingMode != TcpPacingMode::NONE) {
+            pacing = computePacingStats(conn.samples, conn.pacingBps, conn.transferredBytes, durationNs);
+        }
+
+        {
+            LogRecord record(logger_, LogLevel::SUMMARY, "session_end");
+            record.str("transport", "tcp")
+                .u64("sessionId", conn.sessionId)
+                .addr("client", conn.client)
+                .u64("bytes", conn.transferredBytes)
+                .u64("durationNs", durationNs)
+                .i64("worker", index_);
+            logStreamFields(record, conn);
+            if (conn.direction == ThroughputDirection::DOWNLOAD) {
+                record.str("sendMode", tcpSendModeToString(conn.sendMode));
+            } else {
+                record.u64("resyncBytes", conn.sink->resyncBytes());
+            }
+            logCpuEfficiency(record, conn.cpu, conn.transferredBytes);
+            if (conn.pacingMode != TcpPacingMode::NONE) {
+                record.str("pacing", tcpPacingModeToString(conn.pacingMode))
+                    .u64("targetBps", conn.pacingBps)
+                    .u64("achievedBps", pacing.achievedBps)
+                    .u64("intervalRmsErrorBps", pacing.intervalRmsErrorBps)
+                    .u64("intervals", pacing.intervals)
+                    .u64("intervalsWithin10Pct", pacing.intervalsWithin10Pct);
+            }
+            logIntervalSeries(record, conn.samples);
+        }
+
+        if (conn.group) {
+            // Sólo el stream 0 devuelve RESULT (el agregado); el resto cierra al terminar su parte.
+            groups_.finishStream(*conn.group, conn.streamIndex, conn.transferredBytes, endNs);
+            if (conn.streamIndex != 0 || !sendResult) {
+                closeConnection(conn);
+                return;
+            }
+            conn.state = TcpConnState::WAIT_STREAMS;
+            detachFromEpoll(conn);
+            checkStreams(conn);
+            return;
+        }
+
+        if (!sendResult) {
+            closeConnection(conn);
+            return;
+        }
+        std::vector<uint8_t> resultBody;
+        appendLe<uint64_t>(resultBody, conn.transferredBytes);
+        appendLe<uint64_t>(resultBody, durationNs);
+        if (conn.pacingMode != TcpPacingMode::NONE) {
+            appendLe<uint64_t>(resultBody, conn.pacingBps);
+            appendLe<uint64_t>(resultBody, pacing.achievedBps);
+            appendLe<uint64_t>(resultBody, pacing.intervalRmsErrorBps);
+            appendLe<uint16_t>(resultBody, pacing.intervals);
+            appendLe<uint16_t>(resultBody, pacing.intervalsWithin10Pct);
+            appendLe<uint8_t>(resultBody, static_cast<uint8_t>(conn.pacingMode));
+            appendLe<uint8_t>(resultBody, 0);
+            appendLe<uint16_t>(resultBody, 0);
+        }
+        sendResultFrame(conn, resultBody);
+    }
+
+    void sendResultFrame(TcpConnection& conn, const std::vector<uint8_t>& resultBody) {
+        conn.output.clear();
+        if ((conn.features & TCP_FEATURE_SERIES) != 0) {
+            conn.output = makeTcpFrame(TcpMessageType::RESULT_SERIES, conn.sessionId, intervalSeriesBody(conn.samples));
+        }
+        const std::vector<uint8_t> result = makeTcpFrame(TcpMessageType::RESULT, conn.sessionId, resultBody);
+        conn.output.insert(conn.output.end(), result.begin(), result.end());
+        conn.outputOffset = 0;
+        conn.state = TcpConnState::SEND_RESULT;
+        setInterest(conn, EPOLLOUT);
+        setTimer(conn, nowNs() + TCP_CONTROL_TIMEOUT_NS);
+        flushOutput(conn);
+    }
+
+    // RESULT agregado: total, duración del grupo, cantidad de streams y los bytes de cada uno. Si algún stream
+    // unido no termina, se manda igual pasado el deadline del grupo más un margen.
+    void checkStreams(TcpConnection& conn) {
+        bool ready = false;
+        const TcpStreamGroup group = groups_.snapshot(*conn.group, ready);
+        const uint64_t now = nowNs();
+        if (!ready && now < group.deadlineNs + 2 * TCP_CONTROL_TIMEOUT_NS) {
+            setTimer(conn, now + TCP_STREAM_WAIT_NS);
+            return;
         }
-        if (arg == "--log-level" && i + 1 < argc) {
-            options.logLevel = parseLogLevel(argv[++i]);
-            continue;
+
+        uint64_t totalBytes = 0;
+        for (uint64_t bytes : group.streamBytes) {
+            totalBytes += bytes;
+        }
+        const uint64_t endNs = ready ? group.endNs : now;
+        const uint64_t durationNs = endNs > group.startNs ? (endNs - group.startNs) : 1ULL;
+        counters_.tcpSessionDuration.observe(durationNs / 1000ULL);
+
+        std::vector<uint8_t> resultBody;
+        appendLe<uint64_t>(resultBody, totalBytes);
+        appendLe<uint64_t>(resultBody, durationNs);
+        appendLe<uint32_t>(resultBody, static_cast<uint32_t>(group.streamBytes.size()));
+        for (uint64_t bytes : group.streamBytes) {
+            appendLe<uint64_t>(resultBody, bytes);
         }
 
-        std::cerr << "Opción inválida: " << arg << std::endl;
-        printHelp(argv[0]);
-        return false;
+        LogRecord(logger_, LogLevel::SUMMARY, "session_group_end")
+            .str("transport", "tcp")
+            .u64("sessionId", conn.sessionId)
+            .addr("client", conn.client)
+            .str("direction", group.direction == ThroughputDirection::DOWNLOAD ? "download" : "upload")
+            .u64("streams", group.streams)
+            .u64("joined", group.joined)
+            .u64("bytes", totalBytes)
+            .u64("durationNs", durationNs)
+            .u64Array("streamBytes", group.streamBytes.data(), group.streamBytes.size());
+        sendResultFrame(conn, resultBody);
     }
 
-    if (options.port <= 0 || options.port > 65535) {
-        std::cerr << "Puerto inválido" << std::endl;
-        return false;
-    }
-    if (options.maxSessions <= 0) {
-        std::cerr << "--max-sessions debe ser > 0" << std::endl;
-        return false;
+    static void logStreamFields(LogRecord& record, const TcpConnection& conn) {
+        if (conn.group) {
+            record.u64("stream", conn.streamIndex).u64("streams", conn.group->streams);
+        }
     }
-    return true;
-}
 
-int createUdpSocket(int port) {
-    int fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0) {
-        perror("socket UDP");
-        return -1;
+    void expireTimers() {
+        const uint64_t now = nowNs();
+        while (!timers_.empty() && timers_.begin()->first <= now) {
+            TcpConnection* conn = connectionFor(timers_.begin()->second);
+            timers_.erase(timers_.begin());
+            if (conn == nullptr) {
+                continue;
+            }
+            conn->timerNs = 0;
+            eventCpuStart_ = cpuMeter_.sample();
+            switch (conn->state) {
+                case TcpConnState::READ_START:
+                    rejectStart(*conn);
+                    break;
+                case TcpConnState::DOWNLOAD:
+                    if (onlySampleDue(*conn, now)) {
+                        break;
+                    }
+                    if (conn->sendInflight) {
+                        // El CQE pendiente ve FINISH_FRAME y completa el frame.
+                        conn->state = TcpConnState::FINISH_FRAME;
+                        setTimer(*conn, now + TCP_CONTROL_TIMEOUT_NS);
+                    } else if (uring_ && conn->sender) {
+                        submitDownload(*conn);
+                    } else {
+                        setInterest(*conn, EPOLLOUT);
+                        pumpDownload(*conn);
+                    }
+                    break;
+                case TcpConnState::FINISH_FRAME:
+                    finishTransfer(*conn, false);
+                    break;
+                case TcpConnState::UPLOAD:
+                    if (!onlySampleDue(*conn, now)) {
+                        finishTransfer(*conn, true);
+                    }
+                    break;
+                case TcpConnState::SEND_ACK:
+                case TcpConnState::SEND_RESULT:
+                case TcpConnState::DRAIN_ZEROCOPY:
+                case TcpConnState::LINGER:
+                    closeConnection(*conn);
+                    break;
+                case TcpConnState::WAIT_STREAMS:
+                    checkStreams(*conn);
+                    break;
+                case TcpConnState::CLOSING:
+                    break;
+            }
+        }
     }
 
-    int yes = 1;
-    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
-
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(static_cast<uint16_t>(port));
-
-    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
-        perror("bind UDP");
-        close(fd);
-        return -1;
+    int64_t nextTimeoutNs() const {
+        if (timers_.empty()) {
+            return 1000000000LL;
+        }
+        const uint64_t now = nowNs();
+        const uint64_t next = timers_.begin()->first;
+        return next <= now ? 0 : static_cast<int64_t>(std::min<uint64_t>(next - now, 1000000000ULL));
     }
 
-    int flags = fcntl(fd, F_GETFL, 0);
-    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-    return fd;
-}
-
-int createTcpSocket(int port) {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) {
-        perror("socket TCP");
-        return -1;
+    int nextTimeoutMs() const {
+        if (timers_.empty()) {
+            return 1000;
+        }
+        const uint64_t now = nowNs();
+        const uint64_t next = timers_.begin()->first;
+        if (next <= now) {
+            return 0;
+        }
+        return static_cast<int>(std::min<uint64_t>((next - now + 999999ULL) / 1000000ULL, 1000ULL));
     }
 
-    int yes = 1;
-    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    void setTimer(TcpConnection& conn, uint64_t atNs) {
+        if (conn.timerNs != 0) {
+            timers_.erase({conn.timerNs, conn.fd});
+        }
+        conn.timerNs = atNs;
+        timers_.insert({atNs, conn.fd});
+    }
 
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(static_cast<uint16_t>(port));
+    void setInterest(TcpConnection& conn, uint32_t events) {
+        if (conn.registered && conn.interest == events) {
+            return;
+        }
+        conn.interest = events;
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = conn.fd;
+        epoll_ctl(epollFd_, conn.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, conn.fd, &event);
+        conn.registered = true;
+    }
 
-    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
-        perror("bind TCP");
-        close(fd);
-        return -1;
+    void detachFromEpoll(TcpConnection& conn) {
+        if (conn.registered) {
+            epoll_ctl(epollFd_, EPOLL_CTL_DEL, conn.fd, nullptr);
+            conn.registered = false;
+        }
     }
 
-    if (listen(fd, 128) < 0) {
-        perror("listen TCP");
+    // Con zerocopy pendiente sólo se llega acá si la conexión dejó de avanzar: las páginas del ring siguen
+    // fijadas por el kernel, así que liberarlo no corrompe memoria; a lo sumo viajan bytes basura.
+    void closeConnection(TcpConnection& conn) {
+        const int fd = conn.fd;
+        if (conn.timerNs != 0) {
+            timers_.erase({conn.timerNs, fd});
+            conn.timerNs = 0;
+        }
+        if (conn.sendInflight) {
+            // El fd no se cierra hasta el CQE: su número identifica al envío y no puede reutilizarse antes.
+            if (conn.state != TcpConnState::CLOSING) {
+                conn.state = TcpConnState::CLOSING;
+                detachFromEpoll(conn);
+                shutdown(fd, SHUT_RDWR);
+                if (io_uring_sqe* sqe = uring_->nextSqe()) {
+                    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                    sqe->addr = uringUserData(UringTag::TCP_SEND, static_cast<uint32_t>(fd));
+                    sqe->user_data = uringUserData(UringTag::CANCEL, static_cast<uint32_t>(fd));
+                }
+            }
+            return;
+        }
+        if (conn.group) {
+            groups_.release(conn.group);
+        } else if (conn.reserved) {
+            activeSessions_.fetch_sub(1);
+        }
+        connections_[static_cast<size_t>(fd)].reset();
         close(fd);
-        return -1;
     }
 
-    return fd;
-}
+    int index_;
+    int listenFd_;
+    int epollFd_ = -1;
+    const ServerOptions& options_;
+    const ServerLinkSnapshot& serverLink_;
+    TrafficCounters& counters_;
+    JsonLogger& logger_;
+    TcpStreamGroups& groups_;
+    std::atomic<int>& activeSessions_;
+    std::atomic<bool>& running_;
+    std::vector<uint8_t> uploadBuffer_; // compartido por todas las sesiones de upload del worker
+    std::vector<std::unique_ptr<TcpConnection>> connections_; // indexado por fd
+    std::set<std::pair<uint64_t, int>> timers_;
+    const ThreadCpuMeter cpuMeter_;
+    CpuUsage eventCpuStart_;
+    std::unique_ptr<IoUring> uring_;
+    size_t sendsInflight_ = 0;
+};
 
-std::string safeSessionTag(uint32_t sessionId, const sockaddr_in& client) {
-    std::ostringstream oss;
-    oss << sessionId << "@" << addrToString(client);
-    return oss.str();
+// SIGINT/SIGTERM sólo bajan la bandera: los workers salen en su próxima vuelta (<= 1 s) y el logger
+// asíncrono vacía su buffer antes de terminar.
+std::atomic<bool>* gRunning = nullptr;
+
+void handleStopSignal(int) {
+    if (gRunning != nullptr) {
+        gRunning->store(false);
+    }
 }
 
 } // namespace
@@ -741,53 +4902,85 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
-    int udpFd = createUdpSocket(options.port);
-    if (udpFd < 0) {
-        return 1;
+    // Todos los sockets del grupo SO_REUSEPORT se crean antes de recibir tráfico: el kernel reparte por hash
+    // de 4-tupla, así que un mismo cliente siempre cae en el mismo worker mientras el grupo no cambie.
+    std::vector<int> udpFds;
+    for (int i = 0; i < options.udpWorkers; ++i) {
+        int fd = createUdpSocket(options.port, options.udpWorkers > 1, options.kernelTimestamps);
+        if (fd < 0) {
+            for (int open : udpFds) {
+                close(open);
+            }
+            return 1;
+        }
+        udpFds.push_back(fd);
     }
     int tcpFd = createTcpSocket(options.port);
     if (tcpFd < 0) {
-        close(udpFd);
+        for (int fd : udpFds) {
+            close(fd);
+        }
         return 1;
     }
+    int metricsFd = -1;
+    if (options.metricsPort > 0) {
+        metricsFd = createMetricsSocket(options.metricsBind, options.metricsPort);
+        if (metricsFd < 0) {
+            close(tcpFd);
+            for (int fd : udpFds) {
+                close(fd);
+            }
+            return 1;
+        }
+    }
+
+    if (options.ioBackend == IoBackend::URING && !IoUring::supported()) {
+        std::cerr << "io_uring no soportado por el kernel, se usa epoll" << std::endl;
+        options.ioBackend = IoBackend::EPOLL;
+    }
 
     std::atomic<bool> running{true};
+    gRunning = &running;
+    struct sigaction stopAction {};
+    stopAction.sa_handler = handleStopSignal;
+    sigemptyset(&stopAction.sa_mask);
+    sigaction(SIGINT, &stopAction, nullptr);
+    sigaction(SIGTERM, &stopAction, nullptr);
     std::atomic<int> activeSessions{0};
     TrafficCounters counters;
-    JsonLogger logger(options.logDir, options.logLevel);
+    for (int i = 0; i < options.udpWorkers; ++i) {
+        counters.udpWorkers.push_back(std::make_unique<UdpWorkerCounters>());
+    }
+    JsonLogger logger(options.logDir, options.logLevel, options.logFormat);
     const ServerLinkSnapshot serverLink = detectServerLinkSnapshot();
 
-    std::mutex udpMutex;
-    std::unordered_map<UdpSessionKey, UdpSession, UdpSessionKeyHash> udpSessions;
-
-    logger.log(LogLevel::SUMMARY,
-               "server_start",
-               "\"port\":" + std::to_string(options.port) +
-                   ",\"tickOverrideMs\":" + std::to_string(options.tickOverrideMs) +
-                   ",\"maxSessions\":" + std::to_string(options.maxSessions) +
-                   ",\"serverIface\":\"" + jsonEscape(serverLink.iface) + "\"" +
-                   ",\"serverLinkType\":\"" + jsonEscape(serverLinkTypeToString(serverLink.type)) + "\"" +
-                   ",\"serverLinkDownMbps\":" + std::to_string(serverLink.downMbps) +
-                   ",\"serverLinkUpMbps\":" + std::to_string(serverLink.upMbps));
-
-    auto removeUdpSession = [&](const UdpSessionKey& key, const char* reason) {
-        std::lock_guard<std::mutex> lock(udpMutex);
-        auto it = udpSessions.find(key);
-        if (it == udpSessions.end()) {
-            return;
-        }
-
-        logger.log(LogLevel::SUMMARY,
-                   "session_end",
-                   "\"transport\":\"udp\",\"session\":\"" + jsonEscape(safeSessionTag(it->second.sessionId, it->second.client)) +
-                       "\",\"reason\":\"" + jsonEscape(reason) + "\",\"expectedCount\":" + std::to_string(it->second.expectedCount) +
-                       ",\"upReceived\":" + std::to_string(it->second.upReceivedCount) +
-                       ",\"downSent\":" + std::to_string(it->second.downSentCount) +
-                       ",\"upOutOfOrder\":" + std::to_string(it->second.upOutOfOrderCount));
-
-        udpSessions.erase(it);
-        activeSessions.fetch_sub(1);
-    };
+    LogRecord(logger, LogLevel::SUMMARY, "server_start")
+        .i64("port", options.port)
+        .i64("tickOverrideMs", options.tickOverrideMs)
+        .i64("maxSessions", options.maxSessions)
+        .i64("udpWorkers", options.udpWorkers)
+        .u64("udpSessionSlots", udpWorkerSessionCapacity(options))
+        .u64("udpSessionSlabBytes",
+             static_cast<uint64_t>(options.udpWorkers) * udpWorkerSessionCapacity(options) * sizeof(UdpSession))
+        .i64("tcpWorkers", options.tcpWorkers)
+        .boolean("kernelTimestamps", options.kernelTimestamps)
+        .str("ioBackend", options.ioBackend == IoBackend::URING ? "uring" : "epoll")
+        .str("logFormat", options.logFormat == LogFormat::BINARY ? "binary" : "json")
+        .i64("metricsPort", options.metricsPort)
+        .str("tcpPacing", tcpPacingModeToString(options.tcpPacing))
+        .strArray("tcpCcAllow", options.tcpCcAllow)
+        .u64("tcpMaxBufferBytes", options.tcpMaxBufferBytes)
+        .str("serverIface", serverLink.iface)
+        .str("serverLinkType", serverLinkTypeToString(serverLink.type))
+        .u64("serverLinkDownMbps", serverLink.downMbps)
+        .u64("serverLinkUpMbps", serverLink.upMbps);
+
+    std::thread metricsThread;
+    if (metricsFd >= 0) {
+        metricsThread = std::thread([&]() {
+            serveMetrics(metricsFd, running, [&]() { return renderMetrics(counters, activeSessions, logger, options); });
+        });
+    }
 
     std::thread statsThread([&]() {
         uint64_t prevUdpIn = 0;
@@ -795,7 +4988,9 @@ int main(int argc, char* argv[]) {
         uint64_t prevTcpIn = 0;
         uint64_t prevTcpOut = 0;
         while (running.load()) {
-            std::this_thread::sleep_for(std::chrono::seconds(10));
+            for (int slice = 0; slice < 100 && running.load(); ++slice) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
             if (!running.load()) {
                 break;
             }
@@ -803,18 +4998,53 @@ int main(int argc, char* argv[]) {
             uint64_t curUdpOut = counters.udpPacketsOut.load();
             uint64_t curTcpIn = counters.tcpBytesIn.load();
             uint64_t curTcpOut = counters.tcpBytesOut.load();
-
-            logger.log(LogLevel::SUMMARY,
-                       "server_stats",
-                       "\"activeSessions\":" + std::to_string(activeSessions.load()) +
-                           ",\"udpPacketsIn\":" + std::to_string(curUdpIn) +
-                           ",\"udpPacketsOut\":" + std::to_string(curUdpOut) +
-                           ",\"tcpBytesIn\":" + std::to_string(curTcpIn) +
-                           ",\"tcpBytesOut\":" + std::to_string(curTcpOut) +
-                           ",\"udpPacketsInDelta\":" + std::to_string(curUdpIn - prevUdpIn) +
-                           ",\"udpPacketsOutDelta\":" + std::to_string(curUdpOut - prevUdpOut) +
-                           ",\"tcpBytesInDelta\":" + std::to_string(curTcpIn - prevTcpIn) +
-                           ",\"tcpBytesOutDelta\":" + std::to_string(curTcpOut - prevTcpOut));
+            const uint64_t rxDelaySamples = counters.udpRxDelaySamples.exchange(0);
+            const uint64_t rxDelaySumNs = counters.udpRxDelaySumNs.exchange(0);
+            const uint64_t rxDelayAvgUs = rxDelaySamples > 0 ? rxDelaySumNs / rxDelaySamples / 1000ULL : 0;
+
+            LogRecord record(logger, LogLevel::SUMMARY, "server_stats");
+            record.i64("activeSessions", activeSessions.load())
+                .u64("udpPacketsIn", curUdpIn)
+                .u64("udpPacketsOut", curUdpOut)
+                .u64("tcpBytesIn", curTcpIn)
+                .u64("tcpBytesOut", curTcpOut)
+                .u64("udpPacketsInDelta", curUdpIn - prevUdpIn)
+                .u64("udpPacketsOutDelta", curUdpOut - prevUdpOut)
+                .u64("tcpBytesInDelta", curTcpIn - prevTcpIn)
+                .u64("tcpBytesOutDelta", curTcpOut - prevTcpOut)
+                .u64("udpRecvCalls", counters.udpRecvCalls.load())
+                .u64("udpSendCalls", counters.udpSendCalls.load())
+                .u64("udpTxDropped", counters.udpTxDropped.load());
+            logHistogram(record, "udpRxBatchHist", counters.udpRxBatchHist, UDP_BATCH_HIST_BUCKETS);
+            logHistogram(record, "udpTxBatchHist", counters.udpTxBatchHist, UDP_BATCH_HIST_BUCKETS);
+            MetricHistogram syncRespResidence{METRICS_RESIDENCE_BOUNDS_NS, 1e9};
+            MetricHistogram downTickResidence{METRICS_RESIDENCE_BOUNDS_NS, 1e9};
+            mergeUdpWorkerHistogram(counters, &UdpWorkerCounters::syncRespResidence, syncRespResidence);
+            mergeUdpWorkerHistogram(counters, &UdpWorkerCounters::downTickResidence, downTickResidence);
+            logMetricHistogram(record, "syncRespResidenceHist", syncRespResidence);
+            logMetricHistogram(record, "downTickResidenceHist", downTickResidence);
+            MetricHistogram downlinkScheduleDeviation{METRICS_SCHEDULE_DEVIATION_BOUNDS_NS, 1e9};
+            mergeUdpWorkerHistogram(counters, &UdpWorkerCounters::downlinkScheduleDeviation, downlinkScheduleDeviation);
+            logMetricHistogram(record, "downlinkScheduleDeviationHist", downlinkScheduleDeviation);
+            record.u64("syncRespResidenceMaxNs", takeUdpWorkerMax(counters, &UdpWorkerCounters::syncRespResidenceMaxNs))
+                .u64("downTickResidenceMaxNs", takeUdpWorkerMax(counters, &UdpWorkerCounters::downTickResidenceMaxNs))
+                .u64("downlinkScheduleDeviationMaxNs",
+                     takeUdpWorkerMax(counters, &UdpWorkerCounters::downlinkScheduleDeviationMaxNs));
+            record.str("udpWait", options.udpWait == UdpWaitMode::EPOLL ? "epoll" : "sleep")
+                .u64("udpWakeups", counters.udpWakeups.load())
+                .u64("uringEnters", counters.uringEnters.load())
+                .u64("udpRxQueueDelayAvgUs", rxDelayAvgUs)
+                .u64("udpRxQueueDelayMaxUs", counters.udpRxDelayMaxNs.exchange(0) / 1000ULL)
+                .u64("udpTxTimestamps", counters.udpTxTimestamps.load())
+                .u64("udpIdleExpired", counters.udpIdleExpired.load())
+                .u64("udpExpiryUs", counters.udpExpiryNs.exchange(0) / 1000ULL)
+                .u64("udpExpiryMaxUs", counters.udpExpiryMaxNs.exchange(0) / 1000ULL)
+                .u64("logDropped", logger.dropped());
+            if (kAllocationHookEnabled) {
+                record.u64("downTickAllocs", counters.downTickAllocs.load());
+            } else {
+                record.null("downTickAllocs");
+            }
 
             prevUdpIn = curUdpIn;
             prevUdpOut = curUdpOut;
@@ -823,181 +5053,10 @@ int main(int argc, char* argv[]) {
         }
     });
 
-    std::thread tcpAcceptThread([&]() {
-        while (running.load()) {
-            sockaddr_in client{};
-            socklen_t len = sizeof(client);
-            int clientFd = accept(tcpFd, reinterpret_cast<sockaddr*>(&client), &len);
-            if (clientFd < 0) {
-                if (errno == EINTR) {
-                    continue;
-                }
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                continue;
-            }
-
-            if (activeSessions.load() >= options.maxSessions) {
-                std::vector<uint8_t> busyBody;
-                appendLe<uint32_t>(busyBody, 1000U);
-                auto frame = makeTcpFrame(TcpMessageType::BUSY, 0, busyBody);
-                writeAll(clientFd, frame.data(), frame.size());
-                close(clientFd);
-                logger.log(LogLevel::EVENTS,
-                           "session_rejected",
-                           "\"transport\":\"tcp\",\"client\":\"" + jsonEscape(addrToString(client)) +
-                               "\",\"reason\":\"busy\"");
-                continue;
-            }
-
-            activeSessions.fetch_add(1);
-            std::thread([&, clientFd, client]() {
-                auto finish = [&]() {
-                    close(clientFd);
-                    activeSessions.fetch_sub(1);
-                };
-
-                timeval tv{};
-                tv.tv_sec = 1;
-                tv.tv_usec = 0;
-                setsockopt(clientFd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-                setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
-
-                TcpHeader startHeader{};
-                std::vector<uint8_t> startBody;
-                if (!readTcpFrame(clientFd, startHeader, startBody) || startHeader.type != TcpMessageType::START_REQ) {
-                    logger.log(LogLevel::EVENTS,
-                               "session_error",
-                               "\"transport\":\"tcp\",\"client\":\"" + jsonEscape(addrToString(client)) +
-                                   "\",\"reason\":\"invalid_start\"");
-                    finish();
-                    return;
-                }
-
-                size_t offset = 0;
-                uint8_t directionRaw = 0;
-                uint8_t reserved = 0;
-                uint16_t reserved16 = 0;
-                uint32_t durationMs = 0;
-                uint32_t chunkBytes = 0;
-                if (!readLe<uint8_t>(startBody.data(), startBody.size(), offset, directionRaw) ||
-                    !readLe<uint8_t>(startBody.data(), startBody.size(), offset, reserved) ||
-                    !readLe<uint16_t>(startBody.data(), startBody.size(), offset, reserved16) ||
-                    !readLe<uint32_t>(startBody.data(), startBody.size(), offset, durationMs) ||
-                    !readLe<uint32_t>(startBody.data(), startBody.size(), offset, chunkBytes) ||
-                    offset != startBody.size()) {
-                    logger.log(LogLevel::EVENTS,
-                               "session_error",
-                               "\"transport\":\"tcp\",\"sessionId\":" + std::to_string(startHeader.sessionId) +
-                                   ",\"reason\":\"bad_start_payload\"");
-                    finish();
-                    return;
-                }
-
-                if (durationMs < TCP_MIN_DURATION_MS || durationMs > TCP_MAX_DURATION_MS) {
-                    durationMs = 12000;
-                }
-                if (chunkBytes < TCP_MIN_CHUNK_BYTES || chunkBytes > TCP_MAX_CHUNK_BYTES) {
-                    chunkBytes = TCP_DEFAULT_CHUNK_BYTES;
-                }
-
-                auto direction = static_cast<ThroughputDirection>(directionRaw);
-                bool validDirection = direction == ThroughputDirection::DOWNLOAD || direction == ThroughputDirection::UPLOAD;
-
-                std::vector<uint8_t> ackBody;
-                appendLe<uint8_t>(ackBody, static_cast<uint8_t>(validDirection ? 1 : 0));
-                appendLe<uint8_t>(ackBody, 0);
-                appendLe<uint16_t>(ackBody, 0);
-                appendLe<uint32_t>(ackBody, durationMs);
-                appendLe<uint32_t>(ackBody, chunkBytes);
-                appendLe<uint8_t>(ackBody, static_cast<uint8_t>(serverLink.type));
-                appendLe<uint8_t>(ackBody, 0);
-                appendLe<uint16_t>(ackBody, 0);
-                appendLe<uint32_t>(ackBody, serverLink.downMbps);
-                appendLe<uint32_t>(ackBody, serverLink.upMbps);
-                auto ack = makeTcpFrame(TcpMessageType::START_ACK, startHeader.sessionId, ackBody);
-                if (!writeAll(clientFd, ack.data(), ack.size())) {
-                    finish();
-                    return;
-                }
-                if (!validDirection) {
-                    finish();
-                    return;
-                }
-
-                logger.log(LogLevel::SUMMARY,
-                           "session_start",
-                           "\"transport\":\"tcp\",\"sessionId\":" + std::to_string(startHeader.sessionId) +
-                               ",\"client\":\"" + jsonEscape(addrToString(client)) +
-                               "\",\"direction\":\"" + std::string(direction == ThroughputDirection::DOWNLOAD ? "download" : "upload") +
-                               "\",\"durationMs\":" + std::to_string(durationMs) +
-                               ",\"chunkBytes\":" + std::to_string(chunkBytes) +
-                               ",\"serverIface\":\"" + jsonEscape(serverLink.iface) + "\"" +
-                               ",\"serverLinkType\":\"" + jsonEscape(serverLinkTypeToString(serverLink.type)) + "\"" +
-                               ",\"serverLinkDownMbps\":" + std::to_string(serverLink.downMbps) +
-                               ",\"serverLinkUpMbps\":" + std::to_string(serverLink.upMbps));
-
-                const uint64_t startNs = nowNs();
-                uint64_t transferredBytes = 0;
-
-                if (direction == ThroughputDirection::DOWNLOAD) {
-                    std::vector<uint8_t> payload(chunkBytes);
-                    uint8_t seed = static_cast<uint8_t>(startHeader.sessionId & 0xFF);
-                    for (uint32_t i = 0; i < chunkBytes; ++i) {
-                        payload[i] = static_cast<uint8_t>(seed + i);
-                    }
-
-                    const uint64_t deadlineNs = startNs + static_cast<uint64_t>(durationMs) * 1000000ULL;
-                    while (running.load() && nowNs() < deadlineNs) {
-                        auto dataFrame = makeTcpFrame(TcpMessageType::DATA, startHeader.sessionId, payload);
-                        if (!writeAll(clientFd, dataFrame.data(), dataFrame.size())) {
-                            break;
-                        }
-                        transferredBytes += payload.size();
-                        counters.tcpBytesOut.fetch_add(payload.size());
-                    }
-                } else {
-                    const uint64_t deadlineNs = startNs + static_cast<uint64_t>(durationMs) * 1000000ULL;
-                    while (running.load() && nowNs() < deadlineNs) {
-                        TcpHeader frameHeader{};
-                        std::vector<uint8_t> frameBody;
-                        if (!readTcpFrame(clientFd, frameHeader, frameBody)) {
-                            continue;
-                        }
-                        if (frameHeader.sessionId != startHeader.sessionId) {
-                            continue;
-                        }
-                        if (frameHeader.type == TcpMessageType::DATA) {
-                            transferredBytes += frameBody.size();
-                            counters.tcpBytesIn.fetch_add(frameBody.size());
-                        } else if (frameHeader.type == TcpMessageType::STOP) {
-                            break;
-                        }
-                    }
-                }
-
-                const uint64_t endNs = nowNs();
-                const uint64_t durationNs = endNs > startNs ? (endNs - startNs) : 1ULL;
-
-                std::vector<uint8_t> resultBody;
-                appendLe<uint64_t>(resultBody, transferredBytes);
-                appendLe<uint64_t>(resultBody, durationNs);
-                auto resultFrame = makeTcpFrame(TcpMessageType::RESULT, startHeader.sessionId, resultBody);
-                writeAll(clientFd, resultFrame.data(), resultFrame.size());
-
-                logger.log(LogLevel::SUMMARY,
-                           "session_end",
-                           "\"transport\":\"tcp\",\"sessionId\":" + std::to_string(startHeader.sessionId) +
-                               ",\"client\":\"" + jsonEscape(addrToString(client)) +
-                               "\",\"bytes\":" + std::to_string(transferredBytes) +
-                               ",\"durationNs\":" + std::to_string(durationNs));
-
-                finish();
-            }).detach();
-        }
-    });
-
     std::cout << "SpeedTestGamer server running on port " << options.port
               << " (UDP v2 + TCP throughput), maxSessions=" << options.maxSessions
+              << ", udpWorkers=" << options.udpWorkers
+              << ", tcpWorkers=" << options.tcpWorkers
               << ", iface=" << (serverLink.iface.empty() ? "n/a" : serverLink.iface)
               << ", link=" << serverLinkTypeToString(serverLink.type)
               << ", theoretical=" << serverLink.downMbps << "/" << serverLink.upMbps << " Mbps"
@@ -1009,304 +5068,51 @@ int main(int argc, char* argv[]) {
         std::cout << "  - " << endpoint << std::endl;
     }
 
-    uint64_t lastCleanupNs = nowNs();
-
-    while (running.load()) {
-        bool anyPacket = false;
-        while (true) {
-            uint8_t buffer[UDP_MAX_DATAGRAM_BYTES];
-            sockaddr_in client{};
-            socklen_t clientLen = sizeof(client);
-            ssize_t n = recvfrom(udpFd,
-                                 buffer,
-                                 sizeof(buffer),
-                                 0,
-                                 reinterpret_cast<sockaddr*>(&client),
-                                 &clientLen);
-            if (n < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    break;
-                }
-                if (errno == EINTR) {
-                    continue;
-                }
-                perror("recvfrom UDP");
-                break;
-            }
-            anyPacket = true;
-            counters.udpPacketsIn.fetch_add(1);
-
-            if (n < 12) {
-                continue;
-            }
-
-            UdpHeader header{};
-            if (!parseUdpHeader(buffer, static_cast<size_t>(n), header)) {
-                continue;
-            }
-            if (header.version != UDP_PROTOCOL_VERSION) {
-                continue;
-            }
-
-            const uint8_t* body = buffer + 12;
-            const size_t bodySize = static_cast<size_t>(n) - 12;
-
-            UdpSessionKey key{header.sessionId, client.sin_addr.s_addr, client.sin_port};
-
-            if (header.type == UdpMessageType::SYNC_REQ) {
-                size_t offset = 0;
-                uint64_t clientSendNs = 0;
-                if (!readLe<uint64_t>(body, bodySize, offset, clientSendNs) || offset != bodySize) {
-                    continue;
-                }
-
-                const uint64_t recvNs = nowNs();
-                const uint64_t sendNs = nowNs();
-                std::vector<uint8_t> responseBody;
-                appendLe<uint64_t>(responseBody, clientSendNs);
-                appendLe<uint64_t>(responseBody, recvNs);
-                appendLe<uint64_t>(responseBody, sendNs);
-                auto packet = makeUdpPacket(UdpMessageType::SYNC_RESP, header.sessionId, header.seq, responseBody);
-                sendto(udpFd, packet.data(), packet.size(), 0, reinterpret_cast<sockaddr*>(&client), clientLen);
-                counters.udpPacketsOut.fetch_add(1);
-                continue;
-            }
-
-            if (header.type == UdpMessageType::TEST_START_REQ) {
-                size_t offset = 0;
-                uint8_t runMode = 0;
-                uint8_t pad = 0;
-                uint16_t pad16 = 0;
-                uint32_t tickMs = 0;
-                uint32_t durationMs = 0;
-                uint32_t packetCount = 0;
-                uint32_t payloadUpBytes = 0;
-                uint32_t payloadDownBytes = 0;
-
-                if (!readLe<uint8_t>(body, bodySize, offset, runMode) ||
-                    !readLe<uint8_t>(body, bodySize, offset, pad) ||
-                    !readLe<uint16_t>(body, bodySize, offset, pad16) ||
-                    !readLe<uint32_t>(body, bodySize, offset, tickMs) ||
-                    !readLe<uint32_t>(body, bodySize, offset, durationMs) ||
-                    !readLe<uint32_t>(body, bodySize, offset, packetCount) ||
-                    !readLe<uint32_t>(body, bodySize, offset, payloadUpBytes) ||
-                    !readLe<uint32_t>(body, bodySize, offset, payloadDownBytes) ||
-                    offset != bodySize) {
-                    continue;
-                }
-
-                bool accepted = true;
-                uint32_t acceptedTick = options.tickOverrideMs > 0 ? static_cast<uint32_t>(options.tickOverrideMs) : tickMs;
-                if (acceptedTick < UDP_MIN_TICK_MS || acceptedTick > UDP_MAX_TICK_MS) {
-                    accepted = false;
-                }
-
-                if (payloadUpBytes > UDP_MAX_PAYLOAD_BYTES || payloadDownBytes > UDP_MAX_PAYLOAD_BYTES) {
-                    accepted = false;
-                }
-
-                uint32_t resolvedCount = packetCount;
-                if (runMode == 0) {
-                    if (durationMs < acceptedTick) {
-                        durationMs = acceptedTick;
-                    }
-                    resolvedCount = static_cast<uint32_t>(
-                        std::ceil(static_cast<double>(durationMs) / static_cast<double>(acceptedTick)));
-                }
-                if (resolvedCount == 0 || resolvedCount > UDP_MAX_PACKET_COUNT) {
-                    accepted = false;
-                }
-
-                {
-                    std::lock_guard<std::mutex> lock(udpMutex);
-                    bool alreadyExists = udpSessions.find(key) != udpSessions.end();
-                    if (accepted && !alreadyExists && activeSessions.load() >= options.maxSessions) {
-                        accepted = false;
-                    }
-
-                    if (accepted) {
-                        UdpSession& session = udpSessions[key];
-                        if (!alreadyExists) {
-                            activeSessions.fetch_add(1);
-                        }
-                        session.sessionId = header.sessionId;
-                        session.client = client;
-                        session.tickMs = acceptedTick;
-                        session.expectedCount = resolvedCount;
-                        session.payloadUpBytes = payloadUpBytes;
-                        session.payloadDownBytes = payloadDownBytes;
-                        session.upReceivedCount = 0;
-                        session.downSentCount = 0;
-                        session.upOutOfOrderCount = 0;
-                        session.maxSeqSeen = -1;
-                        session.upBitmap.assign((resolvedCount + 7U) / 8U, 0);
-                        session.startedNs = nowNs();
-                        session.lastActivityNs = session.startedNs;
-
-                        logger.log(LogLevel::SUMMARY,
-                                   "session_start",
-                                   "\"transport\":\"udp\",\"session\":\"" + jsonEscape(safeSessionTag(header.sessionId, client)) +
-                                       "\",\"tickMs\":" + std::to_string(acceptedTick) +
-                                       ",\"resolvedCount\":" + std::to_string(resolvedCount) +
-                                       ",\"payloadUp\":" + std::to_string(payloadUpBytes) +
-                                       ",\"payloadDown\":" + std::to_string(payloadDownBytes));
-                    }
-                }
-
-                std::vector<uint8_t> ackBody;
-                appendLe<uint32_t>(ackBody, acceptedTick);
-                appendLe<uint32_t>(ackBody, resolvedCount);
-                appendLe<uint32_t>(ackBody, payloadUpBytes);
-                appendLe<uint32_t>(ackBody, payloadDownBytes);
-                appendLe<uint8_t>(ackBody, static_cast<uint8_t>(accepted ? 1 : 0));
-                appendLe<uint8_t>(ackBody, 0);
-                appendLe<uint8_t>(ackBody, 0);
-                appendLe<uint8_t>(ackBody, 0);
-                auto ack = makeUdpPacket(UdpMessageType::TEST_START_ACK, header.sessionId, header.seq, ackBody);
-                sendto(udpFd, ack.data(), ack.size(), 0, reinterpret_cast<sockaddr*>(&client), clientLen);
-                counters.udpPacketsOut.fetch_add(1);
-                continue;
-            }
-
-            if (header.type == UdpMessageType::UP_TICK) {
-                size_t offset = 0;
-                uint64_t clientSendNs = 0;
-                uint32_t payloadSize = 0;
-                if (!readLe<uint64_t>(body, bodySize, offset, clientSendNs) ||
-                    !readLe<uint32_t>(body, bodySize, offset, payloadSize) ||
-                    payloadSize > UDP_MAX_PAYLOAD_BYTES ||
-                    offset + payloadSize != bodySize) {
-                    continue;
-                }
-
-                UdpSession snapshot;
-                bool hasSession = false;
-                uint32_t flags = 0;
-                uint64_t recvNs = nowNs();
-
-                {
-                    std::lock_guard<std::mutex> lock(udpMutex);
-                    auto it = udpSessions.find(key);
-                    if (it == udpSessions.end()) {
-                        continue;
-                    }
-                    UdpSession& session = it->second;
-                    session.lastActivityNs = recvNs;
-                    uint32_t seq = header.seq;
-                    if (seq < session.expectedCount) {
-                        const size_t byteIndex = seq / 8U;
-                        const uint8_t bit = static_cast<uint8_t>(1U << (seq % 8U));
-                        if ((session.upBitmap[byteIndex] & bit) == 0) {
-                            session.upBitmap[byteIndex] |= bit;
-                            session.upReceivedCount += 1;
-                        }
-
-                        const bool outOfOrder = session.maxSeqSeen >= 0 && static_cast<int64_t>(seq) < session.maxSeqSeen;
-                        if (outOfOrder) {
-                            session.upOutOfOrderCount += 1;
-                            flags |= 0x1U;
-                        }
-                        if (static_cast<int64_t>(seq) > session.maxSeqSeen) {
-                            session.maxSeqSeen = static_cast<int64_t>(seq);
-                        }
-                        session.downSentCount += 1;
-                        snapshot = session;
-                        hasSession = true;
-                    }
-                }
-
-                if (!hasSession) {
-                    continue;
-                }
-
-                std::vector<uint8_t> downPayload(snapshot.payloadDownBytes);
-                std::fill(downPayload.begin(), downPayload.end(), static_cast<uint8_t>(header.seq & 0xFF));
-
-                const uint64_t sendNs = nowNs();
-                std::vector<uint8_t> downBody;
-                appendLe<uint64_t>(downBody, clientSendNs);
-                appendLe<uint64_t>(downBody, recvNs);
-                appendLe<uint64_t>(downBody, sendNs);
-                appendLe<uint32_t>(downBody, flags);
-                appendLe<uint32_t>(downBody, static_cast<uint32_t>(downPayload.size()));
-                downBody.insert(downBody.end(), downPayload.begin(), downPayload.end());
-
-                auto down = makeUdpPacket(UdpMessageType::DOWN_TICK, header.sessionId, header.seq, downBody);
-                sendto(udpFd, down.data(), down.size(), 0, reinterpret_cast<sockaddr*>(&client), clientLen);
-                counters.udpPacketsOut.fetch_add(1);
-                continue;
-            }
-
-            if (header.type == UdpMessageType::TEST_END_REQ) {
-                UdpSession session;
-                bool hasSession = false;
-
-                {
-                    std::lock_guard<std::mutex> lock(udpMutex);
-                    auto it = udpSessions.find(key);
-                    if (it == udpSessions.end()) {
-                        continue;
-                    }
-                    session = it->second;
-                    hasSession = true;
-                }
-
-                if (!hasSession) {
-                    continue;
-                }
-
-                std::vector<uint8_t> summaryBody;
-                appendLe<uint32_t>(summaryBody, session.expectedCount);
-                appendLe<uint32_t>(summaryBody, session.upReceivedCount);
-                appendLe<uint32_t>(summaryBody, session.downSentCount);
-                appendLe<uint32_t>(summaryBody, session.upOutOfOrderCount);
-                appendLe<uint32_t>(summaryBody, static_cast<uint32_t>(session.upBitmap.size()));
-                summaryBody.insert(summaryBody.end(), session.upBitmap.begin(), session.upBitmap.end());
-
-                auto summary = makeUdpPacket(UdpMessageType::TEST_END_SUMMARY, header.sessionId, header.seq, summaryBody);
-                sendto(udpFd, summary.data(), summary.size(), 0, reinterpret_cast<sockaddr*>(&client), clientLen);
-                counters.udpPacketsOut.fetch_add(1);
-
-                removeUdpSession(key, "client_end");
-                continue;
-            }
-        }
+    std::vector<std::unique_ptr<UdpWorker>> udpWorkers;
+    for (int i = 0; i < options.udpWorkers; ++i) {
+        udpWorkers.push_back(std::make_unique<UdpWorker>(
+            i, udpFds[static_cast<size_t>(i)], options, counters, logger, activeSessions, running));
+    }
+    std::vector<std::thread> udpThreads;
+    for (size_t i = 1; i < udpWorkers.size(); ++i) {
+        udpThreads.emplace_back([&udpWorkers, i]() { udpWorkers[i]->run(); });
+    }
+    TcpStreamGroups tcpGroups(activeSessions, options.maxSessions);
+    std::vector<std::unique_ptr<TcpWorker>> tcpWorkers;
+    for (int i = 0; i < options.tcpWorkers; ++i) {
+        tcpWorkers.push_back(std::make_unique<TcpWorker>(
+            i, tcpFd, options, serverLink, counters, logger, tcpGroups, activeSessions, running));
+    }
+    std::vector<std::thread> tcpThreads;
+    for (auto& worker : tcpWorkers) {
+        tcpThreads.emplace_back([&worker]() { worker->run(); });
+    }
+    udpWorkers[0]->run();
 
-        const uint64_t now = nowNs();
-        if (now - lastCleanupNs >= 1000000000ULL) {
-            lastCleanupNs = now;
-            std::vector<UdpSessionKey> toRemove;
-            {
-                std::lock_guard<std::mutex> lock(udpMutex);
-                for (const auto& entry : udpSessions) {
-                    const UdpSession& session = entry.second;
-                    uint64_t idleMs = (now > session.lastActivityNs) ? (now - session.lastActivityNs) / 1000000ULL : 0;
-                    if (idleMs > static_cast<uint64_t>(SESSION_IDLE_TIMEOUT_MS)) {
-                        toRemove.push_back(entry.first);
-                    }
-                }
-            }
-            for (const auto& key : toRemove) {
-                removeUdpSession(key, "idle_timeout");
-            }
+    running.store(false);
+    for (auto& thread : udpThreads) {
+        if (thread.joinable()) {
+            thread.join();
         }
-
-        if (!anyPacket) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    for (auto& thread : tcpThreads) {
+        if (thread.joinable()) {
+            thread.join();
         }
     }
-
-    running.store(false);
     close(tcpFd);
-    close(udpFd);
-
-    if (tcpAcceptThread.joinable()) {
-        tcpAcceptThread.join();
+    for (int fd : udpFds) {
+        close(fd);
     }
+
     if (statsThread.joinable()) {
         statsThread.join();
     }
+    if (metricsThread.joinable()) {
+        metricsThread.join();
+        close(metricsFd);
+    }
 
-    logger.log(LogLevel::SUMMARY, "server_stop", "");
+    LogRecord(logger, LogLevel::SUMMARY, "server_stop").u64("logDropped", logger.dropped());
     return 0;
 }
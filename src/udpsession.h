@@ -0,0 +1,261 @@
+#ifndef SPEEDTEST_UDPSESSION_H
+#define SPEEDTEST_UDPSESSION_H
+
+// Estado de una sesión UDP v2 y la tabla de sesiones de cada worker del server. Separado de server.cpp para que
+// los microbenchmarks (make bench) midan la misma tabla que usa el camino caliente.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <netinet/in.h>
+#include <vector>
+
+#include "protocol.h"
+
+constexpr uint32_t LATENCY_HIST_SUB_BITS = 4;  // 16 sub-buckets por potencia de 2: error relativo < 6.25%
+constexpr uint32_t LATENCY_HIST_MAX_BITS = 26; // hasta 2^26 µs (~67 s); lo que excede va al último bucket
+constexpr size_t LATENCY_HIST_BUCKETS = (LATENCY_HIST_MAX_BITS - LATENCY_HIST_SUB_BITS + 1) << LATENCY_HIST_SUB_BITS;
+
+struct UdpSessionKey {
+    uint32_t sessionId;
+    uint32_t ip;
+    uint16_t port;
+
+    bool operator==(const UdpSessionKey& other) const {
+        return sessionId == other.sessionId && ip == other.ip && port == other.port;
+    }
+};
+
+// Mezcla de 64 bits (finalizador de splitmix64) sobre (sessionId, ip, port): dispersa bien aunque los
+// sessionId sean consecutivos y muchos clientes compartan IP detrás de un NAT.
+inline uint64_t hashUdpSessionKey(const UdpSessionKey& key) {
+    uint64_t h = (static_cast<uint64_t>(key.sessionId) << 32U) | key.ip;
+    h ^= static_cast<uint64_t>(key.port) * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 30U;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27U;
+    h *= 0x94D049BB133111EBULL;
+    h ^= h >> 31U;
+    return h;
+}
+
+constexpr size_t UDP_BITMAP_BYTES = (UDP_MAX_PACKET_COUNT + 7U) / 8U;
+
+// Histograma log-lineal de memoria fija (estilo HdrHistogram) en microsegundos: exacto hasta 16 µs y después
+// 16 sub-buckets por potencia de 2. record() es un clz, dos shifts y un incremento.
+class LatencyHistogram {
+public:
+    void clear() {
+        std::memset(counts_, 0, sizeof(counts_));
+        total_ = 0;
+        max_ = 0;
+    }
+
+    void record(uint64_t valueUs) {
+        counts_[indexOf(valueUs)] += 1;
+        total_ += 1;
+        max_ = std::max(max_, valueUs);
+    }
+
+    // Suma deltaUs a todos los valores ya registrados: cada bucket se mueve con su punto medio. Se usa cuando
+    // cambia la base de una medición relativa (un nuevo mínimo), algo que pasa pocas veces por sesión.
+    void shift(uint64_t deltaUs) {
+        if (deltaUs == 0 || total_ == 0) {
+            return;
+        }
+        for (size_t i = LATENCY_HIST_BUCKETS; i-- > 0;) {
+            if (counts_[i] == 0) {
+                continue;
+            }
+            const size_t target = indexOf((lowerBound(i) + upperBound(i)) / 2 + deltaUs);
+            if (target != i) {
+                counts_[target] += counts_[i];
+                counts_[i] = 0;
+            }
+        }
+        max_ += deltaUs;
+    }
+
+    // Mayor valor equivalente del bucket que contiene el percentil, acotado por el máximo exacto.
+    uint64_t percentile(double p) const {
+        if (total_ == 0) {
+            return 0;
+        }
+        const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p / 100.0 * static_cast<double>(total_))));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < LATENCY_HIST_BUCKETS; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return std::min(upperBound(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t max() const { return max_; }
+
+private:
+    static size_t indexOf(uint64_t value) {
+        constexpr uint64_t subCount = 1ULL << LATENCY_HIST_SUB_BITS;
+        if (value < subCount) {
+            return static_cast<size_t>(value);
+        }
+        const uint32_t msb = 63U - static_cast<uint32_t>(__builtin_clzll(value));
+        if (msb >= LATENCY_HIST_MAX_BITS) {
+            return LATENCY_HIST_BUCKETS - 1;
+        }
+        const uint32_t shiftBits = msb - LATENCY_HIST_SUB_BITS;
+        return static_cast<size_t>(((shiftBits + 1) << LATENCY_HIST_SUB_BITS) + ((value >> shiftBits) - subCount));
+    }
+
+    static uint64_t lowerBound(size_t index) {
+        constexpr uint64_t subCount = 1ULL << LATENCY_HIST_SUB_BITS;
+        const uint64_t group = index >> LATENCY_HIST_SUB_BITS;
+        if (group == 0) {
+            return index;
+        }
+        return (subCount + (index & (subCount - 1))) << (group - 1);
+    }
+
+    static uint64_t upperBound(size_t index) {
+        const uint64_t group = index >> LATENCY_HIST_SUB_BITS;
+        return lowerBound(index) + (group == 0 ? 0 : (1ULL << (group - 1)) - 1);
+    }
+
+    uint32_t counts_[LATENCY_HIST_BUCKETS];
+    uint64_t total_ = 0;
+    uint64_t max_ = 0;
+};
+
+// Los campos que toca cada UP_TICK van primero para que caigan en la primera línea de cache del slot.
+struct alignas(64) UdpSession {
+    UdpSessionKey key{};
+    uint32_t expectedCount = 0;
+    uint32_t upReceivedCount = 0;
+    uint32_t downSentCount = 0;
+    uint32_t upOutOfOrderCount = 0;
+    int64_t maxSeqSeen = -1;
+    uint64_t lastActivityNs = 0;
+    uint32_t payloadDownBytes = 64;
+    uint8_t features = 0;
+    uint32_t lastTxSeq = 0;
+    uint64_t lastTxNs = 0;
+    uint32_t sessionId = 0;
+    uint32_t tickMs = 15;
+    uint32_t payloadUpBytes = 64;
+    uint32_t upBitmapBytes = 0;
+    uint64_t startedNs = 0;
+    sockaddr_in client{};
+    uint32_t wheelPrev = UINT32_MAX;
+    uint32_t wheelNext = UINT32_MAX;
+    uint32_t wheelBucket = UINT32_MAX;
+    int64_t lastArrivalSeq = -1;
+    uint64_t lastArrivalNs = 0;
+    bool upDelayBaseSet = false;
+    int64_t upDelayBaseNs = 0; // mínimo de recvNs - clientSendNs: absorbe el offset entre relojes
+    uint8_t runMode = 0;
+    uint32_t nextDownSeq = 0;
+    uint64_t downStreamStartNs = 0; // instante agendado del DOWN_TICK seq 0 del stream
+    uint8_t upBitmap[UDP_BITMAP_BYTES];
+    LatencyHistogram upDelayHist;        // recvNs - clientSendNs sobre el mínimo de la sesión
+    LatencyHistogram interArrivalHist;   // |llegada - llegada anterior - saltos de seq * tick|
+    LatencyHistogram downDeviationHist;  // envío - instante agendado de cada DOWN_TICK del stream
+};
+
+// Tabla de sesiones de un worker: slab de `capacity` slots preasignado al arrancar más un índice de
+// direccionamiento abierto (linear probing, borrado por backward shift). Insertar y borrar no usan el heap.
+class UdpSessionTable {
+public:
+    explicit UdpSessionTable(size_t capacity) : slots_(capacity) {
+        size_t indexSize = 16;
+        while (indexSize < capacity * 2) {
+            indexSize <<= 1U;
+        }
+        index_.assign(indexSize, IndexEntry{});
+        mask_ = indexSize - 1;
+        freeSlots_.reserve(capacity);
+        for (size_t i = capacity; i > 0; --i) {
+            freeSlots_.push_back(static_cast<uint32_t>(i - 1));
+        }
+    }
+
+    UdpSession* find(const UdpSessionKey& key) {
+        for (size_t pos = hashUdpSessionKey(key) & mask_;; pos = (pos + 1) & mask_) {
+            const IndexEntry& entry = index_[pos];
+            if (entry.slot == EMPTY) {
+                return nullptr;
+            }
+            if (entry.key == key) {
+                return &slots_[entry.slot];
+            }
+        }
+    }
+
+    // Devuelve el slot de la sesión (nuevo o existente); nullptr si el slab está lleno.
+    UdpSession* insert(const UdpSessionKey& key) {
+        size_t pos = hashUdpSessionKey(key) & mask_;
+        for (;; pos = (pos + 1) & mask_) {
+            IndexEntry& entry = index_[pos];
+            if (entry.slot == EMPTY) {
+                break;
+            }
+            if (entry.key == key) {
+                return &slots_[entry.slot];
+            }
+        }
+        if (freeSlots_.empty()) {
+            return nullptr;
+        }
+        const uint32_t slot = freeSlots_.back();
+        freeSlots_.pop_back();
+        index_[pos].key = key;
+        index_[pos].slot = slot;
+        slots_[slot].key = key;
+        return &slots_[slot];
+    }
+
+    void erase(const UdpSessionKey& key) {
+        size_t pos = hashUdpSessionKey(key) & mask_;
+        for (;; pos = (pos + 1) & mask_) {
+            if (index_[pos].slot == EMPTY) {
+                return;
+            }
+            if (index_[pos].key == key) {
+                break;
+            }
+        }
+        freeSlots_.push_back(index_[pos].slot);
+
+        // Backward shift: corre hacia atrás las entradas del mismo cluster que quedarían inalcanzables.
+        size_t hole = pos;
+        for (size_t next = (hole + 1) & mask_; index_[next].slot != EMPTY; next = (next + 1) & mask_) {
+            const size_t home = hashUdpSessionKey(index_[next].key) & mask_;
+            if (((next - home) & mask_) >= ((next - hole) & mask_)) {
+                index_[hole] = index_[next];
+                hole = next;
+            }
+        }
+        index_[hole] = IndexEntry{};
+    }
+
+    UdpSession& at(uint32_t slot) { return slots_[slot]; }
+    uint32_t slotOf(const UdpSession& session) const { return static_cast<uint32_t>(&session - slots_.data()); }
+
+private:
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    struct IndexEntry {
+        UdpSessionKey key{};
+        uint32_t slot = EMPTY;
+    };
+
+    std::vector<UdpSession> slots_;
+    std::vector<IndexEntry> index_;
+    std::vector<uint32_t> freeSlots_;
+    size_t mask_ = 0;
+};
+
+#endif